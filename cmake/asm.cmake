@@ -0,0 +1,147 @@
+# Links a program without the OS into Hack assembly, checks that every symbol it uses is a label,
+# a predefined symbol or a static and runs it on a Hack CPU, then checks that calls into a missing OS
+# are a link error.
+# Invoked by ctest with:
+#   -DCOMPILER=<path> -DSOURCE=<tests/Seven> -DWORK=<scratch dir>
+
+file(REMOVE_RECURSE ${WORK})
+file(WRITE ${WORK}/Standalone/Main.jack
+        "class Main {\n    static int total;\n"
+        "    function int add(int a, int b) { return a + b; }\n"
+        "    function void main() {\n        var int i;\n"
+        "        while(i < 10) {\n            let total = Main.add(total, i);\n            let i = i + 1;\n        }\n"
+        "        if(total > -30000) {\n            let total = -total;\n        }\n        return;\n    }\n}\n")
+
+execute_process(COMMAND ${COMPILER} --asm ${WORK}/Standalone RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Linking a program without OS calls failed:\n${errors}")
+endif()
+
+# Assembles Standalone.asm, every symbol must be a label, a predefined symbol or a static
+file(READ ${WORK}/Standalone/Standalone.asm source)
+string(REPLACE ";" ":" source "${source}")
+string(REPLACE "\n" ";" lines "${source}")
+set(labels SP LCL ARG THIS THAT SCREEN KBD)
+set(addresses 0 1 2 3 4 16384 24576)
+set(instructions)
+foreach(line ${lines})
+    if(line MATCHES "^\\((.+)\\)$")
+        list(APPEND labels "${CMAKE_MATCH_1}")
+        list(LENGTH instructions address)
+        list(APPEND addresses ${address})
+    elseif(NOT line STREQUAL "")
+        list(APPEND instructions "${line}")
+    endif()
+endforeach()
+
+set(rom)
+set(next_static 16)
+foreach(line ${instructions})
+    if(NOT line MATCHES "^@(.+)$")
+        # dest=comp:jump becomes dest:comp:jump
+        if(NOT line MATCHES "=")
+            set(line "=${line}")
+        endif()
+        if(NOT line MATCHES ":")
+            set(line "${line}:")
+        endif()
+        string(REPLACE "=" ":" line "${line}")
+        list(APPEND rom "${line}")
+        continue()
+    endif()
+
+    set(symbol ${CMAKE_MATCH_1})
+    list(FIND labels "${symbol}" found)
+    if(symbol MATCHES "^[0-9]+$")
+        list(APPEND rom ${symbol})
+    elseif(symbol MATCHES "^R([0-9]+)$")
+        list(APPEND rom ${CMAKE_MATCH_1})
+    elseif(NOT found EQUAL -1)
+        list(GET addresses ${found} address)
+        list(APPEND rom ${address})
+    elseif(symbol MATCHES "^[A-Za-z_]+\\.[0-9]+$")
+        list(APPEND labels "${symbol}")
+        list(APPEND addresses ${next_static})
+        list(APPEND rom ${next_static})
+        math(EXPR next_static "${next_static} + 1")
+    else()
+        message(FATAL_ERROR "Standalone.asm uses the undefined symbol ${symbol}")
+    endif()
+endforeach()
+
+# Runs it on a Hack CPU until it jumps to itself, words are kept as signed 16 bit numbers
+function(memory_read address result)
+    if(DEFINED ram_${address})
+        set(${result} ${ram_${address}} PARENT_SCOPE)
+    else()
+        set(${result} 0 PARENT_SCOPE)
+    endif()
+endfunction()
+
+set(a 0)
+set(d 0)
+set(pc 0)
+set(steps 0)
+set(halted OFF)
+while(NOT halted)
+    math(EXPR steps "${steps} + 1")
+    if(steps GREATER 100000)
+        message(FATAL_ERROR "Standalone.asm did not halt")
+    endif()
+
+    list(GET rom ${pc} instruction)
+    if(instruction MATCHES "^[0-9]+$")
+        set(a ${instruction})
+        math(EXPR pc "${pc} + 1")
+        continue()
+    endif()
+
+    string(REGEX MATCH "^([^:]*):([^:]*):([^:]*)$" fields "${instruction}")
+    set(dest "${CMAKE_MATCH_1}")
+    set(comp "${CMAKE_MATCH_2}")
+    set(jump "${CMAKE_MATCH_3}")
+    math(EXPR address "${a} & 32767")
+    memory_read(${address} m)
+    string(REPLACE "!" "~" comp "${comp}")
+    string(REPLACE "A" "(${a})" comp "${comp}")
+    string(REPLACE "D" "(${d})" comp "${comp}")
+    string(REPLACE "M" "(${m})" comp "${comp}")
+    math(EXPR value "((${comp}) + 32768 & 65535) - 32768")
+
+    if(dest MATCHES "M")
+        set(ram_${address} ${value})
+    endif()
+    if(dest MATCHES "A")
+        set(a ${value})
+    endif()
+    if(dest MATCHES "D")
+        set(d ${value})
+    endif()
+
+    if(jump STREQUAL "JMP" OR (jump MATCHES "^J(GT|GE|NE)$" AND value GREATER 0)
+            OR (jump MATCHES "^J(EQ|GE|LE)$" AND value EQUAL 0) OR (jump MATCHES "^J(LT|NE|LE)$" AND value LESS 0))
+        math(EXPR previous "${pc} - 1")
+        if(jump STREQUAL "JMP" AND a EQUAL previous)
+            set(halted ON)
+        endif()
+        set(pc ${a})
+    else()
+        math(EXPR pc "${pc} + 1")
+    endif()
+endwhile()
+
+list(FIND labels Main.0 found)
+list(GET addresses ${found} address)
+memory_read(${address} total)
+if(NOT total EQUAL -45)
+    message(FATAL_ERROR "Standalone.asm ended with total = ${total} after ${steps} steps, expected -45")
+endif()
+
+file(COPY ${SOURCE}/ DESTINATION ${WORK}/Seven)
+execute_process(COMMAND ${COMPILER} --asm ${WORK}/Seven RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 1 OR NOT errors MATCHES "Output\\.printInt")
+    message(FATAL_ERROR "Expected a link error naming Output.printInt, got status ${status}:\n${errors}")
+endif()
+if(EXISTS ${WORK}/Seven/Seven.asm)
+    message(FATAL_ERROR "A failed link wrote Seven.asm")
+endif()
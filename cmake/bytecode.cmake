@@ -0,0 +1,59 @@
+# Round trips every tests/ program through the bytecode tools: each .vm encoded by vm2bin and decoded
+# by bin2vm, and each .vmb written by --binary decoded by bin2vm, must match the compiler's .vm text.
+# Also checks that vm2bin rejects an index that does not fit 16 bits. Invoked by ctest with:
+#   -DCOMPILER=<path> -DVM2BIN=<path> -DBIN2VM=<path> -DSOURCE=<tests dir> -DWORK=<scratch dir>
+
+file(REMOVE_RECURSE ${WORK})
+file(GLOB programs LIST_DIRECTORIES true ${SOURCE}/*)
+
+foreach(program ${programs})
+    if(NOT IS_DIRECTORY ${program})
+        continue()
+    endif()
+    get_filename_component(name ${program} NAME)
+    file(COPY ${program}/ DESTINATION ${WORK}/text/${name})
+    file(COPY ${program}/ DESTINATION ${WORK}/binary/${name})
+
+    execute_process(COMMAND ${COMPILER} ${WORK}/text/${name} RESULT_VARIABLE status ERROR_VARIABLE errors)
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "Compilation of ${program} failed:\n${errors}")
+    endif()
+    execute_process(COMMAND ${COMPILER} --binary ${WORK}/binary/${name} RESULT_VARIABLE status ERROR_VARIABLE errors)
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "Binary compilation of ${program} failed:\n${errors}")
+    endif()
+
+    file(GLOB vm_files ${WORK}/text/${name}/*.vm)
+    foreach(vm_file ${vm_files})
+        get_filename_component(class ${vm_file} NAME_WE)
+        set(encoded ${WORK}/text/${name}/${class}.vmb)
+        set(decoded ${WORK}/text/${name}/${class}.decoded.vm)
+        set(compiled ${WORK}/binary/${name}/${class}.vmb)
+        set(compiled_decoded ${WORK}/binary/${name}/${class}.decoded.vm)
+
+        execute_process(COMMAND ${VM2BIN} ${vm_file} ${encoded} RESULT_VARIABLE status ERROR_VARIABLE errors)
+        if(NOT status EQUAL 0)
+            message(FATAL_ERROR "vm2bin ${vm_file} failed:\n${errors}")
+        endif()
+        foreach(pair "${encoded}|${decoded}" "${compiled}|${compiled_decoded}")
+            string(REPLACE "|" ";" pair "${pair}")
+            list(GET pair 0 input)
+            list(GET pair 1 output)
+            execute_process(COMMAND ${BIN2VM} ${input} ${output} RESULT_VARIABLE status ERROR_VARIABLE errors)
+            if(NOT status EQUAL 0)
+                message(FATAL_ERROR "bin2vm ${input} failed:\n${errors}")
+            endif()
+
+            execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${vm_file} ${output} RESULT_VARIABLE different)
+            if(different)
+                message(FATAL_ERROR "${output} differs from ${vm_file}")
+            endif()
+        endforeach()
+    endforeach()
+endforeach()
+
+file(WRITE ${WORK}/Wide.vm "push constant 65536\n")
+execute_process(COMMAND ${VM2BIN} ${WORK}/Wide.vm ${WORK}/Wide.vmb RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 1 OR NOT errors MATCHES "Index out of range")
+    message(FATAL_ERROR "Expected vm2bin to reject index 65536, got status ${status}:\n${errors}")
+endif()
@@ -0,0 +1,41 @@
+# Runs loops on conditions other than true and false: a while loop only continues while its condition
+# is -1, an if takes any nonzero condition, in vmemu and through the C backend. Invoked by ctest with:
+#   -DCOMPILER=<path> -DVMEMU=<path> -DCC=<C compiler> -DWORK=<scratch dir>
+
+file(REMOVE_RECURSE ${WORK})
+file(WRITE ${WORK}/Conditions/Main.jack
+        "class Main {\n    function void main() {\n        var int n, c;\n"
+        "        let n = 3;\n        while(n) { let c = c + 1; let n = n - 1; }\n"
+        "        do Output.printInt(c);\n"
+        "        while(1) { let c = 5; }\n        do Output.printInt(c);\n"
+        "        while(~(n = 0)) { let n = n - 1; }\n"
+        "        let n = -1;\n        while(n) { let c = c + 1; let n = 0; }\n"
+        "        if(2) { let c = c + 2; }\n"
+        "        do Output.printInt(c);\n        return;\n    }\n}\n")
+set(expected "003\n")
+
+execute_process(COMMAND ${COMPILER} ${WORK}/Conditions RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation failed:\n${errors}")
+endif()
+
+execute_process(COMMAND ${VMEMU} ${WORK}/Conditions RESULT_VARIABLE status OUTPUT_VARIABLE output ERROR_VARIABLE report)
+if(NOT status EQUAL 0 OR NOT output STREQUAL expected)
+    message(FATAL_ERROR "Expected output ${expected}, got status ${status} and ${output}:\n${report}")
+endif()
+
+execute_process(COMMAND ${COMPILER} --c ${WORK}/Conditions RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "C compilation failed:\n${errors}")
+endif()
+
+execute_process(COMMAND ${CC} -O2 -o ${WORK}/Conditions.out ${WORK}/Conditions/Conditions.c
+        RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Building Conditions.c failed:\n${errors}")
+endif()
+
+execute_process(COMMAND ${WORK}/Conditions.out RESULT_VARIABLE status OUTPUT_VARIABLE output ERROR_VARIABLE errors)
+if(NOT status EQUAL 0 OR NOT output STREQUAL expected)
+    message(FATAL_ERROR "Expected native output ${expected}, got status ${status} and ${output}:\n${errors}")
+endif()
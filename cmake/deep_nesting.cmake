@@ -0,0 +1,54 @@
+# Compiles and runs expressions nested 1000 levels deep in parentheses, unary operators, call
+# arguments and array indices, then checks that nesting past --max-nesting is a diagnostic and
+# not a crash. Invoked by ctest with:
+#   -DCOMPILER=<path> -DVMEMU=<path> -DWORK=<scratch dir>
+
+set(DEPTH 1000)
+
+string(REPEAT "(" ${DEPTH} OPEN_PARENTHESES)
+string(REPEAT ")" ${DEPTH} CLOSE_PARENTHESES)
+string(REPEAT "-" ${DEPTH} NEGATIONS)
+string(REPEAT "Main.f(" ${DEPTH} OPEN_CALLS)
+string(REPEAT "a[" ${DEPTH} OPEN_INDICES)
+string(REPEAT "]" ${DEPTH} CLOSE_INDICES)
+
+function(write_program directory)
+    file(REMOVE_RECURSE ${directory})
+    file(WRITE ${directory}/Main.jack
+            "class Main {\n    function int f(int v) { return v + 1; }\n"
+            "    function void main() {\n        var int x;\n        var Array a;\n"
+            "        let a = Array.new(1);\n        let a[0] = 0;\n"
+            "        let x = ${OPEN_PARENTHESES}7${CLOSE_PARENTHESES};\n"
+            "        let x = x + ${NEGATIONS}1;\n"
+            "        let x = x + ${OPEN_CALLS}0${CLOSE_PARENTHESES};\n"
+            "        let x = x + ${OPEN_INDICES}0${CLOSE_INDICES};\n"
+            "        do Output.printInt(x);\n        return;\n    }\n}\n")
+endfunction()
+
+write_program(${WORK}/accepted)
+execute_process(COMMAND ${COMPILER} ${WORK}/accepted RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation failed:\n${errors}")
+endif()
+
+execute_process(COMMAND ${VMEMU} ${WORK}/accepted RESULT_VARIABLE status OUTPUT_VARIABLE output ERROR_VARIABLE report)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Emulation failed:\n${report}")
+endif()
+
+# 7 + 1 (an even number of negations) + 1000 calls adding 1 + a[0]
+string(STRIP "${output}" output)
+if(NOT output STREQUAL "1008")
+    message(FATAL_ERROR "Expected output 1008, got '${output}'")
+endif()
+
+execute_process(COMMAND ${COMPILER} --max-nesting=999 ${WORK}/accepted RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 1 OR NOT errors MATCHES "nested deeper than 999 levels")
+    message(FATAL_ERROR "Expected a nesting diagnostic, got status ${status}:\n${errors}")
+endif()
+
+# A negative limit must not wrap around to a huge one
+execute_process(COMMAND ${COMPILER} --max-nesting=-1 ${WORK}/accepted RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 1 OR NOT errors MATCHES "Invalid value")
+    message(FATAL_ERROR "Expected --max-nesting=-1 to be rejected, got status ${status}:\n${errors}")
+endif()
@@ -0,0 +1,68 @@
+# Checks the depfiles --depfile writes: Main names Point as a type and only calls Counter through a
+# call the inliner removes, both sources must still be listed while the OS (no source) is left out.
+# Then Main inlines Alpha.f, which returns Beta.g inlined into it, and editing Beta must change
+# Main.vm, whose depfile therefore lists Beta too. Invoked by ctest with:
+#   -DCOMPILER=<path> -DWORK=<scratch dir>
+
+file(REMOVE_RECURSE ${WORK})
+set(program ${WORK}/Depfile)
+file(WRITE ${program}/Point.jack
+        "class Point {\n    field int x;\n"
+        "    constructor Point new() { let x = 0; return this; }\n}\n")
+file(WRITE ${program}/Counter.jack
+        "class Counter {\n    function int twice(int v) { return v + v; }\n}\n")
+file(WRITE ${program}/Main.jack
+        "class Main {\n    function void main() {\n        var Point p;\n        var int x;\n"
+        "        let x = Counter.twice(3);\n        do Output.printInt(x);\n        return;\n    }\n}\n")
+
+execute_process(COMMAND ${COMPILER} --depfile ${program} RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation failed:\n${errors}")
+endif()
+
+file(READ ${program}/Main.vm main_vm)
+if(main_vm MATCHES "call Counter\\.twice")
+    message(FATAL_ERROR "Counter.twice was not inlined, the test no longer covers inlined dependencies")
+endif()
+
+# Sources of the target, in order, on their own escaped lines
+function(expect_depfile output)
+    file(READ ${output}.d depfile)
+    set(expected "${output}:")
+    foreach(source ${ARGN})
+        string(APPEND expected " \\\n  ${source}")
+    endforeach()
+    if(NOT depfile STREQUAL "${expected}\n")
+        message(FATAL_ERROR "Unexpected ${output}.d:\n${depfile}\nexpected:\n${expected}")
+    endif()
+endfunction()
+
+expect_depfile(${program}/Main.vm ${program}/Main.jack ${program}/Counter.jack ${program}/Point.jack)
+expect_depfile(${program}/Counter.vm ${program}/Counter.jack)
+
+set(program ${WORK}/Chain)
+file(WRITE ${program}/Beta.jack
+        "class Beta {\n    function int g(int v) { return v + 1; }\n}\n")
+file(WRITE ${program}/Alpha.jack
+        "class Alpha {\n    function int f(int v) { return Beta.g(v); }\n}\n")
+file(WRITE ${program}/Main.jack
+        "class Main {\n    function void main() {\n"
+        "        do Output.printInt(Alpha.f(3));\n        return;\n    }\n}\n")
+
+execute_process(COMMAND ${COMPILER} --depfile ${program} RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation failed:\n${errors}")
+endif()
+file(READ ${program}/Main.vm before)
+expect_depfile(${program}/Main.vm ${program}/Main.jack ${program}/Alpha.jack ${program}/Beta.jack)
+
+file(WRITE ${program}/Beta.jack
+        "class Beta {\n    function int g(int v) { return v + 2; }\n}\n")
+execute_process(COMMAND ${COMPILER} --depfile ${program} RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation after editing Beta failed:\n${errors}")
+endif()
+file(READ ${program}/Main.vm after)
+if(before STREQUAL after)
+    message(FATAL_ERROR "Editing Beta left Main.vm unchanged, Beta.g is no longer inlined through Alpha.f")
+endif()
@@ -0,0 +1,37 @@
+# Builds tests/Pong with --incremental, changes a getter of Ball that PongGame inlines and builds
+# again, which regenerates Ball and its users and skims Bat. Every output must match a full build
+# of the changed sources. Invoked by ctest with:
+#   -DCOMPILER=<path> -DSOURCE=<tests/Pong> -DWORK=<scratch dir>
+
+file(REMOVE_RECURSE ${WORK})
+file(COPY ${SOURCE}/ DESTINATION ${WORK}/incremental)
+
+execute_process(COMMAND ${COMPILER} --incremental ${WORK}/incremental RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "First incremental build failed:\n${errors}")
+endif()
+
+file(READ ${WORK}/incremental/Ball.jack ball)
+string(REPLACE "return x;" "return x + 1;" ball "${ball}")
+file(WRITE ${WORK}/incremental/Ball.jack "${ball}")
+
+execute_process(COMMAND ${COMPILER} --incremental ${WORK}/incremental RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Second incremental build failed:\n${errors}")
+endif()
+
+file(GLOB sources ${WORK}/incremental/*.jack)
+file(COPY ${sources} DESTINATION ${WORK}/full)
+execute_process(COMMAND ${COMPILER} ${WORK}/full RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Full build failed:\n${errors}")
+endif()
+
+file(GLOB outputs RELATIVE ${WORK}/full ${WORK}/full/*.vm)
+foreach(output ${outputs})
+    file(READ ${WORK}/full/${output} expected)
+    file(READ ${WORK}/incremental/${output} actual)
+    if(NOT actual STREQUAL expected)
+        message(FATAL_ERROR "Incremental ${output} differs from the full build")
+    endif()
+endforeach()
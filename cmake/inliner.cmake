@@ -0,0 +1,28 @@
+# Inlines calls whose arguments divide by a variable and checks that the division still raises
+# Sys.error(3), while a constant product and a quotient by 1 are dropped with the unused argument.
+# Invoked by ctest with:
+#   -DCOMPILER=<path> -DVMEMU=<path> -DWORK=<scratch dir>
+
+file(REMOVE_RECURSE ${WORK})
+file(WRITE ${WORK}/Inliner/P.jack
+        "class P {\n    function void zero(int x) { return; }\n"
+        "    function int first(int x, int y) { return x; }\n}\n")
+file(WRITE ${WORK}/Inliner/Main.jack
+        "class Main {\n    function void main() {\n        var int a, b;\n"
+        "        do P.zero(a * 4);\n        do Output.printInt(P.first(3, a / 1));\n"
+        "        do P.zero(1 / b);\n        do Output.printInt(4);\n        return;\n    }\n}\n")
+
+execute_process(COMMAND ${COMPILER} ${WORK}/Inliner RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation failed:\n${errors}")
+endif()
+
+file(READ ${WORK}/Inliner/Main.vm main_vm)
+if(main_vm MATCHES "call P\\.first" OR NOT main_vm MATCHES "call Math\\.divide")
+    message(FATAL_ERROR "Unexpected Main.vm:\n${main_vm}")
+endif()
+
+execute_process(COMMAND ${VMEMU} ${WORK}/Inliner RESULT_VARIABLE status OUTPUT_VARIABLE output ERROR_VARIABLE report)
+if(status EQUAL 0 OR NOT report MATCHES "Sys\\.error\\(3\\)" OR NOT output STREQUAL "3\n")
+    message(FATAL_ERROR "Expected output 3 and Sys.error(3), got status ${status} and ${output}:\n${report}")
+endif()
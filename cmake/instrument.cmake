@@ -0,0 +1,24 @@
+# Compiles tests/Square with --instrument=loops, runs it in vmemu and checks the counts Profile.dump
+# prints when Main.main returns. Invoked by ctest with:
+#   -DCOMPILER=<path> -DVMEMU=<path> -DSOURCE=<tests/Square> -DWORK=<scratch dir>
+
+file(REMOVE_RECURSE ${WORK})
+file(COPY ${SOURCE}/ DESTINATION ${WORK})
+
+execute_process(COMMAND ${COMPILER} --instrument=loops ${WORK} RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation failed:\n${errors}")
+endif()
+
+# 2000 polls without a key, then q
+execute_process(COMMAND ${VMEMU} --keys=0*2000,81*1 ${WORK} RESULT_VARIABLE status OUTPUT_VARIABLE output ERROR_VARIABLE report)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Emulation failed:\n${report}")
+endif()
+
+foreach(EXPECTED "Main.main 1" "SquareGame.run 1" "SquareGame.moveSquare 2002" "SquareGame.run loop 1 2001")
+    string(FIND "${output}" "\n${EXPECTED}\n" found)
+    if(found EQUAL -1)
+        message(FATAL_ERROR "Expected '${EXPECTED}' in the profile:\n${output}")
+    endif()
+endforeach()
@@ -0,0 +1,37 @@
+# Compiles one tests/ program to VM code and to C, builds the C with the system compiler and checks
+# that the native program prints what vmemu prints and exits the same way. Invoked by ctest with:
+#   -DCOMPILER=<path> -DVMEMU=<path> -DCC=<C compiler> -DSOURCE=<tests/program> -DWORK=<scratch dir> -DARGS=<vmemu options>
+
+file(REMOVE_RECURSE ${WORK})
+get_filename_component(PROGRAM ${SOURCE} NAME)
+file(COPY ${SOURCE}/ DESTINATION ${WORK}/vm/${PROGRAM})
+file(COPY ${SOURCE}/ DESTINATION ${WORK}/c/${PROGRAM})
+
+execute_process(COMMAND ${COMPILER} ${WORK}/vm/${PROGRAM} RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation of ${SOURCE} failed:\n${errors}")
+endif()
+
+execute_process(COMMAND ${COMPILER} --c ${WORK}/c/${PROGRAM} RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "C compilation of ${SOURCE} failed:\n${errors}")
+endif()
+
+set(executable ${WORK}/c/${PROGRAM}.out)
+execute_process(COMMAND ${CC} -O2 -o ${executable} ${WORK}/c/${PROGRAM}/${PROGRAM}.c RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Building ${PROGRAM}.c failed:\n${errors}")
+endif()
+
+separate_arguments(ARGS)
+execute_process(COMMAND ${VMEMU} ${ARGS} ${WORK}/vm/${PROGRAM}
+        RESULT_VARIABLE vm_status OUTPUT_VARIABLE vm_output ERROR_QUIET)
+execute_process(COMMAND ${executable} ${ARGS}
+        RESULT_VARIABLE native_status OUTPUT_VARIABLE native_output ERROR_VARIABLE native_errors)
+
+if(NOT native_status STREQUAL vm_status)
+    message(FATAL_ERROR "Native exit status ${native_status}, vmemu ${vm_status}:\n${native_errors}")
+endif()
+if(NOT native_output STREQUAL vm_output)
+    message(FATAL_ERROR "Native output differs from vmemu\nvmemu:\n${vm_output}\nnative:\n${native_output}")
+endif()
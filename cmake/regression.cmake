@@ -0,0 +1,27 @@
+# Compiles one tests/ program, runs it in vmemu and compares the executed instruction count
+# against the baseline in tests/instruction_counts.txt. Invoked by ctest with:
+#   -DCOMPILER=<path> -DVMEMU=<path> -DSOURCE=<tests/program> -DWORK=<scratch dir> -DMAX=<count> -DARGS=<vmemu options>
+
+file(REMOVE_RECURSE ${WORK})
+file(COPY ${SOURCE}/ DESTINATION ${WORK})
+
+execute_process(COMMAND ${COMPILER} ${WORK} RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation of ${SOURCE} failed:\n${errors}")
+endif()
+
+separate_arguments(ARGS)
+execute_process(COMMAND ${VMEMU} ${ARGS} ${WORK} RESULT_VARIABLE status ERROR_VARIABLE report OUTPUT_QUIET)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Emulation of ${SOURCE} failed:\n${report}")
+endif()
+
+string(REGEX MATCH "instructions: ([0-9]+)" match "${report}")
+set(count ${CMAKE_MATCH_1})
+message(STATUS "${report}")
+
+if(count GREATER MAX)
+    message(FATAL_ERROR "Instruction count went up: ${count} > ${MAX}")
+elseif(count LESS MAX)
+    message(STATUS "Instruction count went down: ${count} < ${MAX}, lower the baseline")
+endif()
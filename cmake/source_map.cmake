@@ -0,0 +1,48 @@
+# Compiles tests/Square with --source-map, checks the map of Main and that every map covers all
+# lines of its output, then that --stream writes the same maps. Invoked by ctest with:
+#   -DCOMPILER=<path> -DSOURCE=<tests/Square> -DWORK=<scratch dir>
+
+set(EXPECTED_MAIN "jack-map 1
+source Main.jack
+1-1 10:5-16:6
+2-3 12:9-12:37
+4-6 13:9-13:23
+7-9 14:9-14:27
+10-11 15:9-15:16
+")
+
+file(REMOVE_RECURSE ${WORK})
+file(COPY ${SOURCE}/ DESTINATION ${WORK}/batch)
+file(COPY ${SOURCE}/ DESTINATION ${WORK}/stream)
+
+# Streaming never inlines, the batch build must not either for the maps to match
+execute_process(COMMAND ${COMPILER} --source-map --inline-budget=0 ${WORK}/batch RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation failed:\n${errors}")
+endif()
+execute_process(COMMAND ${COMPILER} --source-map --stream ${WORK}/stream RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Streaming compilation failed:\n${errors}")
+endif()
+
+file(READ ${WORK}/batch/Main.vm.map map)
+if(NOT map STREQUAL EXPECTED_MAIN)
+    message(FATAL_ERROR "Unexpected Main.vm.map:\n${map}")
+endif()
+
+file(GLOB outputs RELATIVE ${WORK}/batch ${WORK}/batch/*.vm)
+foreach(output ${outputs})
+    file(STRINGS ${WORK}/batch/${output} lines)
+    list(LENGTH lines line_count)
+    file(STRINGS ${WORK}/batch/${output}.map records)
+    list(GET records -1 last)
+    if(NOT last MATCHES "^[0-9]+-${line_count} ")
+        message(FATAL_ERROR "${output}.map ends with '${last}', ${output} has ${line_count} lines")
+    endif()
+
+    file(READ ${WORK}/batch/${output}.map batch_map)
+    file(READ ${WORK}/stream/${output}.map stream_map)
+    if(NOT batch_map STREQUAL stream_map)
+        message(FATAL_ERROR "--stream wrote a different ${output}.map:\n${stream_map}")
+    endif()
+endforeach()
@@ -0,0 +1,30 @@
+# Compiles and runs a generated Jack program of over a million lines whose main function holds
+# hundreds of thousands of labels. Invoked by ctest with:
+#   -DCOMPILER=<path> -DVMEMU=<path> -DWORK=<scratch dir>
+
+set(BLOCK_COUNT 250000)
+set(BLOCK "        if (x < 30000) {\n            let x = x + 1;\n        }\n        while (x < 0) { let x = 0; }\n")
+
+string(REPEAT "${BLOCK}" ${BLOCK_COUNT} BODY)
+
+file(REMOVE_RECURSE ${WORK})
+file(WRITE ${WORK}/Main.jack
+        "class Main {\n    function void main() {\n        var int x;\n        let x = 0;\n"
+        "${BODY}"
+        "        do Output.printInt(x);\n        return;\n    }\n}\n")
+
+execute_process(COMMAND ${COMPILER} ${WORK} RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation failed:\n${errors}")
+endif()
+
+# vmemu rejects duplicate labels, a wrapped label counter fails here
+execute_process(COMMAND ${VMEMU} ${WORK} RESULT_VARIABLE status OUTPUT_VARIABLE output ERROR_VARIABLE report)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Emulation failed:\n${report}")
+endif()
+
+string(STRIP "${output}" output)
+if(NOT output STREQUAL "30000")
+    message(FATAL_ERROR "Expected output 30000, got '${output}'")
+endif()
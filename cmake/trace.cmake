@@ -0,0 +1,48 @@
+# Compiles tests/Pong with --trace and checks the JSON holds a read, parse, resolve and generate
+# span for every file, each on a named thread. Invoked by ctest with:
+#   -DCOMPILER=<path> -DSOURCE=<tests/Pong> -DWORK=<scratch dir>
+
+file(REMOVE_RECURSE ${WORK})
+file(COPY ${SOURCE}/ DESTINATION ${WORK}/Pong)
+
+execute_process(COMMAND ${COMPILER} --trace=${WORK}/trace.json ${WORK}/Pong RESULT_VARIABLE status ERROR_VARIABLE errors)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "Compilation failed:\n${errors}")
+endif()
+
+file(READ ${WORK}/trace.json trace)
+string(JSON count ERROR_VARIABLE json_error LENGTH "${trace}" traceEvents)
+if(json_error)
+    message(FATAL_ERROR "Invalid trace: ${json_error}\n${trace}")
+endif()
+
+set(named_threads "")
+set(spans "")
+math(EXPR last "${count} - 1")
+foreach(i RANGE ${last})
+    string(JSON name GET "${trace}" traceEvents ${i} name)
+    string(JSON tid GET "${trace}" traceEvents ${i} tid)
+    if(name STREQUAL "thread_name")
+        list(APPEND named_threads ${tid})
+        continue()
+    endif()
+
+    list(FIND named_threads ${tid} found)
+    if(found EQUAL -1)
+        message(FATAL_ERROR "Span '${name}' on unnamed thread ${tid}")
+    endif()
+
+    string(JSON file ERROR_VARIABLE no_file GET "${trace}" traceEvents ${i} args file)
+    if(NOT no_file)
+        list(APPEND spans "${name} ${file}")
+    endif()
+endforeach()
+
+foreach(file Ball.jack Bat.jack Main.jack PongGame.jack)
+    foreach(phase read parse resolve generate)
+        list(FIND spans "${phase} ${file}" found)
+        if(found EQUAL -1)
+            message(FATAL_ERROR "No ${phase} span for ${file} in:\n${trace}")
+        endif()
+    endforeach()
+endforeach()
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Counts heap allocations made through the global operator new. The hook is only compiled in
+ * when building with -DCOUNT_ALLOCATIONS=ON, otherwise every count reads 0.
+ */
+class allocation_counter {
+public:
+    static constexpr bool enabled() {
+#ifdef COUNT_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static uint64_t count();
+    static uint64_t bytes();
+};
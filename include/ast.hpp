@@ -1,10 +1,12 @@
 #pragma once
 
 #include "token.hpp"
+#include "symbol.hpp"
 
 #include <string>
 #include <list>
 #include <optional>
+#include <set>
 #include <utility>
 
 struct ast_parameter {
@@ -23,6 +25,20 @@ struct ast_subroutine_local {
     std::list<std::string> identifiers;
 };
 
+// Source text a node was parsed from, as byte offsets into its class's source, end is exclusive
+struct ast_span {
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+// Storage of a variable, filled in by the resolver
+struct ast_slot {
+    symbol::segment_t segment = symbol::segment_t::LOCAL;
+    uint16_t index = 0;
+
+    bool operator==(const ast_slot& other) const { return segment == other.segment && index == other.index; };
+};
+
 struct ast_term {
     enum struct type_t {
         INTEGER,
@@ -71,10 +87,21 @@ struct ast_expression {
 };
 
 struct ast_subroutine_call {
+    enum struct receiver_t {
+        NONE,
+        THIS,
+        VARIABLE
+    };
+
     std::optional<std::string> callee_identifier;
     std::string subroutine_identifier;
     std::list<ast_expression> arguments;
 
+    // Filled in by the resolver
+    std::string callee_class;
+    receiver_t receiver = receiver_t::NONE;
+    ast_slot receiver_slot;
+
     explicit ast_subroutine_call(
             std::string subroutine_identifier = "",
     std::optional<std::string> callee_identifier = std::nullopt)
@@ -98,6 +125,7 @@ struct ast_term_string : public ast_term {
 
 struct ast_term_variable : public ast_term {
     std::string identifier;
+    ast_slot slot;
     explicit ast_term_variable(std::string identifier)
     : ast_term(type_t::VARIABLE),
     identifier(std::move(identifier)) {};
@@ -105,6 +133,7 @@ struct ast_term_variable : public ast_term {
 
 struct ast_term_array : public ast_term {
     std::string identifier;
+    ast_slot slot;
     ast_expression access;
     explicit ast_term_array(ast_expression access)
     : ast_term(type_t::ARRAY),
@@ -143,6 +172,8 @@ struct ast_statement {
     };
 
     type_t type;
+    // Filled in by the lexer, inlined statements take the span of the call they replace
+    ast_span span;
 
     explicit ast_statement(type_t type) : type(type) {};
 };
@@ -150,6 +181,7 @@ struct ast_statement {
 struct ast_statement_let : public ast_statement {
     std::optional<ast_expression> array_access = std::nullopt;
     std::string identifier;
+    ast_slot slot;
     ast_expression assignment;
 
     ast_statement_let()
@@ -201,10 +233,33 @@ struct ast_class_subroutine {
     std::list<ast_parameter> parameters;
     std::list<ast_subroutine_local> locals;
     std::list<ast_statement*> statements;
+    // From the subroutine keyword to the closing brace
+    ast_span span;
+    // The statements between the locals and the closing brace, left unparsed by a skimming
+    // lexer until lexer::parse_body
+    ast_span body;
+    bool skimmed = false;
+
+    // Filled in by the resolver
+    uint16_t local_count = 0;
 };
 
 struct ast_class {
     std::string identifier;
     std::list<ast_class_variable> variables;
     std::list<ast_class_subroutine> subroutines;
-};
\ No newline at end of file
+
+    // Filled in by the resolver
+    uint16_t field_count = 0;
+    // Filled in by the inliner, classes whose subroutine bodies were inlined into this one, directly
+    // or as part of another inlined body
+    std::set<std::string> inlined_classes;
+};
+
+// Deletes a node and every node it owns
+void ast_free(ast_class* ast);
+void ast_free(std::list<ast_statement*>& statements);
+void ast_free(ast_statement* statement);
+void ast_free(ast_expression& expression);
+void ast_free(ast_subroutine_call& call);
+void ast_free(ast_term* term);
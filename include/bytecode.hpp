@@ -0,0 +1,37 @@
+#pragma once
+
+#include "vm.hpp"
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+
+/*
+ * Binary form of a .vm file, all integers are little endian:
+ *   header       "JVMB", u16 version, u16 reserved, u32 string count, u32 instruction count
+ *   strings      u16 length followed by the characters, for every function and label name
+ *   instructions u8 op, u8 segment, u16 index, u32 operand
+ *
+ * The operand of label, function and call is a string table index, goto and if-goto
+ * hold the offset of their (function scoped) label in the instruction list.
+ */
+struct bytecode {
+    static constexpr uint16_t VERSION = 1;
+
+    struct instruction {
+        uint8_t op = 0;
+        uint8_t segment = 0;
+        uint16_t index = 0;
+        uint32_t operand = 0;
+    };
+
+    std::vector<std::string> strings;
+    std::vector<instruction> code;
+
+    static bytecode encode(const std::vector<vm_instruction>& instructions);
+    static std::vector<vm_instruction> decode(const bytecode& module);
+
+    static void write(const bytecode& module, std::ostream& out);
+    static bytecode read(std::istream& in);
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * C backend, links the resolved classes into a single C99 program that runs natively. Words are
+ * int16_t with the VM's wrapping arithmetic, objects, arrays and strings live in a RAM array and are
+ * allocated at the addresses vmemu gives them, and every OS function the program does not define is
+ * a C version of vmemu's stub, so the program prints what it prints in vmemu.
+ */
+class c_generator {
+private:
+    struct function {
+        std::string c_name;
+        uint16_t arg_count = 0;
+        // OS stubs only, index into the stub table and whether the program calls it
+        int32_t native = -1;
+        bool used = false;
+    };
+
+    // An operand as C code. C leaves the evaluation order of operands and arguments open, so values
+    // whose order matters are moved into temporaries (see _sequence)
+    struct value {
+        std::string code;
+        // Runs a call, which must happen before any later operand reads memory
+        bool calls = false;
+        // Reads memory a call may change, or may fail, so it must happen before any later call
+        bool reads = false;
+    };
+
+    std::vector<const ast_class*> _classes;
+    std::unordered_map<std::string, function> _functions;
+    std::string _c_code;
+    bool _uses_strings = false;
+
+    // Subroutine being generated
+    const ast_class* _class = nullptr;
+    const ast_class_subroutine* _subroutine = nullptr;
+    std::string _body;
+    uint32_t _indent = 0;
+    uint32_t _next_temp = 0;
+    // Operands evaluated but not yet consumed, oldest first
+    std::vector<value*> _held;
+public:
+    c_generator() = default;
+    ~c_generator() = default;
+
+    // Classes must be resolved (and pruned), and outlive run
+    void add(const ast_class* ast);
+    // Throws std::runtime_error for calls to undefined functions and argument count mismatches
+    void run(const std::string& program_name);
+
+    [[nodiscard]] const std::string& get_c_code() const { return _c_code; };
+private:
+    void _generate_subroutine(const ast_class_subroutine& subroutine);
+    void _generate_statements(const std::list<ast_statement*>& statements);
+    void _generate_let_statement(const ast_statement_let* let_statement);
+    void _generate_if_statement(const ast_statement_if* if_statement);
+    void _generate_while_statement(const ast_statement_while* while_statement);
+    value _generate_expression(const ast_expression& expression);
+    value _generate_term(const ast_term* term);
+    value _generate_call(const std::string& name, std::vector<value>& arguments);
+    value _generate_subroutine_call(const ast_subroutine_call& call);
+    value _generate_binary_op(ast_binary_op op, value& left, value& right);
+    value _generate_string(const std::string& str);
+    value _read_variable(const ast_slot& slot);
+
+    std::string _variable(const ast_slot& slot);
+    std::string _this();
+    function& _get_function(const std::string& name, size_t arg_count);
+    bool _is_defined(const std::string& name) const;
+    // Moves held operands into temporaries before a call, or before a memory read when they run a call
+    void _sequence(bool call);
+    void _spill(value& value);
+    void _line(const std::string& line);
+
+    static std::string _mangle(const std::string& class_name, const std::string& subroutine);
+    static std::string _statics(const std::string& class_name);
+    static std::string _escape(const std::string& identifier);
+    static std::string _parameters(size_t count);
+};
@@ -2,65 +2,218 @@
 
 #include "tokenizer.hpp"
 #include "lexer.hpp"
+#include "resolver.hpp"
 #include "generator.hpp"
+#include "c_generator.hpp"
+#include "inliner.hpp"
+#include "pruner.hpp"
+#include "pipeline.hpp"
+#include "translator.hpp"
+#include "bytecode.hpp"
+#include "allocation_counter.hpp"
+#include "file_io.hpp"
+#include "summary.hpp"
+#include "tracer.hpp"
 
+#include <chrono>
 #include <filesystem>
+#include <future>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <set>
+#include <unordered_map>
 #include <fstream>
+#include <sstream>
 
 class compiler {
 public:
     class error : public std::exception {
     private:
         std::list<std::string> _errors;
-        std::string _message;
+        // Formatted once, what() must not allocate
+        std::string _what;
     public:
-        explicit error(std::string message) : _message(std::move(message)) {};
-        explicit error(std::list<std::string> errors) : _errors(std::move(errors)) {};
+        explicit error(std::string message) : _what(_format(message, {})) {};
+        explicit error(std::list<std::string> errors) : _errors(std::move(errors)), _what(_format("", _errors)) {};
         error() = default;
 
-        [[nodiscard]] const char* what() const noexcept final {
+        [[nodiscard]] const char* what() const noexcept final { return _what.c_str(); };
+        [[nodiscard]] const std::list<std::string>& get_errors() const { return _errors; };
+    private:
+        static std::string _format(const std::string& message, const std::list<std::string>& errors) {
             std::stringstream out;
 
-            if(!_message.empty())
-                out << _message << std::endl;
+            if(!message.empty())
+                out << message << std::endl;
 
-            if(!_errors.empty()) {
-                out << _errors.size() << " error(s) reported:" << std::endl;
-                for(const auto& error : _errors)
+            if(!errors.empty()) {
+                out << errors.size() << " error(s) reported:" << std::endl;
+                for(const auto& error : errors)
                     out << "\t" << error << std::endl;
             }
 
-            auto out_str = out.str();
-            out_str.shrink_to_fit();
+            return out.str();
+        }
+    };
 
-            char* ret = new char[out_str.size() + 1];
-            memcpy(ret, out_str.data(), out_str.size());
-            ret[out_str.size()] = '\0';
+    enum struct output_format_t {
+        VM,
+        ASM,
+        BINARY,
+        C
+    };
 
-            return ret;
-        }
+    // Wall time and heap allocations (with COUNT_ALLOCATIONS) of one compiler phase
+    struct phase_stats {
+        std::string name;
+        double milliseconds = 0;
+        uint64_t allocations = 0;
     };
 
     const std::string SOURCE_FILE_EXTENSION = ".jack";
     const std::string OUTPUT_FILE_EXTENSION = ".vm";
+    const std::string ASM_OUTPUT_FILE_EXTENSION = ".asm";
+    const std::string BINARY_OUTPUT_FILE_EXTENSION = ".vmb";
+    const std::string C_OUTPUT_FILE_EXTENSION = ".c";
+    const std::string DEPFILE_EXTENSION = ".d";
+    const std::string SOURCE_MAP_EXTENSION = ".map";
+    const std::string SUMMARY_FILE_EXTENSION = ".summary";
 private:
     struct context {
         std::filesystem::path source_path;
         std::filesystem::path output_path;
-        tokenizer tokenizer;
-        lexer lexer;
-        generator generator;
+        std::filesystem::path summary_path;
+        output_format_t output_format = output_format_t::VM;
+        std::string source_code;
+        // Encoded .vmb contents, BINARY only
+        std::string binary;
+        std::string depfile;
+        bool source_map = false;
+        std::string source_map_text;
+
+        std::string class_name;
+        uint32_t static_count = 0;
+        bool parsed = false;
+        bool generate = true;
+
+        // Incremental only: FNV-1a of the options and source, the previous run's summary and the plan
+        uint64_t source_hash = 0;
+        std::optional<class_summary> summary;
+        std::string summary_text;
+        bool changed = false;
+        bool needed = false;
+        // Skimmed classes only: subroutines whose bodies _parse_bodies parses next
+        std::set<std::string> requested_bodies;
+
+        ::tokenizer tokenizer;
+        ::lexer lexer;
+        ::resolver resolver;
+        ::generator generator;
+        // Null unless tracing
+        tracer* trace = nullptr;
+    };
+
+    // Frees the contexts when it is created and when it goes out of scope, also when a phase throws
+    class context_scope {
+        std::vector<context*>& _contexts;
+    public:
+        explicit context_scope(std::vector<context*>& contexts) : _contexts(contexts) { free(); };
+        ~context_scope() { free(); };
+
+        void free() {
+            for(context* ctx : _contexts)
+                delete ctx;
+            _contexts.clear();
+        };
     };
 
     std::vector<context*> _contexts;
+    uint16_t _inline_budget = inliner::DEFAULT_SIZE_BUDGET;
+    uint32_t _max_nesting = lexer::DEFAULT_MAX_NESTING;
+    generator::cost_model _costs;
+    output_format_t _output_format = output_format_t::VM;
+    bool _write_depfiles = false;
+    bool _write_source_maps = false;
+    bool _incremental = false;
+    bool _streaming = false;
+    generator::instrumentation _instrumentation;
+    // Profile class of an instrumented program
+    std::string _profile_code;
+    std::string _profile_binary;
+
+    std::optional<std::filesystem::path> _trace_path;
+    std::unique_ptr<tracer> _tracer;
+
+    std::vector<phase_stats> _phase_stats;
+    std::chrono::steady_clock::time_point _phase_start;
+    uint64_t _phase_allocations = 0;
 public:
     compiler() = default;
     ~compiler() = default;
 
     void run(std::filesystem::path source_path);
+
+    // Maximum body size (in terms) of subroutines inlined at their call sites, 0 disables inlining
+    void set_inline_budget(uint16_t budget) { _inline_budget = budget; };
+    void set_cost_model(const generator::cost_model& costs) { _costs = costs; };
+    // Deepest expression nesting accepted before reporting an error
+    void set_max_nesting(uint32_t max_nesting) { _max_nesting = max_nesting; };
+
+    // ASM links every class into a single <directory>.asm instead of writing one .vm per class,
+    // C into a single <directory>.c program (see c_generator), BINARY writes one .vmb bytecode file per class
+    void set_output_format(output_format_t format) { _output_format = format; };
+    // Writes a Make/Ninja depfile next to every output, listing the sources of the classes it references
+    void set_write_depfiles(bool write_depfiles) { _write_depfiles = write_depfiles; };
+    // Writes <output>.map next to every output, relating its VM lines to the source (VM and binary output only)
+    void set_write_source_maps(bool write_source_maps) { _write_source_maps = write_source_maps; };
+    // Writes a summary next to every output and skips classes whose summary shows nothing they
+    // depend on changed since, they are then neither parsed nor written (VM and binary output only)
+    void set_incremental(bool incremental) { _incremental = incremental; };
+
+    // Compiles one class after the other, writing each subroutine as soon as it is generated and
+    // freeing its AST, so memory stays bounded by the largest subroutine instead of the program.
+    // Disables inlining, VM output only and not combinable with incremental builds
+    void set_streaming(bool streaming) { _streaming = streaming; };
+
+    // Counts subroutine entries (and with loops every loop iteration) at run time, Main.main prints
+    // the counts through a generated Profile class before it returns. The OS classes are not counted.
+    // Rebuilds every class and is not combinable with streaming
+    void set_instrument(bool instrument, bool loops) { _instrumentation.enabled = instrument; _instrumentation.loops = loops; };
+
+    // Writes a Chrome trace-event JSON of the run: the phases on the main thread and the read, parse,
+    // resolve, generate and encode spans of every file on the thread that ran them
+    void set_trace_path(std::filesystem::path trace_path) { _trace_path = std::move(trace_path); };
+
+    // Phases of the last run, in order
+    [[nodiscard]] const std::vector<phase_stats>& get_phase_stats() const { return _phase_stats; };
 private:
     void _scan_source_path(std::filesystem::path &source_path, std::list<std::filesystem::path>& source_files);
+    void _run_parallel(void (*task)(context*), const std::vector<context*>& contexts, const std::filesystem::path& source_path);
+    void _collect_errors(std::vector<std::future<void>>& futures, const std::vector<context*>& contexts, const std::filesystem::path& source_path);
+    void _run_streaming(const std::filesystem::path& source_path);
+    void _read_and_parse(const std::filesystem::path& source_path, bool incremental);
+    void _load_summaries();
+    void _count_statics(const std::filesystem::path& source_path);
+    void _plan_instrumentation();
+    void _generate_profile();
+    void _plan_incremental(const std::filesystem::path& source_path);
+    void _parse_called_bodies(class_summary::call_set calls, const std::unordered_map<std::string, context*>& classes, const std::filesystem::path& source_path);
+    void _write_outputs(const std::vector<context*>& contexts, const std::filesystem::path& source_path, bool incremental);
+    void _add_depfiles(const std::vector<context*>& contexts, std::vector<file_io::write_request>& requests);
+    [[nodiscard]] uint64_t _options_hash() const;
+    void _link_asm(const std::filesystem::path& source_path);
+    void _link_c(const std::filesystem::path& source_path);
+    // Writes the output of a linked program and its depfile, which lists every source
+    void _write_linked(const std::filesystem::path& output_path, const std::string& contents);
+    std::string _make_depfile(const std::filesystem::path& target, const std::list<const std::filesystem::path*>& sources);
+    void _begin_phase();
+    void _end_phase(const char* name);
+    void _write_trace(const std::string& json);
 
-    static void _compile(context* ctx);
+    static void _parse(context* ctx);
+    static void _parse_bodies(context* ctx);
+    static void _resolve(context* ctx);
+    static void _generate(context* ctx);
+    static void _encode(context* ctx);
 };
\ No newline at end of file
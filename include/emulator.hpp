@@ -0,0 +1,100 @@
+#pragma once
+
+#include "vm.hpp"
+
+#include <array>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*
+ * Headless VM emulator used to measure generated code. The OS classes are native stubs
+ * (unless the program defines them itself), so only the program's own VM instructions
+ * are counted, a call to a stub counts as a single instruction.
+ */
+class emulator {
+public:
+    struct options {
+        // Key code returned by Keyboard.keyPressed and the number of polls it is held for
+        std::list<std::pair<int16_t, uint32_t>> keys;
+        // Values returned by Keyboard.readInt, in order
+        std::list<int16_t> inputs;
+        uint64_t max_instructions = 100000000;
+    };
+
+    struct function {
+        std::string name;
+        uint32_t entry = 0;
+        uint16_t local_count = 0;
+        uint16_t static_base = 0;
+        int16_t native = -1;
+        uint64_t executed = 0;
+        uint64_t calls = 0;
+    };
+private:
+    struct instruction {
+        vm_instruction::op_t op;
+        vm_instruction::segment_t segment;
+        uint16_t index;
+        uint32_t target;
+    };
+
+    struct frame {
+        uint32_t function;
+        uint32_t return_address;
+    };
+
+    options _options;
+    std::vector<instruction> _code;
+    std::vector<function> _functions;
+    std::unordered_map<std::string, uint32_t> _function_indices;
+
+    std::array<int16_t, 32768> _ram{};
+    std::vector<frame> _frames;
+    uint32_t _current = 0;
+    uint64_t _executed = 0;
+    bool _halted = false;
+    std::string _output;
+
+    uint16_t _heap_next = 0;
+    std::map<uint16_t, uint16_t> _heap_free;
+    std::unordered_map<uint16_t, uint16_t> _heap_used;
+public:
+    static constexpr uint16_t SP = 0, LCL = 1, ARG = 2, THIS = 3, THAT = 4;
+    static constexpr uint16_t TEMP_BASE = 5, STATIC_BASE = 16, STACK_BASE = 256;
+    static constexpr uint16_t HEAP_BASE = 2048, HEAP_END = 16384;
+
+    emulator() = default;
+    explicit emulator(options options) : _options(std::move(options)) {};
+    ~emulator() = default;
+
+    void load(const std::filesystem::path& path);
+    void run(const std::string& entry = "Main.main");
+
+    [[nodiscard]] uint64_t get_instruction_count() const { return _executed; };
+    [[nodiscard]] const std::vector<function>& get_functions() const { return _functions; };
+    [[nodiscard]] const std::string& get_output() const { return _output; };
+private:
+    void _load_unit(const std::string& unit_name, const std::vector<vm_instruction>& code, uint16_t& next_static);
+    void _link_natives();
+    uint32_t _get_function(const std::string& name);
+
+    void _call(uint32_t function_index, uint16_t arg_count, uint32_t return_address);
+    void _return();
+    int16_t _call_native(int16_t native, const int16_t* args, uint16_t arg_count);
+
+    int16_t& _segment(vm_instruction::segment_t segment, uint16_t index);
+    int16_t& _memory(int32_t address);
+    void _push(int16_t value);
+    int16_t _pop();
+
+    uint16_t _alloc(int16_t size);
+    void _free(uint16_t address);
+    uint16_t _new_string(const std::string& value);
+    std::string _read_string(uint16_t address);
+    int16_t _next_key();
+    void _error(int16_t code);
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+
+/*
+ * Batched whole-file reads and writes. On Linux the opens, reads, writes and closes of all files
+ * are submitted together through io_uring, without it (or when the kernel refuses io_uring)
+ * every file is handled synchronously on its own thread.
+ */
+class file_io {
+public:
+    struct read_result {
+        std::string contents;
+        // Empty on success
+        std::string error;
+    };
+
+    struct write_request {
+        std::filesystem::path path;
+        const std::string* contents = nullptr;
+    };
+
+    /*
+     * Writes one output piece by piece into a temporary file, commit then replaces the target
+     * only when the contents differ. Dropped without a commit the temporary file is removed.
+     */
+    class stream_writer {
+    private:
+        std::filesystem::path _path;
+        std::filesystem::path _temp_path;
+        std::ofstream _out;
+        bool _committed = false;
+    public:
+        explicit stream_writer(std::filesystem::path path);
+        ~stream_writer();
+        stream_writer(const stream_writer&) = delete;
+        stream_writer& operator=(const stream_writer&) = delete;
+
+        void write(const std::string& data);
+        // Returns an error message, empty on success
+        std::string commit();
+    };
+
+    // Called once per file, in completion order and possibly from several threads at once
+    typedef std::function<void(size_t index, read_result result)> read_callback;
+private:
+    static bool _use_uring;
+public:
+    // Opens and reads every path, on_read is called as soon as a file's bytes have arrived
+    static void read_all(const std::vector<std::filesystem::path>& paths, const read_callback& on_read);
+    // Atomically and durably replaces every path whose contents differ (through a temporary file that
+    // is fsynced, then renamed), returns one message per failed file
+    static std::list<std::string> write_all(const std::vector<write_request>& requests);
+
+    static void set_use_uring(bool use_uring) { _use_uring = use_uring; };
+    // Whether io_uring is enabled and supported by the running kernel
+    static bool uring_available();
+private:
+    static std::filesystem::path _temp_path_for(const std::filesystem::path& path);
+    // Gives the temporary file the permissions of the output it replaces and flushes it to disk,
+    // returns an error message, empty on success
+    static std::string _prepare_rename(const std::filesystem::path& temp_path, const std::filesystem::path& path);
+    static void _sync_directory(const std::filesystem::path& directory);
+
+    static void _read_threaded(const std::vector<std::filesystem::path>& paths, const read_callback& on_read);
+    static void _write_threaded(const std::vector<write_request>& requests, std::vector<std::string>& errors);
+    static bool _read_uring(const std::vector<std::filesystem::path>& paths, const read_callback& on_read);
+    static bool _write_uring(const std::vector<write_request>& requests, std::vector<std::string>& errors);
+};
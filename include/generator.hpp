@@ -1,32 +1,122 @@
 #pragma once
 
 #include "ast.hpp"
+#include "source_map.hpp"
 #include "symbol.hpp"
 
 #include <list>
 #include <string>
-#include <atomic>
-#include <unordered_map>
+#include <string_view>
+#include <unordered_set>
+#include <optional>
+#include <vector>
 
 
 class generator {
+public:
+
+    // Estimated VM instructions executed by library calls, inline sequences are only emitted when cheaper
+    struct cost_model {
+        uint16_t multiply = 300;
+        uint16_t divide = 300;
+    };
+
+    // Counts subroutine entries, and optionally loop iterations, in a counter array per class.
+    // counters_static holds the array, Profile.register (see run_profile) allocates it on first entry
+    struct instrumentation {
+        bool enabled = false;
+        bool loops = false;
+        uint16_t class_id = 0;
+        uint32_t counters_static = 0;
+    };
+
+    static constexpr const char* PROFILE_CLASS = "Profile";
 private:
     ast_class* _top_level = nullptr;
-    std::list<std::string> _vm_code;
-    std::unordered_map<std::string, symbol> _global_symbols;
-    std::unordered_map<std::string, symbol> _subroutine_symbols;
-
-    uint16_t _next_this_index = 0;
-    uint16_t _next_local_index = 0;
-    uint16_t _next_arg_index = 0;
-    uint16_t _next_label = 0;
+    // Newline terminated VM instructions
+    std::string _vm_code;
+    uint32_t _next_label = 0;
+
+    cost_model _costs;
+
+    instrumentation _instrumentation;
+    // Names of the counted sites of the class in counter order, filled before generation
+    std::vector<std::string> _profile_sites;
+    uint32_t _next_profile_site = 0;
+    bool _in_main = false;
+
+    // Only recorded when a source map is requested
+    bool _record_source_map = false;
+    std::vector<source_map::segment> _source_segments;
+    ast_span _current_span;
+
+    // Scratch space of _remove_dead_code, kept to reuse its allocations
+    std::vector<std::string_view> _lines;
+    std::vector<char> _keep_line;
+    std::unordered_set<std::string_view> _jump_targets;
+
+    // A branch condition with its enclosing parentheses and ~ operators removed
+    struct condition {
+        const ast_expression* expression = nullptr;
+        const ast_term* term = nullptr;
+        bool negated = false;
+    };
+
+    // Variable pointer 1 currently holds, only tracked within straight-line code
+    std::optional<ast_slot> _that_base;
+
+    typedef std::list<ast_expression::op_term_t>::const_iterator secondary_iterator;
+
+    // Pending work of the expression emitter, which keeps an explicit stack instead of recursing
+    struct emit_task {
+        enum struct kind_t {
+            // Expands into its terms and operators, up to but not including secondary
+            EXPRESSION,
+            // The operand and operator of secondary, or an inline sequence for a constant operand
+            SECONDARY,
+            TERM,
+            // Multiplies by the constant term, the other operand is already on the stack
+            MULTIPLY_CONSTANT,
+            BINARY_OP,
+            UNARY_OP,
+            ARRAY_READ,
+            // Expands into the receiver and arguments, followed by CALL_END
+            CALL,
+            CALL_END
+        };
+
+        kind_t kind;
+        const ast_expression* expression = nullptr;
+        secondary_iterator secondary{};
+        const ast_term* term = nullptr;
+        const ast_subroutine_call* call = nullptr;
+        ast_binary_op binary_op = ast_binary_op::ADD;
+        ast_unary_op unary_op = ast_unary_op::NEGATE;
+    };
+    std::vector<emit_task> _emit_stack;
 public:
     generator() = default;
     ~generator() = default;
 
     void run(ast_class* ast);
+    // Streaming: appends a single subroutine of ast, labels keep counting across calls
+    void run_subroutine(ast_class* ast, const ast_class_subroutine& subroutine);
+
+    void set_cost_model(const cost_model& costs) { _costs = costs; };
+    // Applies to run, not to run_subroutine
+    void set_instrumentation(const instrumentation& instrumentation) { _instrumentation = instrumentation; };
+    // Profile.vm of an instrumented program, class_sites holds the sites of every class by class id
+    void run_profile(const std::vector<std::vector<std::string>>& class_sites);
+
+    [[nodiscard]] const std::vector<std::string>& get_profile_sites() const { return _profile_sites; };
 
-    [[nodiscard]] const std::list<std::string>& get_vm_code() const { return _vm_code; };
+    // Records which statement every instruction was generated for, see source_map
+    void set_source_map(bool enabled) { _record_source_map = enabled; };
+    [[nodiscard]] const std::vector<source_map::segment>& get_source_segments() const { return _source_segments; };
+
+    [[nodiscard]] const std::string& get_vm_code() const { return _vm_code; };
+    // Keeps the buffer's capacity for the next subroutine
+    void clear_vm_code() { _vm_code.clear(); _source_segments.clear(); };
 
 private:
     void _generate_subroutine(const ast_class_subroutine& subroutine);
@@ -37,15 +127,31 @@ private:
     void _generate_do_statement(const ast_statement_do* do_statement);
     void _generate_return_statement(const ast_statement_return* return_statement);
     void _generate_expression(const ast_expression &expression);
+    void _generate_expression(const ast_expression &expression, secondary_iterator end);
     void _generate_term(const ast_term* term);
     void _generate_subroutine_call(const ast_subroutine_call &call);
+    void _emit(const emit_task& task);
+    void _emit_term(const ast_term* term);
+    void _emit_binary_op(ast_binary_op op);
+    void _generate_string(const std::string& str);
+    void _generate_profile_count(uint32_t site);
+    void _remove_dead_code(size_t start);
+    void _mark_source(const ast_span& span);
+    void _collect_profile_sites(const std::string& subroutine, const std::list<ast_statement*>& statements, uint32_t& loop);
+    bool _try_generate_multiply_constant(uint16_t constant);
+    bool _try_generate_divide_constant(uint16_t constant);
+    uint16_t _generate_multiply_sequence(uint16_t constant, bool emit);
+    void _load_that_base(const ast_slot& base);
+    void _generate_branch(const ast_expression& condition, bool jump_if, const char* label, uint32_t label_num);
+    void _generate_inverted_comparison(const ast_expression& expression, int16_t inverted);
 
-    symbol _get_symbol(const std::string& identifier);
-    std::optional<symbol> _try_get_symbol(const std::string& identifier);
-private:
-    static std::atomic<uint16_t> _next_static_index;
-
-    static uint16_t _get_next_static_index();
-public:
-    static void reset();
+    static condition _peel_condition(const ast_expression& expression);
+    // Whether the value is always 0 or -1
+    static bool _is_boolean(const ast_expression& expression);
+    static bool _is_boolean(const ast_term* term);
+    static bool _branch_needs_not(const ast_expression& condition, bool jump_if);
+    static bool _try_invert_comparison(const ast_expression& expression, int16_t& inverted);
+    // Whether evaluating the expression may change pointer 1, or the static or field an array store indexes
+    static bool _uses_that(const ast_expression& expression);
+    static bool _uses_that(const ast_term* term);
 };
\ No newline at end of file
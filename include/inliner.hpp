@@ -0,0 +1,67 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <list>
+#include <optional>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+class inliner {
+public:
+    static constexpr uint16_t DEFAULT_SIZE_BUDGET = 8;
+private:
+    struct class_info {
+        ast_class* ast = nullptr;
+        std::unordered_map<std::string, const ast_class_subroutine*> subroutines;
+        std::unordered_map<std::string, uint32_t> fields;
+        std::unordered_map<std::string, std::string> variable_types;
+    };
+
+    // Describes how identifiers of the inlined body map into the caller
+    struct substitution {
+        const class_info* callee_class = nullptr;
+        const std::string* receiver = nullptr;
+        std::unordered_map<std::string, const ast_expression*> arguments;
+    };
+
+    uint16_t _size_budget;
+    std::unordered_map<std::string, class_info> _classes;
+
+    const class_info* _caller_class = nullptr;
+    const ast_class_subroutine* _caller_subroutine = nullptr;
+public:
+    explicit inliner(uint16_t size_budget = DEFAULT_SIZE_BUDGET) : _size_budget(size_budget) {};
+    ~inliner() = default;
+
+    void run(const std::vector<ast_class*>& classes);
+private:
+    void _inline_statements(std::list<ast_statement*>& statements);
+    void _inline_expression(ast_expression& expression);
+    void _inline_term(ast_term*& term);
+    void _inline_call_arguments(ast_subroutine_call& call);
+
+    ast_term* _try_inline_call(const ast_subroutine_call& call);
+    bool _try_inline_do(const ast_subroutine_call& call, std::list<ast_statement*>& replacement);
+    // Records the callee's class, and every class inlined into it, as dependencies of the caller's
+    void _record_inlined(const substitution& subst);
+
+    const ast_class_subroutine* _resolve_callee(const ast_subroutine_call& call, substitution& subst);
+    bool _bind_arguments(const ast_class_subroutine& callee, const ast_subroutine_call& call, substitution& subst);
+    std::optional<std::string> _variable_type(const std::string& identifier) const;
+
+    bool _is_inlinable_expression(const ast_expression& expression, const substitution& subst, uint32_t& size) const;
+    bool _is_inlinable_term(const ast_term* term, const substitution& subst, uint32_t& size) const;
+    bool _is_inlinable_identifier(const std::string& identifier, const substitution& subst) const;
+
+    static ast_expression _clone_expression(const ast_expression& expression, const substitution& subst);
+    static ast_term* _clone_term(const ast_term* term, const substitution& subst);
+    static ast_term* _clone_identifier(const std::string& identifier, const substitution& subst);
+
+    static bool _is_pure_expression(const ast_expression& expression);
+    static bool _is_pure_term(const ast_term* term);
+    static bool _is_trivial_expression(const ast_expression& expression);
+    static uint32_t _count_uses(const ast_expression& expression, const std::string& identifier);
+    static uint32_t _count_uses(const ast_term* term, const std::string& identifier);
+};
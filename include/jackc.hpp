@@ -0,0 +1,57 @@
+#pragma once
+
+#include "generator.hpp"
+#include "inliner.hpp"
+#include "lexer.hpp"
+
+#include <string>
+#include <vector>
+
+/*
+ * In-memory compiler, the libjackc entry point. Takes source text instead of paths and returns
+ * the outputs and structured diagnostics instead of writing files and throwing. Every call owns
+ * all of its state, so any number of threads may compile at the same time.
+ */
+class jackc {
+public:
+    enum struct output_format_t {
+        VM,
+        BINARY
+    };
+
+    struct options {
+        output_format_t output_format = output_format_t::VM;
+        uint16_t inline_budget = inliner::DEFAULT_SIZE_BUDGET;
+        generator::cost_model costs;
+        uint32_t max_nesting = lexer::DEFAULT_MAX_NESTING;
+    };
+
+    struct source {
+        // Identifies the source in diagnostics, usually its file name
+        std::string name;
+        std::string code;
+    };
+
+    struct diagnostic {
+        std::string source;
+        std::string message;
+    };
+
+    struct output {
+        std::string class_name;
+        // VM text or .vmb bytes
+        std::string code;
+    };
+
+    struct result {
+        // One per source, in order, empty when there are diagnostics
+        std::vector<output> outputs;
+        std::vector<diagnostic> diagnostics;
+
+        [[nodiscard]] bool succeeded() const { return diagnostics.empty(); };
+    };
+
+    // Compiles the sources as one program, every class numbers its static variables from 0
+    static result compile(const std::vector<source>& sources, const options& options);
+    static result compile(const std::vector<source>& sources) { return compile(sources, options()); };
+};
@@ -4,15 +4,37 @@
 #include "tokenizer.hpp"
 #include "ast.hpp"
 
+#include <functional>
+
 class lexer {
+public:
+    // Parentheses, brackets, argument lists and unary operators an expression may be nested in
+    static constexpr uint32_t DEFAULT_MAX_NESTING = 1024;
+
+    // Receives every subroutine as soon as it is parsed, the lexer frees it afterwards
+    typedef std::function<void(ast_class& cl, ast_class_subroutine& subroutine)> subroutine_callback;
 private:
     tokenizer* _tokenizer = nullptr;
-    ast_class* _class;
+    ast_class* _class = nullptr;
+    const subroutine_callback* _on_subroutine = nullptr;
+    uint32_t _max_nesting = DEFAULT_MAX_NESTING;
+    bool _skim = false;
 public:
-    ~lexer() = default;
+    ~lexer();
     lexer() = default;
+    lexer(const lexer&) = delete;
+    lexer& operator=(const lexer&) = delete;
 
     void run(tokenizer& tokenizer);
+    // Streaming parse, the class is left with its variables but no subroutines
+    void run(tokenizer& tokenizer, const subroutine_callback& on_subroutine);
+
+    void set_max_nesting(uint32_t max_nesting) { _max_nesting = max_nesting; };
+    // Skimming parses the class variables and every subroutine's signature and locals but only
+    // brace-matches the statements, which parse_body parses on demand
+    void set_skim(bool skim) { _skim = skim; };
+    // Parses the statements of a skimmed subroutine of the class, the tokenizer's source must still be alive
+    void parse_body(ast_class_subroutine& subroutine);
 
     [[nodiscard]] ast_class* get_class() const { return _class; };
 private:
@@ -34,7 +56,7 @@ private:
     token _expect_unary_op();
 
     ast_class* _parse_class();
-    ast_class_subroutine _parse_class_subroutine_declaration();
+    void _parse_class_subroutine_declaration(ast_class_subroutine& subroutine);
     ast_statement* _parse_statement();
     ast_statement_let * _parse_let_statement();
     ast_statement_if * _parse_if_statement();
@@ -42,8 +64,9 @@ private:
     ast_statement_do * _parse_do_statement();
     ast_statement_return * _parse_return_statement();
     ast_expression _parse_expression();
+    ast_subroutine_call _parse_subroutine_call_head();
     ast_subroutine_call _parse_subroutine_call();
-    ast_term * _parse_term();
+    ast_term * _parse_constant_term();
     void _parse_statements(std::list<ast_statement *> &statements);
 
     static ast_binary_op _binary_op_from_token(const token& token);
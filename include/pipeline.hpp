@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ast.hpp"
+#include "generator.hpp"
+#include "resolver.hpp"
+
+#include <functional>
+#include <vector>
+
+/*
+ * The passes between parsing and output, shared by compiler::run and jackc::compile so both compile
+ * a program the same way: prune every class, inline the program, then resolve, prune again and
+ * generate each class being compiled. The caller runs the per-class phases, through resolve and
+ * generate, on the classes and threads it likes.
+ */
+class pipeline {
+public:
+    enum struct phase_t {
+        RESOLVE,
+        GENERATE
+    };
+
+    // Returns false when run_phase does, a failed phase stops the pipeline
+    static bool run(const std::vector<ast_class*>& classes, uint16_t inline_budget, const std::function<bool(phase_t)>& run_phase);
+
+    static void resolve(resolver& resolver, ast_class* cl);
+    // Without a generator the class is only pruned, the C backend generates the whole program later
+    static void generate(generator* generator, ast_class* cl);
+};
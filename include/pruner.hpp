@@ -0,0 +1,28 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <list>
+#include <optional>
+
+/*
+ * Removes statements that can never run: everything after a return or a loop on a constant true
+ * condition (Jack has no break), loops on a constant false condition, and the branch of an if
+ * its constant condition never takes. Runs before inlining, so callees are measured without their
+ * dead tails, and again after it so inlined flags fold too.
+ */
+class pruner {
+public:
+    pruner() = default;
+    ~pruner() = default;
+
+    void run(ast_class* ast);
+    void run(ast_class_subroutine& subroutine);
+
+    // Value of an expression built from constants only, evaluated with Jack's 16 bit arithmetic
+    static std::optional<int16_t> fold(const ast_expression& expression);
+    static std::optional<int16_t> fold(const ast_term* term);
+private:
+    // Returns whether control never reaches the end of the statements
+    bool _prune(std::list<ast_statement*>& statements);
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "ast.hpp"
+#include "symbol.hpp"
+
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+/*
+ * Binds every identifier use in a class to its segment and slot, and every call to the class it
+ * targets, so the generator never looks up names. Also fills in the field and local counts and
+ * records the classes the class depends on.
+ */
+class resolver {
+public:
+    // Static segment is RAM[16..255], other segment indices and constants are 15 bit A-instruction values
+    static constexpr uint32_t MAX_STATIC_COUNT = 240;
+    static constexpr uint32_t MAX_CONSTANT = 32767;
+private:
+    ast_class* _top_level = nullptr;
+    std::unordered_map<std::string, symbol> _global_symbols;
+    std::unordered_map<std::string, symbol> _subroutine_symbols;
+
+    uint32_t _next_this_index = 0;
+    uint32_t _next_local_index = 0;
+    uint32_t _next_arg_index = 0;
+
+    std::set<std::string> _referenced_classes;
+public:
+    resolver() = default;
+    ~resolver() = default;
+
+    // Statics are numbered from 0 in every class, the VM's static segment is per file
+    void run(ast_class* ast);
+    // run split in two for streaming: the class variables, then one subroutine at a time
+    void declare_class(ast_class* ast);
+    void resolve_subroutine(ast_class_subroutine& subroutine);
+
+    // Other classes named by variable, parameter and return types or called into, sorted
+    [[nodiscard]] const std::set<std::string>& get_referenced_classes() const { return _referenced_classes; };
+private:
+    void _resolve_statements(const std::list<ast_statement*>& statements);
+    void _resolve_expression(ast_expression& expression);
+    void _resolve_term(ast_term* term);
+    void _resolve_subroutine_call(ast_subroutine_call& call);
+
+    ast_slot _get_slot(const std::string& identifier);
+    const symbol* _try_get_symbol(const std::string& identifier);
+    void _reference(const std::string& type);
+private:
+    static void _check_limit(uint64_t count, uint32_t limit, const std::string& what);
+public:
+    static uint32_t count_statics(const ast_class& ast);
+    // Once linked the statics of every class share RAM[16..255], throws when the program has too many
+    static void check_program_statics(uint64_t count) { _check_limit(count, MAX_STATIC_COUNT, "static variables in the program"); };
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <string>
+#include <vector>
+
+/*
+ * Side-car of a .vm output relating its lines to the Jack source. Text, one record per line:
+ *   jack-map <version>
+ *   source <file name>
+ *   <first vm line>-<last vm line> <line>:<column>-<line>:<column>
+ * All numbers are 1-based, the source span ends before its last column. A line belongs to the
+ * innermost statement it was generated for, or to the subroutine outside of any statement. For
+ * .vmb output the line numbers are instruction numbers.
+ */
+class source_map {
+public:
+    static constexpr uint16_t VERSION = 1;
+
+    // The VM code from vm_offset up to the next segment was generated for span
+    struct segment {
+        size_t vm_offset = 0;
+        ast_span span;
+    };
+private:
+    // Offset of the first character of every source line
+    std::vector<uint32_t> _line_starts;
+    std::string _text;
+    uint32_t _vm_lines = 0;
+public:
+    source_map(const std::string& source_name, const std::string& source);
+    ~source_map() = default;
+
+    // Records the segments of the next piece of VM code, in VM order
+    void add(const std::string& vm_code, const std::vector<segment>& segments);
+
+    [[nodiscard]] const std::string& get_text() const { return _text; };
+    // Streaming: drops the records already written out
+    void clear_text() { _text.clear(); };
+private:
+    void _format_position(uint32_t offset);
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <list>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+/*
+ * Interface of a compiled class, written next to its output so later runs can plan without
+ * parsing it. Text, one record per line:
+ *   jack-summary <version>
+ *   source <hash>                                 FNV-1a of the compiler options and the source
+ *   class <name>
+ *   fields <count>
+ *   statics <count>
+ *   subroutine <kind> <return type> <name> <local count> [<parameter type>...]
+ *   call <class>.<subroutine> <argument count>    every distinct call left after inlining
+ *   use <class> <hash or ->                       referenced classes, '-' when not part of the program
+ */
+struct class_summary {
+    static constexpr uint16_t VERSION = 2;
+
+    // <class>.<subroutine> and argument count
+    typedef std::set<std::pair<std::string, uint16_t>> call_set;
+
+    struct subroutine {
+        ast_class_subroutine::type_t type = ast_class_subroutine::type_t::FUNCTION;
+        std::string return_type;
+        std::string identifier;
+        uint16_t local_count = 0;
+        std::vector<std::string> parameter_types;
+    };
+
+    struct use {
+        std::string class_name;
+        std::optional<uint64_t> source_hash;
+    };
+
+    uint64_t source_hash = 0;
+    std::string class_name;
+    uint16_t field_count = 0;
+    uint32_t static_count = 0;
+    std::list<subroutine> subroutines;
+    std::list<std::pair<std::string, uint16_t>> calls;
+    std::list<use> uses;
+
+    // Fills in everything but the uses from a resolved class
+    static class_summary build(const ast_class& ast, uint64_t source_hash);
+
+    [[nodiscard]] std::string serialize() const;
+    // Returns nothing for malformed summaries or other versions
+    static std::optional<class_summary> parse(const std::string& text);
+
+    // Adds every call the resolved statements make
+    static void collect_calls(const std::list<ast_statement*>& statements, call_set& calls);
+
+    static uint64_t hash(const std::string& data, uint64_t seed = 0xcbf29ce484222325);
+};
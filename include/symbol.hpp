@@ -13,7 +13,7 @@ struct symbol {
         THIS
     };
 
-    static std::string segment_to_string(segment_t segment) {
+    static const char* segment_to_string(segment_t segment) {
         switch(segment) {
             case segment_t::LOCAL:
                 return "local";
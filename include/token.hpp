@@ -10,7 +10,9 @@ struct token {
         IDENTIFIER,
         SYMBOL,
         STRING_CONSTANT,
-        INT_CONSTANT
+        INT_CONSTANT,
+        // Past the last token of the source
+        END
     };
 
     enum class keyword_t {
@@ -46,6 +48,10 @@ struct token {
 
     type_t type;
     value_t value;
+    // Byte offset of the first character in the source and the length of the token's text, the
+    // line and column are only worked out when needed (see source_map)
+    uint32_t offset = 0;
+    uint32_t length = 0;
 
     template <typename Return>
     inline const Return& get_value() const {
@@ -2,28 +2,55 @@
 
 #include "token.hpp"
 
+#include <array>
 #include <string>
-#include <list>
-#include <regex>
 
+/*
+ * Pull tokenizer, tokens are scanned from the source on demand so only the lookahead is ever
+ * held in memory. The source must outlive the tokenizer's use of it.
+ */
 class tokenizer {
+public:
+    // Largest integer constant the Hack VM can push
+    static constexpr uint32_t INT_CONSTANT_MAX = 32767;
+    // Tokens peek can look ahead, the lexer needs one past the next
+    static constexpr uint32_t LOOKAHEAD = 2;
 private:
-    std::list<token> _tokens;
-    std::list<token>::const_iterator _tokens_it;
+    const std::string* _source = nullptr;
+    size_t _position = 0;
+
+    // Ring of scanned but not yet consumed tokens
+    std::array<token, LOOKAHEAD> _lookahead;
+    uint32_t _lookahead_start = 0;
+    uint32_t _lookahead_count = 0;
+    // Last token returned by next, valid until the following call
+    token _current;
+    // Returned once the source is exhausted
+    token _end{token::type_t::END, token::value_t()};
 public:
     tokenizer() = default;
     ~tokenizer() = default;
 
-    void run(std::string& source_code);
+    void run(const std::string& source_code);
 
     void reset();
     const token& next();
     const token& peek(uint32_t offset = 0);
     bool has_next();
+    // Source offset just past the last token returned by next
+    [[nodiscard]] uint32_t get_consumed_end() const { return _current.offset + _current.length; };
+
+    // Moves past everything up to the '}' closing a block whose '{' was already consumed, matching
+    // braces without tokenizing (strings and comments are still skipped). Returns the offset where
+    // the block's contents start, next returns the closing brace
+    uint32_t skip_block();
+    // Drops the lookahead and continues scanning at offset
+    void seek(uint32_t offset);
 private:
+    bool _fill(uint32_t count);
+
     static void _token_process_symbol(const token::symbol_t&, std::string& str);
 
-    static void _source_remove_comments(std::string& source_code);
-    static bool _source_next_token(token &token, std::string &source_code);
-    static std::string _check_matches(const std::smatch &matches, std::string &source_code);
-};
\ No newline at end of file
+    static void _source_skip_whitespace(const std::string& source_code, size_t& i);
+    static bool _source_next_token(token &token, const std::string &source_code, size_t& i);
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Records timed spans for a Chrome trace-event JSON file (chrome://tracing, ui.perfetto.dev).
+ * Every thread appends to a buffer of its own, found through a thread_local, so recording never
+ * takes a lock: a thread only locks once, to hand its new buffer to the tracer. to_json must only
+ * be called once the recording threads are done.
+ */
+class tracer {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    struct event {
+        const char* name = nullptr;
+        // Source file the span worked on, nullptr for whole program phases. Must outlive the tracer's use
+        const std::filesystem::path* file = nullptr;
+        clock::time_point begin;
+        clock::time_point end;
+    };
+
+    // Records the time from construction to destruction on the current thread, a null tracer records nothing
+    class span {
+    private:
+        tracer* _tracer;
+        const char* _name;
+        const std::filesystem::path* _file;
+        clock::time_point _begin;
+    public:
+        span(tracer* tracer, const char* name, const std::filesystem::path* file = nullptr)
+            : _tracer(tracer), _name(name), _file(file), _begin(tracer != nullptr ? clock::now() : clock::time_point()) {};
+        ~span() { if(_tracer != nullptr) _tracer->record(_name, _file, _begin, clock::now()); };
+        span(const span&) = delete;
+        span& operator=(const span&) = delete;
+    };
+private:
+    struct thread_buffer {
+        std::thread::id thread;
+        std::vector<event> events;
+    };
+
+    // Tells a thread's cached buffer of an earlier tracer from one of this tracer
+    static std::atomic<uint64_t> _next_id;
+    uint64_t _id;
+    clock::time_point _start;
+    std::thread::id _main_thread;
+
+    std::mutex _buffers_mutex;
+    // In the order threads first recorded, which is also their track order
+    std::vector<std::unique_ptr<thread_buffer>> _buffers;
+public:
+    tracer();
+    ~tracer() = default;
+    tracer(const tracer&) = delete;
+    tracer& operator=(const tracer&) = delete;
+
+    void record(const char* name, const std::filesystem::path* file, clock::time_point begin, clock::time_point end);
+
+    // One track per thread, the thread that created the tracer is named main
+    [[nodiscard]] std::string to_json() const;
+private:
+    thread_buffer& _thread_buffer();
+
+    static void _append_escaped(std::string& out, const std::string& str);
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "vm.hpp"
+
+#include <list>
+#include <string>
+#include <vector>
+
+/*
+ * Hack assembly backend, links the VM code of every class into a single program.
+ * Call, return and comparisons go through shared trampolines, and operands consumed
+ * by the next command are kept in D instead of going through the stack.
+ */
+class translator {
+private:
+    struct unit {
+        std::string name;
+        std::vector<vm_instruction> code;
+    };
+
+    std::list<unit> _units;
+    std::list<std::string> _asm_code;
+
+    const unit* _unit = nullptr;
+    std::string _function;
+    uint32_t _next_return = 0;
+public:
+    translator() = default;
+    ~translator() = default;
+
+    void add(std::string unit_name, const std::string& vm_code);
+    // Throws std::runtime_error listing the called functions no unit defines
+    void run();
+
+    [[nodiscard]] const std::list<std::string>& get_asm_code() const { return _asm_code; };
+private:
+    void _check_calls() const;
+    std::string _entry() const;
+    void _translate_bootstrap();
+    void _translate_trampolines();
+    void _translate_signed_difference(const std::string& name);
+    void _translate_unit(const unit& unit);
+    size_t _translate_push(const std::vector<vm_instruction>& code, size_t i);
+    void _translate_instruction(const vm_instruction& instruction);
+
+    void _load_d(const vm_instruction& push);
+    void _store_d(vm_instruction::segment_t segment, uint16_t index);
+    void _pop_d();
+    void _push_d();
+    void _apply_d(vm_instruction::op_t op);
+    // Both expect y in D and x on top of the stack
+    void _compare_top(vm_instruction::op_t op);
+    void _jump_compare(vm_instruction::op_t op, bool negate, const std::string& label);
+    void _call_compare(const char* trampoline);
+    void _call(const std::string& function, uint16_t arg_count);
+
+    std::string _label(const std::string& name) const;
+    std::string _static(uint16_t index) const;
+
+    static bool _is_arithmetic(vm_instruction::op_t op);
+    static bool _is_compare(vm_instruction::op_t op);
+    static const char* _segment_base(vm_instruction::segment_t segment);
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct vm_instruction {
+    enum struct op_t {
+        PUSH,
+        POP,
+        ADD,
+        SUB,
+        NEG,
+        EQ,
+        GT,
+        LT,
+        AND,
+        OR,
+        NOT,
+        LABEL,
+        GOTO,
+        IF_GOTO,
+        FUNCTION,
+        CALL,
+        RETURN
+    };
+
+    enum struct segment_t {
+        CONSTANT,
+        LOCAL,
+        ARGUMENT,
+        STATIC,
+        THIS,
+        THAT,
+        POINTER,
+        TEMP
+    };
+
+    op_t op = op_t::RETURN;
+    segment_t segment = segment_t::CONSTANT;
+    uint16_t index = 0;
+    std::string name;
+
+    static vm_instruction parse(const std::string& line);
+    // Parses newline separated VM commands, blank lines are skipped
+    static std::vector<vm_instruction> parse_all(const std::string& text);
+
+    static op_t op_from_string(const std::string& str);
+    static segment_t segment_from_string(const std::string& str);
+    static std::string op_to_string(op_t op);
+    static std::string segment_to_string(segment_t segment);
+    static std::string to_string(const vm_instruction& instruction);
+};
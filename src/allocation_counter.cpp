@@ -0,0 +1,59 @@
+#include "allocation_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef COUNT_ALLOCATIONS
+
+static std::atomic<uint64_t> allocation_count = 0;
+static std::atomic<uint64_t> allocation_bytes = 0;
+
+void* operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    if(auto ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+uint64_t allocation_counter::count() {
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+uint64_t allocation_counter::bytes() {
+    return allocation_bytes.load(std::memory_order_relaxed);
+}
+
+#else
+
+uint64_t allocation_counter::count() {
+    return 0;
+}
+
+uint64_t allocation_counter::bytes() {
+    return 0;
+}
+
+#endif
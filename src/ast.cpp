@@ -0,0 +1,115 @@
+#include "ast.hpp"
+
+// The AST is recursive, disable recursion check
+// NOLINTBEGIN(misc-no-recursion)
+
+// Nodes have no virtual destructors, so each one is deleted through its concrete type
+void ast_free(ast_term* term) {
+    switch(term->type) {
+        case ast_term::type_t::INTEGER:
+            delete (ast_term_integer*)term;
+            break;
+        case ast_term::type_t::STRING:
+            delete (ast_term_string*)term;
+            break;
+        case ast_term::type_t::VARIABLE:
+            delete (ast_term_variable*)term;
+            break;
+        case ast_term::type_t::ARRAY: {
+            auto array_term = (ast_term_array*)term;
+            ast_free(array_term->access);
+            delete array_term;
+            break;
+        }
+        case ast_term::type_t::EXPRESSION: {
+            auto expression_term = (ast_term_expression*)term;
+            ast_free(expression_term->expression);
+            delete expression_term;
+            break;
+        }
+        case ast_term::type_t::UNARY: {
+            auto unary_term = (ast_term_unary*)term;
+            ast_free(unary_term->term);
+            delete unary_term;
+            break;
+        }
+        case ast_term::type_t::SUBROUTINE_CALL: {
+            auto call_term = (ast_term_subroutine_call*)term;
+            ast_free(call_term->call);
+            delete call_term;
+            break;
+        }
+        default:
+            delete term;
+            break;
+    }
+}
+
+void ast_free(ast_expression& expression) {
+    if(expression.primary != nullptr)
+        ast_free(expression.primary);
+    for(auto& pair : expression.secondaries)
+        ast_free(pair.second);
+
+    expression.primary = nullptr;
+    expression.secondaries.clear();
+}
+
+void ast_free(ast_subroutine_call& call) {
+    for(auto& argument : call.arguments)
+        ast_free(argument);
+}
+
+void ast_free(ast_statement* statement) {
+    switch(statement->type) {
+        case ast_statement::type_t::LET: {
+            auto let_statement = (ast_statement_let*)statement;
+            if(let_statement->array_access.has_value())
+                ast_free(let_statement->array_access.value());
+            ast_free(let_statement->assignment);
+            delete let_statement;
+            break;
+        }
+        case ast_statement::type_t::IF: {
+            auto if_statement = (ast_statement_if*)statement;
+            ast_free(if_statement->conditional);
+            ast_free(if_statement->true_statements);
+            ast_free(if_statement->false_statements);
+            delete if_statement;
+            break;
+        }
+        case ast_statement::type_t::WHILE: {
+            auto while_statement = (ast_statement_while*)statement;
+            ast_free(while_statement->conditional);
+            ast_free(while_statement->statements);
+            delete while_statement;
+            break;
+        }
+        case ast_statement::type_t::DO: {
+            auto do_statement = (ast_statement_do*)statement;
+            ast_free(do_statement->call);
+            delete do_statement;
+            break;
+        }
+        case ast_statement::type_t::RETURN: {
+            auto return_statement = (ast_statement_return*)statement;
+            ast_free(return_statement->value);
+            delete return_statement;
+            break;
+        }
+    }
+}
+
+void ast_free(std::list<ast_statement*>& statements) {
+    for(auto statement : statements)
+        ast_free(statement);
+    statements.clear();
+}
+
+void ast_free(ast_class* ast) {
+    for(auto& subroutine : ast->subroutines)
+        ast_free(subroutine.statements);
+    delete ast;
+}
+
+// NOLINTEND(misc-no-recursion)
@@ -0,0 +1,102 @@
+#include "compiler.hpp"
+
+#include <iostream>
+#include <optional>
+
+static bool starts_with(const std::string& str, const std::string& prefix) {
+    return str.rfind(prefix, 0) == 0;
+}
+
+static uint64_t count_source_lines(const std::filesystem::path& path) {
+    std::list<std::filesystem::path> files;
+    if(std::filesystem::is_directory(path)) {
+        for(const auto& entry : std::filesystem::directory_iterator(path)) {
+            if(entry.path().extension() == ".jack")
+                files.push_back(entry.path());
+        }
+    } else {
+        files.push_back(path);
+    }
+
+    uint64_t lines = 0;
+    for(const auto& file : files) {
+        std::ifstream in(file);
+        std::string line;
+        while(std::getline(in, line))
+            lines++;
+    }
+    return lines;
+}
+
+int main(int argc, char** argv) {
+    compiler compiler;
+    std::optional<std::string> source_path;
+    uint32_t iterations = 20;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        try {
+            if(starts_with(arg, "--iterations=")) {
+                iterations = std::max(1, std::stoi(arg.substr(arg.find('=') + 1)));
+            } else if(arg == "--asm") {
+                compiler.set_output_format(compiler::output_format_t::ASM);
+            } else if(starts_with(arg, "--")) {
+                std::cerr << "Unknown option '" << arg << "'" << std::endl;
+                return 1;
+            } else {
+                source_path = arg;
+            }
+        } catch(const std::logic_error&) {
+            std::cerr << "Invalid value for option '" << arg << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    if(!source_path.has_value()) {
+        std::cerr << "Usage: bench [--iterations=N] [--asm] <source file or directory>" << std::endl;
+        return 1;
+    }
+
+    std::vector<compiler::phase_stats> totals;
+    try {
+        for(uint32_t i = 0; i < iterations; i++) {
+            compiler.run(source_path.value());
+
+            const auto& phases = compiler.get_phase_stats();
+            totals.resize(phases.size());
+            for(size_t p = 0; p < phases.size(); p++) {
+                totals[p].name = phases[p].name;
+                totals[p].milliseconds += phases[p].milliseconds;
+                totals[p].allocations += phases[p].allocations;
+            }
+        }
+    } catch(const compiler::error& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    auto lines = count_source_lines(source_path.value());
+    std::cout << iterations << " iterations, " << lines << " source lines, averages per iteration:" << std::endl;
+
+    compiler::phase_stats sum;
+    for(const auto& phase : totals) {
+        std::cout << "\t" << phase.name << "\t" << phase.milliseconds / iterations << " ms";
+        if(allocation_counter::enabled())
+            std::cout << "\t" << phase.allocations / iterations << " allocations";
+        std::cout << std::endl;
+
+        sum.milliseconds += phase.milliseconds;
+        sum.allocations += phase.allocations;
+    }
+
+    std::cout << "\ttotal\t" << sum.milliseconds / iterations << " ms";
+    if(allocation_counter::enabled())
+        std::cout << "\t" << sum.allocations / iterations << " allocations (" << (double)sum.allocations / iterations / std::max<uint64_t>(lines, 1) << " per line)";
+    std::cout << std::endl;
+
+    if(!allocation_counter::enabled())
+        std::cout << "Configure with -DCOUNT_ALLOCATIONS=ON to count allocations" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+#include "bytecode.hpp"
+
+#include <fstream>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    if(argc < 2 || argc > 3) {
+        std::cerr << "Usage: bin2vm <input.vmb> [output.vm]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream input(argv[1], std::ios::binary);
+    if(input.fail()) {
+        std::cerr << "Failed to open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::ofstream output_file;
+    if(argc == 3)
+        output_file.open(argv[2]);
+    std::ostream& output = argc == 3 ? output_file : std::cout;
+
+    try {
+        for(const auto& instruction : bytecode::decode(bytecode::read(input)))
+            output << vm_instruction::to_string(instruction) << std::endl;
+    } catch(const std::runtime_error& e) {
+        std::cerr << argv[1] << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
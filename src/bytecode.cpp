@@ -0,0 +1,195 @@
+#include "bytecode.hpp"
+
+#include <stdexcept>
+#include <unordered_map>
+
+static const char MAGIC[4] = {'J', 'V', 'M', 'B'};
+
+static void write_u8(std::ostream& out, uint8_t value) {
+    out.put((char)value);
+}
+
+static void write_u16(std::ostream& out, uint16_t value) {
+    write_u8(out, value & 0xFF);
+    write_u8(out, value >> 8);
+}
+
+static void write_u32(std::ostream& out, uint32_t value) {
+    write_u16(out, value & 0xFFFF);
+    write_u16(out, value >> 16);
+}
+
+static uint8_t read_u8(std::istream& in) {
+    auto value = in.get();
+    if(value == std::istream::traits_type::eof())
+        throw std::runtime_error("Unexpected end of bytecode");
+    return (uint8_t)value;
+}
+
+static uint16_t read_u16(std::istream& in) {
+    uint16_t low = read_u8(in);
+    return low | (read_u8(in) << 8);
+}
+
+static uint32_t read_u32(std::istream& in) {
+    uint32_t low = read_u16(in);
+    return low | ((uint32_t)read_u16(in) << 16);
+}
+
+bytecode bytecode::encode(const std::vector<vm_instruction> &instructions) {
+    bytecode module;
+    module.code.reserve(instructions.size());
+
+    std::unordered_map<std::string, uint32_t> string_indices;
+    auto intern = [&](const std::string& str) {
+        auto check = string_indices.find(str);
+        if(check != string_indices.end())
+            return check->second;
+
+        auto index = (uint32_t)module.strings.size();
+        module.strings.push_back(str);
+        string_indices[str] = index;
+        return index;
+    };
+
+    // Labels are scoped to their function, so they are keyed by the enclosing function name
+    std::unordered_map<std::string, uint32_t> label_offsets;
+    std::string function;
+    for(uint32_t i = 0; i < instructions.size(); i++) {
+        const auto& vm = instructions[i];
+        instruction encoded;
+        encoded.op = (uint8_t)vm.op;
+        encoded.segment = (uint8_t)vm.segment;
+        encoded.index = vm.index;
+
+        switch(vm.op) {
+            case vm_instruction::op_t::FUNCTION:
+                function = vm.name;
+                encoded.operand = intern(vm.name);
+                break;
+            case vm_instruction::op_t::LABEL:
+                if(!label_offsets.emplace(function + "$" + vm.name, i).second)
+                    throw std::runtime_error("Duplicate label '" + vm.name + "' in " + function);
+                encoded.operand = intern(vm.name);
+                break;
+            case vm_instruction::op_t::CALL:
+                encoded.operand = intern(vm.name);
+                break;
+            default:
+                break;
+        }
+
+        module.code.push_back(encoded);
+    }
+
+    function.clear();
+    for(uint32_t i = 0; i < instructions.size(); i++) {
+        const auto& vm = instructions[i];
+        if(vm.op == vm_instruction::op_t::FUNCTION) {
+            function = vm.name;
+        } else if(vm.op == vm_instruction::op_t::GOTO || vm.op == vm_instruction::op_t::IF_GOTO) {
+            auto label = label_offsets.find(function + "$" + vm.name);
+            if(label == label_offsets.end())
+                throw std::runtime_error("Undefined label '" + vm.name + "' in " + function);
+            module.code[i].operand = label->second;
+        }
+    }
+
+    return module;
+}
+
+std::vector<vm_instruction> bytecode::decode(const bytecode &module) {
+    std::vector<vm_instruction> instructions;
+    instructions.reserve(module.code.size());
+
+    auto string_at = [&](uint32_t index) -> const std::string& {
+        if(index >= module.strings.size())
+            throw std::runtime_error("String index out of range");
+        return module.strings[index];
+    };
+
+    for(const auto& encoded : module.code) {
+        if(encoded.op > (uint8_t)vm_instruction::op_t::RETURN || encoded.segment > (uint8_t)vm_instruction::segment_t::TEMP)
+            throw std::runtime_error("Invalid instruction in bytecode");
+
+        vm_instruction vm;
+        vm.op = (vm_instruction::op_t)encoded.op;
+        vm.segment = (vm_instruction::segment_t)encoded.segment;
+        vm.index = encoded.index;
+
+        switch(vm.op) {
+            case vm_instruction::op_t::FUNCTION:
+            case vm_instruction::op_t::LABEL:
+            case vm_instruction::op_t::CALL:
+                vm.name = string_at(encoded.operand);
+                break;
+            case vm_instruction::op_t::GOTO:
+            case vm_instruction::op_t::IF_GOTO: {
+                if(encoded.operand >= module.code.size() || module.code[encoded.operand].op != (uint8_t)vm_instruction::op_t::LABEL)
+                    throw std::runtime_error("Branch target is not a label");
+                vm.name = string_at(module.code[encoded.operand].operand);
+                break;
+            }
+            default:
+                break;
+        }
+
+        instructions.push_back(std::move(vm));
+    }
+
+    return instructions;
+}
+
+void bytecode::write(const bytecode &module, std::ostream &out) {
+    out.write(MAGIC, sizeof(MAGIC));
+    write_u16(out, VERSION);
+    write_u16(out, 0);
+    write_u32(out, module.strings.size());
+    write_u32(out, module.code.size());
+
+    for(const auto& str : module.strings) {
+        if(str.size() > UINT16_MAX)
+            throw std::runtime_error("String too long for bytecode");
+        write_u16(out, str.size());
+        out.write(str.data(), (std::streamsize)str.size());
+    }
+
+    for(const auto& encoded : module.code) {
+        write_u8(out, encoded.op);
+        write_u8(out, encoded.segment);
+        write_u16(out, encoded.index);
+        write_u32(out, encoded.operand);
+    }
+}
+
+bytecode bytecode::read(std::istream &in) {
+    char magic[sizeof(MAGIC)];
+    if(!in.read(magic, sizeof(magic)) || std::string(magic, sizeof(magic)) != std::string(MAGIC, sizeof(MAGIC)))
+        throw std::runtime_error("Not a bytecode file");
+
+    if(read_u16(in) != VERSION)
+        throw std::runtime_error("Unsupported bytecode version");
+    read_u16(in);
+
+    bytecode module;
+    auto string_count = read_u32(in);
+    auto code_count = read_u32(in);
+
+    for(uint32_t i = 0; i < string_count; i++) {
+        std::string str(read_u16(in), '\0');
+        if(!in.read(str.data(), (std::streamsize)str.size()))
+            throw std::runtime_error("Unexpected end of bytecode");
+        module.strings.push_back(std::move(str));
+    }
+
+    for(uint32_t i = 0; i < code_count; i++) {
+        instruction encoded;
+        encoded.op = read_u8(in);
+        encoded.segment = read_u8(in);
+        encoded.index = read_u16(in);
+        encoded.operand = read_u32(in);
+        module.code.push_back(encoded);
+    }
+
+    return module;
+}
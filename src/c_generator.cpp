@@ -0,0 +1,1009 @@
+#include "c_generator.hpp"
+#include "resolver.hpp"
+
+#include <fmt/format.h>
+
+#include <stdexcept>
+
+// Everything but the OS stubs, which are only emitted when called
+static const char* RUNTIME = R"C(#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+/* Program functions and runtime helpers may go unused */
+#define JACK_STATIC static __attribute__((unused))
+#define JACK_NORETURN __attribute__((noreturn))
+#else
+#define JACK_STATIC static
+#define JACK_NORETURN
+#endif
+
+#define JACK_RAM_SIZE 32768
+#define JACK_HEAP_BASE 2048
+#define JACK_HEAP_END 16384
+
+/* Objects, arrays and strings. Statics are arrays per class, locals and arguments C variables */
+static int16_t jack_memory[JACK_RAM_SIZE];
+
+/* Printed when the program ends, as vmemu does, so a backspace can take back a character */
+static char* jack_output;
+static size_t jack_output_length;
+static size_t jack_output_capacity;
+
+static JACK_NORETURN void jack_exit(int status) {
+    if(jack_output_length > 0) {
+        fwrite(jack_output, 1, jack_output_length, stdout);
+        if(jack_output[jack_output_length - 1] != '\n')
+            fputc('\n', stdout);
+    }
+    exit(status);
+}
+
+static JACK_NORETURN void jack_fail(const char* message) {
+    fprintf(stderr, "error: %s\n", message);
+    jack_exit(1);
+}
+
+JACK_STATIC JACK_NORETURN void jack_error(int16_t code) {
+    char message[32];
+    sprintf(message, "Sys.error(%d)", code);
+    jack_fail(message);
+}
+
+JACK_STATIC void jack_put(char c) {
+    if(jack_output_length == jack_output_capacity) {
+        jack_output_capacity = jack_output_capacity * 2 + 4096;
+        jack_output = (char*)realloc(jack_output, jack_output_capacity);
+        if(jack_output == NULL) {
+            fputs("error: out of memory\n", stderr);
+            exit(1);
+        }
+    }
+    jack_output[jack_output_length++] = c;
+}
+
+JACK_STATIC void jack_put_chars(const char* chars, int32_t length) {
+    int32_t i;
+    for(i = 0; i < length; i++)
+        jack_put(chars[i]);
+}
+
+JACK_STATIC void jack_put_int(int16_t value) {
+    char digits[8];
+    jack_put_chars(digits, sprintf(digits, "%d", value));
+}
+
+JACK_STATIC void jack_unput(void) {
+    if(jack_output_length > 0)
+        jack_output_length--;
+}
+
+/* 16 bit words, wrapping like the VM's arithmetic */
+JACK_STATIC int16_t jack_word(int32_t value) {
+    value &= 0xFFFF;
+    return (int16_t)(value >= 0x8000 ? value - 0x10000 : value);
+}
+
+JACK_STATIC int16_t jack_add(int16_t a, int16_t b) { return jack_word((int32_t)a + b); }
+JACK_STATIC int16_t jack_sub(int16_t a, int16_t b) { return jack_word((int32_t)a - b); }
+JACK_STATIC int16_t jack_mul(int16_t a, int16_t b) { return jack_word((int32_t)a * b); }
+JACK_STATIC int16_t jack_neg(int16_t a) { return jack_word(-(int32_t)a); }
+JACK_STATIC int16_t jack_and(int16_t a, int16_t b) { return (int16_t)(a & b); }
+JACK_STATIC int16_t jack_or(int16_t a, int16_t b) { return (int16_t)(a | b); }
+JACK_STATIC int16_t jack_not(int16_t a) { return (int16_t)~a; }
+JACK_STATIC int16_t jack_eq(int16_t a, int16_t b) { return a == b ? -1 : 0; }
+JACK_STATIC int16_t jack_gt(int16_t a, int16_t b) { return a > b ? -1 : 0; }
+JACK_STATIC int16_t jack_lt(int16_t a, int16_t b) { return a < b ? -1 : 0; }
+
+JACK_STATIC int16_t jack_div(int16_t a, int16_t b) {
+    if(b == 0)
+        jack_error(3);
+    return jack_word((int32_t)a / b);
+}
+
+JACK_STATIC int16_t* jack_ram(int32_t address) {
+    if(address < 0 || address >= JACK_RAM_SIZE) {
+        char message[64];
+        sprintf(message, "Memory access out of range (%ld)", (long)address);
+        jack_fail(message);
+    }
+    return &jack_memory[address];
+}
+
+/* An array element, its address is read unsigned like pointer 1 */
+JACK_STATIC int16_t* jack_at(int16_t address) { return jack_ram((uint16_t)address); }
+/* A field, the index is added to the unsigned object address without wrapping like the this segment */
+JACK_STATIC int16_t* jack_field(int16_t object, uint16_t index) { return jack_ram((int32_t)(uint16_t)object + index); }
+
+/* First fit over the free blocks in address order, then the untouched rest of the heap. Freed
+   blocks are never merged, which gives the same addresses as vmemu */
+struct jack_block {
+    int32_t address;
+    int32_t size;
+};
+
+static struct jack_block jack_free_blocks[JACK_HEAP_END - JACK_HEAP_BASE];
+static int32_t jack_free_count;
+/* Size of the allocated block at an address, 0 when none starts there */
+static int16_t jack_block_sizes[JACK_RAM_SIZE];
+static int32_t jack_heap_next = JACK_HEAP_BASE;
+
+JACK_STATIC int16_t jack_alloc(int16_t size) {
+    int32_t i;
+    int32_t address;
+    if(size <= 0)
+        jack_error(5);
+
+    for(i = 0; i < jack_free_count; i++) {
+        if(jack_free_blocks[i].size < size)
+            continue;
+
+        address = jack_free_blocks[i].address;
+        if(jack_free_blocks[i].size > size) {
+            jack_free_blocks[i].address += size;
+            jack_free_blocks[i].size -= size;
+        } else {
+            memmove(&jack_free_blocks[i], &jack_free_blocks[i + 1], (size_t)(jack_free_count - i - 1) * sizeof(struct jack_block));
+            jack_free_count--;
+        }
+        jack_block_sizes[address] = size;
+        return (int16_t)address;
+    }
+
+    if(jack_heap_next + size > JACK_HEAP_END)
+        jack_error(6);
+
+    address = jack_heap_next;
+    jack_heap_next += size;
+    jack_block_sizes[address] = size;
+    return (int16_t)address;
+}
+
+JACK_STATIC void jack_free(int16_t address) {
+    int32_t i;
+    if(address < 0 || jack_block_sizes[address] == 0)
+        return;
+
+    for(i = jack_free_count; i > 0 && jack_free_blocks[i - 1].address > address; i--)
+        jack_free_blocks[i] = jack_free_blocks[i - 1];
+    jack_free_blocks[i].address = address;
+    jack_free_blocks[i].size = jack_block_sizes[address];
+    jack_free_count++;
+    jack_block_sizes[address] = 0;
+}
+
+/* Characters of a string (and of a line being read) */
+static char jack_text[JACK_RAM_SIZE];
+
+/* Copies a string's characters into jack_text and returns their count */
+JACK_STATIC int16_t jack_read_string(int16_t address) {
+    int32_t base = (uint16_t)address;
+    int16_t length = *jack_ram(base + 1);
+    int16_t i;
+    for(i = 0; i < length; i++)
+        jack_text[i] = (char)*jack_ram(base + 2 + i);
+    return length < 0 ? 0 : length;
+}
+
+/* A string holding the first length characters of jack_text */
+JACK_STATIC int16_t jack_new_string(int32_t length) {
+    int16_t str = jack_alloc(jack_word(length + 2));
+    int32_t i;
+    *jack_ram(str) = jack_word(length);
+    *jack_ram(str + 1) = jack_word(length);
+    for(i = 0; i < length && i < JACK_RAM_SIZE; i++)
+        *jack_ram(str + 2 + i) = jack_text[i];
+    return str;
+}
+
+/* Keyboard input, from the --keys and --input options */
+struct jack_key {
+    int16_t key;
+    uint32_t polls;
+};
+
+static struct jack_key* jack_keys;
+static size_t jack_key_count;
+static size_t jack_next_key_index;
+static int16_t* jack_inputs;
+static size_t jack_input_count;
+JACK_STATIC size_t jack_next_input;
+
+JACK_STATIC int16_t jack_next_key(void) {
+    struct jack_key* key;
+    if(jack_next_key_index == jack_key_count)
+        return 0;
+
+    key = &jack_keys[jack_next_key_index];
+    if(--key->polls == 0)
+        jack_next_key_index++;
+    return key->key;
+}
+
+/* --keys=K*N,... and --input=V,... as vmemu reads them */
+static int jack_parse_options(int argc, char** argv) {
+    int i;
+    for(i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* item;
+        int keys = strncmp(arg, "--keys=", 7) == 0;
+        if(!keys && strncmp(arg, "--input=", 8) != 0) {
+            fprintf(stderr, "Unknown option '%s'\nUsage: %s [--keys=K*N,...] [--input=V,...]\n", arg, argv[0]);
+            return 0;
+        }
+
+        for(item = strchr(arg, '=') + 1; *item != '\0'; ) {
+            const char* end = strchr(item, ',');
+            char* parsed;
+            long value;
+            if(end == NULL)
+                end = item + strlen(item);
+            if(end == item) {
+                item++;
+                continue;
+            }
+
+            value = strtol(item, &parsed, 10);
+            if(parsed == item)
+                goto invalid;
+
+            if(keys) {
+                const char* star = (const char*)memchr(item, '*', (size_t)(end - item));
+                unsigned long polls = 1;
+                if(star != NULL) {
+                    polls = strtoul(star + 1, &parsed, 10);
+                    if(parsed == star + 1)
+                        goto invalid;
+                }
+
+                jack_keys = (struct jack_key*)realloc(jack_keys, (jack_key_count + 1) * sizeof(struct jack_key));
+                if(jack_keys == NULL)
+                    goto invalid;
+                jack_keys[jack_key_count].key = (int16_t)value;
+                jack_keys[jack_key_count].polls = (uint32_t)polls;
+                jack_key_count++;
+            } else {
+                jack_inputs = (int16_t*)realloc(jack_inputs, (jack_input_count + 1) * sizeof(int16_t));
+                if(jack_inputs == NULL)
+                    goto invalid;
+                jack_inputs[jack_input_count++] = (int16_t)value;
+            }
+
+            item = *end == ',' ? end + 1 : end;
+        }
+    }
+    return 1;
+
+invalid:
+    fprintf(stderr, "Invalid value for option '%s'\n", argv[i]);
+    return 0;
+}
+)C";
+
+// C versions of vmemu's stubs, the parameters are a0, a1, ...
+struct native {
+    const char* name;
+    uint16_t arg_count;
+    const char* body;
+};
+
+static const native NATIVES[] = {
+    {"Math.init", 0, R"(
+    return 0;
+)"},
+    {"Math.abs", 1, R"(
+    return jack_word(a0 < 0 ? -(int32_t)a0 : a0);
+)"},
+    {"Math.multiply", 2, R"(
+    return jack_mul(a0, a1);
+)"},
+    {"Math.divide", 2, R"(
+    return jack_div(a0, a1);
+)"},
+    {"Math.min", 2, R"(
+    return a1 < a0 ? a1 : a0;
+)"},
+    {"Math.max", 2, R"(
+    return a0 < a1 ? a1 : a0;
+)"},
+    {"Math.sqrt", 1, R"(
+    int16_t root = 0;
+    if(a0 < 0)
+        jack_error(4);
+    while((int32_t)(root + 1) * (root + 1) <= a0)
+        root++;
+    return root;
+)"},
+    {"Memory.init", 0, R"(
+    return 0;
+)"},
+    {"Memory.peek", 1, R"(
+    return *jack_ram(a0);
+)"},
+    {"Memory.poke", 2, R"(
+    *jack_ram(a0) = a1;
+    return 0;
+)"},
+    {"Memory.alloc", 1, R"(
+    return jack_alloc(a0);
+)"},
+    {"Memory.deAlloc", 1, R"(
+    jack_free(a0);
+    return 0;
+)"},
+    {"Array.new", 1, R"(
+    if(a0 <= 0)
+        jack_error(2);
+    return jack_alloc(a0);
+)"},
+    {"Array.dispose", 1, R"(
+    jack_free(a0);
+    return 0;
+)"},
+    {"String.new", 1, R"(
+    int16_t str;
+    if(a0 < 0)
+        jack_error(14);
+    str = jack_alloc(jack_word(a0 + 2));
+    *jack_ram(str) = a0;
+    *jack_ram(str + 1) = 0;
+    return str;
+)"},
+    {"String.dispose", 1, R"(
+    jack_free(a0);
+    return 0;
+)"},
+    {"String.length", 1, R"(
+    return *jack_ram(a0 + 1);
+)"},
+    {"String.charAt", 2, R"(
+    if(a1 < 0 || a1 >= *jack_ram(a0 + 1))
+        jack_error(15);
+    return *jack_ram(a0 + 2 + a1);
+)"},
+    {"String.setCharAt", 3, R"(
+    if(a1 < 0 || a1 >= *jack_ram(a0 + 1))
+        jack_error(16);
+    *jack_ram(a0 + 2 + a1) = a2;
+    return 0;
+)"},
+    {"String.appendChar", 2, R"(
+    int16_t length = *jack_ram(a0 + 1);
+    if(length >= *jack_ram(a0))
+        jack_error(17);
+    *jack_ram(a0 + 2 + length) = a1;
+    *jack_ram(a0 + 1) = jack_word(length + 1);
+    return a0;
+)"},
+    {"String.eraseLastChar", 1, R"(
+    int16_t* length = jack_ram(a0 + 1);
+    if(*length == 0)
+        jack_error(18);
+    *length = jack_word(*length - 1);
+    return 0;
+)"},
+    {"String.intValue", 1, R"(
+    int16_t length = jack_read_string(a0);
+    int negative = length > 0 && jack_text[0] == '-';
+    int16_t value = 0;
+    int16_t i;
+    for(i = negative ? 1 : 0; i < length && jack_text[i] >= '0' && jack_text[i] <= '9'; i++)
+        value = jack_word(value * 10 + (jack_text[i] - '0'));
+    return negative ? jack_neg(value) : value;
+)"},
+    {"String.setInt", 2, R"(
+    char digits[8];
+    int16_t length = (int16_t)sprintf(digits, "%d", a1);
+    int16_t i;
+    if(length > *jack_ram(a0))
+        jack_error(19);
+    for(i = 0; i < length; i++)
+        *jack_ram(a0 + 2 + i) = digits[i];
+    *jack_ram(a0 + 1) = length;
+    return 0;
+)"},
+    {"String.backSpace", 0, R"(
+    return 129;
+)"},
+    {"String.doubleQuote", 0, R"(
+    return 34;
+)"},
+    {"String.newLine", 0, R"(
+    return 128;
+)"},
+    {"Output.init", 0, R"(
+    return 0;
+)"},
+    {"Output.moveCursor", 2, R"(
+    (void)a0;
+    (void)a1;
+    jack_put('\n');
+    return 0;
+)"},
+    {"Output.printChar", 1, R"(
+    if(a0 == 128)
+        jack_put('\n');
+    else if(a0 == 129)
+        jack_unput();
+    else
+        jack_put((char)a0);
+    return 0;
+)"},
+    {"Output.printString", 1, R"(
+    jack_put_chars(jack_text, jack_read_string(a0));
+    return 0;
+)"},
+    {"Output.printInt", 1, R"(
+    jack_put_int(a0);
+    return 0;
+)"},
+    {"Output.println", 0, R"(
+    jack_put('\n');
+    return 0;
+)"},
+    {"Output.backSpace", 0, R"(
+    jack_unput();
+    return 0;
+)"},
+    {"Screen.init", 0, R"(
+    return 0;
+)"},
+    {"Screen.clearScreen", 0, R"(
+    return 0;
+)"},
+    {"Screen.setColor", 1, R"(
+    (void)a0;
+    return 0;
+)"},
+    {"Screen.drawPixel", 2, R"(
+    (void)a0;
+    (void)a1;
+    return 0;
+)"},
+    {"Screen.drawLine", 4, R"(
+    (void)a0;
+    (void)a1;
+    (void)a2;
+    (void)a3;
+    return 0;
+)"},
+    {"Screen.drawRectangle", 4, R"(
+    (void)a0;
+    (void)a1;
+    (void)a2;
+    (void)a3;
+    return 0;
+)"},
+    {"Screen.drawCircle", 3, R"(
+    (void)a0;
+    (void)a1;
+    (void)a2;
+    return 0;
+)"},
+    {"Keyboard.init", 0, R"(
+    return 0;
+)"},
+    {"Keyboard.keyPressed", 0, R"(
+    return jack_next_key();
+)"},
+    {"Keyboard.readChar", 0, R"(
+    int16_t key;
+    while((key = jack_next_key()) == 0) {
+        if(jack_next_key_index == jack_key_count)
+            jack_fail("Keyboard input exhausted");
+    }
+    jack_put((char)key);
+    return key;
+)"},
+    {"Keyboard.readLine", 1, R"(
+    int32_t length = 0;
+    int16_t key;
+    jack_put_chars(jack_text, jack_read_string(a0));
+    while((key = jack_next_key()) != 128) {
+        if(key == 0 && jack_next_key_index == jack_key_count)
+            break;
+        if(key != 0 && length < JACK_RAM_SIZE)
+            jack_text[length++] = (char)key;
+    }
+    jack_put_chars(jack_text, length);
+    jack_put('\n');
+    return jack_new_string(length);
+)"},
+    {"Keyboard.readInt", 1, R"(
+    int16_t value;
+    jack_put_chars(jack_text, jack_read_string(a0));
+    if(jack_next_input == jack_input_count)
+        jack_fail("Keyboard input exhausted");
+    value = jack_inputs[jack_next_input++];
+    jack_put_int(value);
+    jack_put('\n');
+    return value;
+)"},
+    {"Sys.halt", 0, R"(
+    jack_exit(0);
+    return 0;
+)"},
+    {"Sys.error", 1, R"(
+    jack_error(a0);
+    return 0;
+)"},
+    {"Sys.wait", 1, R"(
+    (void)a0;
+    return 0;
+)"}
+};
+
+void c_generator::add(const ast_class *ast) {
+    _classes.push_back(ast);
+}
+
+void c_generator::run(const std::string& program_name) {
+    _c_code.clear();
+    _functions.clear();
+    _uses_strings = false;
+
+    for(auto ast : _classes) {
+        for(const auto& subroutine : ast->subroutines) {
+            function fn;
+            fn.c_name = _mangle(ast->identifier, subroutine.identifier);
+            fn.arg_count = subroutine.parameters.size() + (subroutine.type == ast_class_subroutine::type_t::METHOD ? 1 : 0);
+            if(!_functions.emplace(ast->identifier + "." + subroutine.identifier, fn).second)
+                throw std::runtime_error(fmt::format("Duplicate function {}.{}", ast->identifier, subroutine.identifier));
+        }
+    }
+
+    // Without the OS in the sources there is no Sys.init, so start the program directly
+    std::string entry = _is_defined("Sys.init") ? "Sys.init" : "Main.main";
+    if(!_is_defined(entry))
+        throw std::runtime_error("Entry point " + entry + " not found");
+
+    // Generated first, the stubs and helpers to emit are known after
+    std::string definitions;
+    for(auto ast : _classes) {
+        _class = ast;
+        for(const auto& subroutine : ast->subroutines) {
+            _generate_subroutine(subroutine);
+            definitions += _body;
+        }
+    }
+
+    _c_code = fmt::format("/* {}, generated by the Jack compiler. Build with any C99 compiler, for example\n"
+                          "   cc -O2 -o {} {}.c, and run with the --keys and --input options of vmemu */\n",
+                          program_name, program_name, program_name);
+    _c_code += RUNTIME;
+
+    _c_code += '\n';
+    for(auto ast : _classes) {
+        for(const auto& subroutine : ast->subroutines) {
+            const auto& fn = _functions[ast->identifier + "." + subroutine.identifier];
+            fmt::format_to(std::back_inserter(_c_code), "JACK_STATIC int16_t {}({});\n", fn.c_name, _parameters(fn.arg_count));
+        }
+    }
+
+    for(auto ast : _classes) {
+        auto count = resolver::count_statics(*ast);
+        if(count > 0)
+            fmt::format_to(std::back_inserter(_c_code), "static int16_t {}[{}];\n", _statics(ast->identifier), count);
+    }
+
+    for(const auto& native : NATIVES) {
+        auto check = _functions.find(native.name);
+        if(check == _functions.end() || check->second.native < 0 || !check->second.used)
+            continue;
+
+        fmt::format_to(std::back_inserter(_c_code), "\nstatic int16_t {}({}) {{{}}}\n",
+                       check->second.c_name, _parameters(native.arg_count), native.body);
+    }
+
+    if(_uses_strings) {
+        fmt::format_to(std::back_inserter(_c_code),
+                       "\n/* A string constant, built through String.new and String.appendChar like the VM code does */\n"
+                       "static int16_t jack_string(int16_t length, const int16_t* chars) {{\n"
+                       "    int16_t str = {}(length);\n"
+                       "    int16_t i;\n"
+                       "    for(i = 0; i < length; i++)\n"
+                       "        str = {}(str, chars[i]);\n"
+                       "    return str;\n"
+                       "}}\n", _functions["String.new"].c_name, _functions["String.appendChar"].c_name);
+    }
+
+    _c_code += definitions;
+
+    const auto& entry_fn = _functions[entry];
+    std::string arguments;
+    for(uint16_t i = 0; i < entry_fn.arg_count; i++)
+        arguments += i == 0 ? "0" : ", 0";
+
+    fmt::format_to(std::back_inserter(_c_code),
+                   "\nint main(int argc, char** argv) {{\n"
+                   "    if(!jack_parse_options(argc, argv))\n"
+                   "        return 1;\n"
+                   "    {}({});\n"
+                   "    jack_exit(0);\n"
+                   "}}\n", entry_fn.c_name, arguments);
+}
+
+void c_generator::_generate_subroutine(const ast_class_subroutine &subroutine) {
+    _subroutine = &subroutine;
+    _body.clear();
+    _indent = 0;
+    _next_temp = 0;
+
+    const auto& fn = _functions[_class->identifier + "." + subroutine.identifier];
+    _line("");
+    _line(fmt::format("static int16_t {}({}) {{", fn.c_name, _parameters(fn.arg_count)));
+    _indent++;
+
+    if(subroutine.local_count > 0) {
+        std::string locals;
+        for(uint16_t i = 0; i < subroutine.local_count; i++)
+            fmt::format_to(std::back_inserter(locals), "{}l{} = 0", i == 0 ? "" : ", ", i);
+        _line("int16_t " + locals + ";");
+    }
+
+    if(subroutine.type == ast_class_subroutine::type_t::CONSTRUCTOR)
+        _line(fmt::format("int16_t self = {}({});", _get_function("Memory.alloc", 1).c_name, _class->field_count));
+
+    _generate_statements(subroutine.statements);
+    // Every path of a Jack subroutine ends in a return, C compilers cannot always tell
+    if(subroutine.statements.empty() || subroutine.statements.back()->type != ast_statement::type_t::RETURN)
+        _line("return 0;");
+
+    _indent--;
+    _line("}");
+}
+
+void c_generator::_generate_statements(const std::list<ast_statement *> &statements) {
+    for(auto statement : statements) {
+        switch(statement->type) {
+            case ast_statement::type_t::LET:
+                _generate_let_statement((const ast_statement_let*)statement);
+                break;
+            case ast_statement::type_t::IF:
+                _generate_if_statement((const ast_statement_if*)statement);
+                break;
+            case ast_statement::type_t::WHILE:
+                _generate_while_statement((const ast_statement_while*)statement);
+                break;
+            case ast_statement::type_t::DO:
+                _line(_generate_subroutine_call(((const ast_statement_do*)statement)->call).code + ";");
+                break;
+            case ast_statement::type_t::RETURN:
+                _line("return " + _generate_expression(((const ast_statement_return*)statement)->value).code + ";");
+                break;
+        }
+    }
+}
+
+void c_generator::_generate_let_statement(const ast_statement_let *let_statement) {
+    if(let_statement->array_access.has_value()) {
+        // The address is worked out before the value, the element is only checked when stored
+        auto address = _read_variable(let_statement->slot);
+        _held.push_back(&address);
+        auto index = _generate_expression(let_statement->array_access.value());
+        address = {fmt::format("jack_add({}, {})", address.code, index.code), address.calls || index.calls, address.reads || index.reads};
+
+        auto assigned = _generate_expression(let_statement->assignment);
+        _held.pop_back();
+        if(assigned.calls)
+            _spill(assigned);
+
+        _line(fmt::format("*jack_at({}) = {};", address.code, assigned.code));
+        return;
+    }
+
+    auto assigned = _generate_expression(let_statement->assignment);
+    if(let_statement->slot.segment == symbol::segment_t::THIS && assigned.calls)
+        _spill(assigned);
+
+    _line(fmt::format("{} = {};", _variable(let_statement->slot), assigned.code));
+}
+
+void c_generator::_generate_if_statement(const ast_statement_if *if_statement) {
+    auto condition = _generate_expression(if_statement->conditional);
+    _line(fmt::format("if({}) {{", condition.code));
+    _indent++;
+    _generate_statements(if_statement->true_statements);
+    _indent--;
+
+    if(!if_statement->false_statements.empty()) {
+        _line("} else {");
+        _indent++;
+        _generate_statements(if_statement->false_statements);
+        _indent--;
+    }
+    _line("}");
+}
+
+// As in the VM code, a loop only continues while its condition is -1
+void c_generator::_generate_while_statement(const ast_statement_while *while_statement) {
+    auto start = _body.size();
+    _indent++;
+    auto condition = _generate_expression(while_statement->conditional);
+
+    // A condition that needed temporaries is evaluated at the top of the loop body
+    if(_body.size() == start) {
+        _indent--;
+        _line(fmt::format("while(({}) == -1) {{", condition.code));
+        _indent++;
+    } else {
+        _body.insert(start, std::string((_indent - 1) * 4, ' ') + "for(;;) {\n");
+        _line(fmt::format("if(({}) != -1)", condition.code));
+        _line("    break;");
+    }
+
+    _generate_statements(while_statement->statements);
+    _indent--;
+    _line("}");
+}
+
+c_generator::value c_generator::_generate_expression(const ast_expression &expression) {
+    auto result = _generate_term(expression.primary);
+    _held.push_back(&result);
+    for(const auto& [op, term] : expression.secondaries) {
+        auto operand = _generate_term(term);
+        result = _generate_binary_op(op, result, operand);
+    }
+    _held.pop_back();
+    return result;
+}
+
+c_generator::value c_generator::_generate_term(const ast_term *term) {
+    switch(term->type) {
+        case ast_term::type_t::INTEGER:
+            return {std::to_string(((const ast_term_integer*)term)->value)};
+        case ast_term::type_t::STRING:
+            return _generate_string(((const ast_term_string*)term)->value);
+        case ast_term::type_t::NUL:
+        case ast_term::type_t::FALSE:
+            return {"0"};
+        case ast_term::type_t::TRUE:
+            return {"-1"};
+        case ast_term::type_t::THIS:
+            return {_this()};
+        case ast_term::type_t::VARIABLE:
+            return _read_variable(((const ast_term_variable*)term)->slot);
+        case ast_term::type_t::ARRAY: {
+            auto array_term = (const ast_term_array*)term;
+            auto base = _read_variable(array_term->slot);
+            _held.push_back(&base);
+            auto index = _generate_expression(array_term->access);
+            _held.pop_back();
+
+            _sequence(false);
+            return {fmt::format("*jack_at(jack_add({}, {}))", base.code, index.code), base.calls || index.calls, true};
+        }
+        case ast_term::type_t::EXPRESSION:
+            return _generate_expression(((const ast_term_expression*)term)->expression);
+        case ast_term::type_t::UNARY: {
+            auto unary_term = (const ast_term_unary*)term;
+            auto operand = _generate_term(unary_term->term);
+            operand.code = fmt::format("{}({})", unary_term->op == ast_unary_op::NEGATE ? "jack_neg" : "jack_not", operand.code);
+            return operand;
+        }
+        case ast_term::type_t::SUBROUTINE_CALL:
+            return _generate_subroutine_call(((const ast_term_subroutine_call*)term)->call);
+    }
+
+    throw std::runtime_error("Unknown term type");
+}
+
+c_generator::value c_generator::_generate_subroutine_call(const ast_subroutine_call &call) {
+    _sequence(true);
+
+    // The receiver is read before the arguments are evaluated
+    std::vector<value> arguments;
+    arguments.reserve(call.arguments.size() + 1);
+    if(call.receiver == ast_subroutine_call::receiver_t::VARIABLE) {
+        arguments.push_back(_read_variable(call.receiver_slot));
+        _held.push_back(&arguments.back());
+    } else if(call.receiver == ast_subroutine_call::receiver_t::THIS) {
+        arguments.push_back({_this()});
+        _held.push_back(&arguments.back());
+    }
+
+    for(const auto& argument : call.arguments) {
+        arguments.push_back(_generate_expression(argument));
+        _held.push_back(&arguments.back());
+    }
+    _held.resize(_held.size() - arguments.size());
+
+    return _generate_call(call.callee_class + "." + call.subroutine_identifier, arguments);
+}
+
+c_generator::value c_generator::_generate_call(const std::string &name, std::vector<value> &arguments) {
+    value result;
+    result.code = _get_function(name, arguments.size()).c_name + "(";
+    for(size_t i = 0; i < arguments.size(); i++) {
+        if(i > 0)
+            result.code += ", ";
+        result.code += arguments[i].code;
+    }
+    result.code += ")";
+    result.calls = true;
+    result.reads = true;
+    return result;
+}
+
+c_generator::value c_generator::_generate_binary_op(ast_binary_op op, value &left, value &right) {
+    const char* helper = nullptr;
+    switch(op) {
+        case ast_binary_op::ADD:
+            helper = "jack_add";
+            break;
+        case ast_binary_op::SUBTRACT:
+            helper = "jack_sub";
+            break;
+        case ast_binary_op::MULTIPLY:
+        case ast_binary_op::DIVIDE: {
+            // A Math class of the program's own replaces the arithmetic, as in the VM code
+            auto name = op == ast_binary_op::MULTIPLY ? "Math.multiply" : "Math.divide";
+            if(_is_defined(name)) {
+                _sequence(true);
+                std::vector<value> arguments = {left, right};
+                return _generate_call(name, arguments);
+            }
+
+            if(op == ast_binary_op::MULTIPLY) {
+                helper = "jack_mul";
+                break;
+            }
+
+            // Fails on a zero divisor, so it is ordered like a memory read
+            _sequence(false);
+            return {fmt::format("jack_div({}, {})", left.code, right.code), left.calls || right.calls, true};
+        }
+        case ast_binary_op::AND:
+            helper = "jack_and";
+            break;
+        case ast_binary_op::OR:
+            helper = "jack_or";
+            break;
+        case ast_binary_op::GREATER:
+            helper = "jack_gt";
+            break;
+        case ast_binary_op::LESSER:
+            helper = "jack_lt";
+            break;
+        case ast_binary_op::EQUAL:
+            helper = "jack_eq";
+            break;
+    }
+
+    return {fmt::format("{}({}, {})", helper, left.code, right.code), left.calls || right.calls, left.reads || right.reads};
+}
+
+c_generator::value c_generator::_generate_string(const std::string &str) {
+    _sequence(true);
+    _get_function("String.new", 1);
+    _get_function("String.appendChar", 2);
+    _uses_strings = true;
+
+    if(str.empty())
+        return {"jack_string(0, NULL)", true, true};
+
+    std::string chars;
+    for(const auto& ch : str)
+        fmt::format_to(std::back_inserter(chars), "{}{}", chars.empty() ? "" : ", ", (int16_t)(uint16_t)ch);
+    return {fmt::format("jack_string({}, (const int16_t[]){{{}}})", str.length(), chars), true, true};
+}
+
+c_generator::value c_generator::_read_variable(const ast_slot &slot) {
+    bool reads = slot.segment == symbol::segment_t::STATIC || slot.segment == symbol::segment_t::THIS;
+    if(reads)
+        _sequence(false);
+    return {_variable(slot), false, reads};
+}
+
+std::string c_generator::_variable(const ast_slot &slot) {
+    switch(slot.segment) {
+        case symbol::segment_t::LOCAL:
+            return fmt::format("l{}", slot.index);
+        case symbol::segment_t::ARGUMENT:
+            return fmt::format("a{}", slot.index);
+        case symbol::segment_t::STATIC:
+            return fmt::format("{}[{}]", _statics(_class->identifier), slot.index);
+        case symbol::segment_t::THIS:
+            return fmt::format("*jack_field({}, {})", _this(), slot.index);
+    }
+
+    throw std::runtime_error("Unknown segment");
+}
+
+std::string c_generator::_this() {
+    // Argument 0 of a method is never assigned, Jack has no name for it
+    switch(_subroutine->type) {
+        case ast_class_subroutine::type_t::METHOD:
+            return "a0";
+        case ast_class_subroutine::type_t::CONSTRUCTOR:
+            return "self";
+        case ast_class_subroutine::type_t::FUNCTION:
+            break;
+    }
+
+    throw std::runtime_error(fmt::format("{}.{}: functions have no this, or fields", _class->identifier, _subroutine->identifier));
+}
+
+c_generator::function& c_generator::_get_function(const std::string &name, size_t arg_count) {
+    auto check = _functions.find(name);
+    if(check == _functions.end()) {
+        for(const auto& native : NATIVES) {
+            if(name != native.name)
+                continue;
+
+            function fn;
+            auto dot = name.find('.');
+            fn.c_name = _mangle(name.substr(0, dot), name.substr(dot + 1));
+            fn.arg_count = native.arg_count;
+            fn.native = (int32_t)(&native - NATIVES);
+            check = _functions.emplace(name, fn).first;
+            break;
+        }
+    }
+
+    if(check == _functions.end())
+        throw std::runtime_error(fmt::format("{}.{}: undefined function {}", _class->identifier, _subroutine->identifier, name));
+    if(check->second.arg_count != arg_count)
+        throw std::runtime_error(fmt::format("{}.{}: {} called with {} arguments, takes {}",
+                                             _class->identifier, _subroutine->identifier, name, arg_count, check->second.arg_count));
+
+    check->second.used = true;
+    return check->second;
+}
+
+bool c_generator::_is_defined(const std::string &name) const {
+    auto check = _functions.find(name);
+    return check != _functions.end() && check->second.native < 0;
+}
+
+void c_generator::_sequence(bool call) {
+    // Older held operands were already sequenced against any call they hold
+    for(value* held : _held) {
+        if(held->calls || (call && held->reads))
+            _spill(*held);
+    }
+}
+
+void c_generator::_spill(value &value) {
+    auto name = fmt::format("t{}", _next_temp++);
+    _line(fmt::format("int16_t {} = {};", name, value.code));
+    value = {name};
+}
+
+void c_generator::_line(const std::string &line) {
+    if(!line.empty())
+        _body.append(_indent * 4, ' ').append(line);
+    _body += '\n';
+}
+
+// '_' becomes "_u" and "__" separates the class, so distinct functions never collide with each
+// other or with the runtime's jack_ names
+std::string c_generator::_mangle(const std::string &class_name, const std::string &subroutine) {
+    return _escape(class_name) + "__" + _escape(subroutine);
+}
+
+std::string c_generator::_statics(const std::string &class_name) {
+    return "jack_statics_" + _escape(class_name);
+}
+
+std::string c_generator::_escape(const std::string &identifier) {
+    std::string escaped;
+    for(char c : identifier) {
+        escaped += c;
+        if(c == '_')
+            escaped += 'u';
+    }
+    return escaped;
+}
+
+std::string c_generator::_parameters(size_t count) {
+    if(count == 0)
+        return "void";
+
+    std::string parameters;
+    for(size_t i = 0; i < count; i++)
+        fmt::format_to(std::back_inserter(parameters), "{}int16_t a{}", i == 0 ? "" : ", ", i);
+    return parameters;
+}
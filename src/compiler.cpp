@@ -5,9 +5,16 @@
     #include <tinyxml2.h>
 #endif
 
+#include <fmt/format.h>
+
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <future>
 #include <list>
+#include <set>
+#include <sstream>
+#include <unordered_map>
 
 void compiler::run(std::filesystem::path source_path) {
     if(!std::filesystem::exists(source_path))
@@ -15,43 +22,660 @@ void compiler::run(std::filesystem::path source_path) {
 
     source_path = std::filesystem::canonical(source_path);
 
+    _phase_stats.clear();
+    _tracer = _trace_path.has_value() ? std::make_unique<tracer>() : nullptr;
+    _begin_phase();
+    // The compiler object is reused, a previous run that threw must not leave its contexts behind
+    context_scope contexts(_contexts);
+
     std::list<std::filesystem::path> source_files;
     _scan_source_path(source_path, source_files);
+    // Outputs follow source order, which must not depend on the directory listing
+    source_files.sort();
 
     for(const auto& file : source_files) {
         auto ctx = new context();
 
         auto output_file = file;
-        output_file.replace_extension(OUTPUT_FILE_EXTENSION);
+        output_file.replace_extension(_output_format == output_format_t::BINARY ? BINARY_OUTPUT_FILE_EXTENSION : OUTPUT_FILE_EXTENSION);
         output_file = output_file.filename();
 
         ctx->source_path = file;
         ctx->output_path = source_path / output_file;
+        ctx->summary_path = ctx->output_path;
+        ctx->summary_path.replace_extension(SUMMARY_FILE_EXTENSION);
+        ctx->output_format = _output_format;
+        ctx->source_map = _write_source_maps;
+        ctx->generator.set_cost_model(_costs);
+        ctx->generator.set_source_map(_write_source_maps);
+        ctx->trace = _tracer.get();
+        ctx->lexer.set_max_nesting(_max_nesting);
 
         _contexts.push_back(ctx);
     }
 
-    generator::reset();
+    bool linked = _output_format == output_format_t::ASM || _output_format == output_format_t::C;
+    if(_write_source_maps && linked)
+        throw error("Source maps are only written for .vm and .vmb output");
+    if(_instrumentation.enabled && _output_format == output_format_t::C)
+        throw error("Instrumentation needs VM output, the Profile class is only generated as VM code");
+
+    if(_streaming) {
+        if(_output_format != output_format_t::VM || _incremental || _instrumentation.enabled)
+            throw error("Streaming only supports non-incremental, uninstrumented .vm output");
+
+        _run_streaming(source_path);
+        _end_phase("stream");
+
+        // Spans point at the contexts' source paths
+        std::string trace = _tracer != nullptr ? _tracer->to_json() : std::string();
+        contexts.free();
+        _write_trace(trace);
+        return;
+    }
+
+    // A linked .asm or .c always needs every class. So does the Profile class of an instrumented
+    // program, which then still writes summaries, recording the instrumentation in their hash
+    bool incremental = _incremental && !linked;
+    if(incremental && !_instrumentation.enabled)
+        _load_summaries();
+
+    _read_and_parse(source_path, incremental);
+    _count_statics(source_path);
+    if(_instrumentation.enabled)
+        _plan_instrumentation();
+    _end_phase("parse");
+
+    if(incremental) {
+        _plan_incremental(source_path);
+        _end_phase("plan");
+    }
+
+    // Whole-program passes need every class parsed before any code is generated
+    std::vector<ast_class*> classes;
+    std::vector<context*> generated;
+    classes.reserve(_contexts.size());
+    for(context* ctx : _contexts) {
+        if(ctx->parsed)
+            classes.push_back(ctx->lexer.get_class());
+        if(ctx->generate)
+            generated.push_back(ctx);
+    }
+
+    // _run_parallel throws when a class fails
+    pipeline::run(classes, _inline_budget, [&](pipeline::phase_t phase) {
+        if(phase == pipeline::phase_t::RESOLVE) {
+            _end_phase("inline");
+            _run_parallel(&compiler::_resolve, generated, source_path);
+            _end_phase("resolve");
+        } else {
+            _run_parallel(&compiler::_generate, generated, source_path);
+        }
+        return true;
+    });
+    if(_instrumentation.enabled)
+        _generate_profile();
+    _end_phase("generate");
+
+    if(_output_format == output_format_t::ASM) {
+        _link_asm(source_path);
+        _end_phase("link");
+    } else if(_output_format == output_format_t::C) {
+        _link_c(source_path);
+        _end_phase("link");
+    } else {
+        _write_outputs(generated, source_path, incremental);
+        _end_phase("write");
+    }
+
+    std::string trace = _tracer != nullptr ? _tracer->to_json() : std::string();
+    contexts.free();
+    _write_trace(trace);
+}
 
+void compiler::_run_parallel(void (*task)(context*), const std::vector<context*>& contexts, const std::filesystem::path& source_path) {
     std::vector<std::future<void>> futures;
-    futures.clear();
-    futures.reserve(source_files.size());
-    for(context* ctx : _contexts)
-        futures.push_back(std::async(std::launch::async, &compiler::_compile, ctx));
+    futures.reserve(contexts.size());
+    for(context* ctx : contexts)
+        futures.push_back(std::async(std::launch::async, task, ctx));
+
+    _collect_errors(futures, contexts, source_path);
+}
 
+void compiler::_collect_errors(std::vector<std::future<void>>& futures, const std::vector<context*>& contexts, const std::filesystem::path& source_path) {
     std::list<std::string> errors;
     for(unsigned int i = 0; i < futures.size(); i++) {
+        // Tasks that were never started have nothing to report
+        if(!futures[i].valid())
+            continue;
+
         try {
             futures[i].get();
-            delete _contexts[i];
         } catch(const std::runtime_error& e) {
-            auto file_name = std::filesystem::relative(_contexts[i]->source_path, source_path);
+            auto file_name = std::filesystem::relative(contexts[i]->source_path, source_path);
+            errors.emplace_back(std::string("[") + file_name.generic_string() + "]: " + e.what());
+        }
+    }
+
+    if(!errors.empty())
+        throw error(errors);
+}
+
+void compiler::_run_streaming(const std::filesystem::path &source_path) {
+    std::list<std::string> errors;
+    uint64_t program_statics = 0;
+
+    // Sequential in source order, only a single class is held in memory at a time
+    for(context* ctx : _contexts) {
+        std::string read_error;
+        {
+            tracer::span span(ctx->trace, "read", &ctx->source_path);
+            file_io::read_all({ctx->source_path}, [ctx, &read_error](size_t, file_io::read_result result) {
+                ctx->source_code = std::move(result.contents);
+                read_error = std::move(result.error);
+            });
+        }
+        // Parsing, generating and writing are interleaved subroutine by subroutine
+        tracer::span span(ctx->trace, "compile", &ctx->source_path);
+
+        try {
+            if(!read_error.empty())
+                throw std::runtime_error(read_error);
+
+            file_io::stream_writer out(ctx->output_path);
+            std::optional<file_io::stream_writer> map_out;
+            std::optional<source_map> map;
+            if(ctx->source_map) {
+                map_out.emplace(ctx->output_path.string() + SOURCE_MAP_EXTENSION);
+                map.emplace(ctx->source_path.filename().string(), ctx->source_code);
+            }
+
+            bool declared = false;
+            auto declare = [ctx, &declared](ast_class& cl) {
+                ctx->resolver.declare_class(&cl);
+                declared = true;
+            };
+
+            ctx->tokenizer.run(ctx->source_code);
+            ctx->lexer.run(ctx->tokenizer, [ctx, &out, &map_out, &map, &declared, &declare](ast_class& cl, ast_class_subroutine& subroutine) {
+                if(!declared)
+                    declare(cl);
+
+                pruner().run(subroutine);
+                ctx->resolver.resolve_subroutine(subroutine);
+                ctx->generator.run_subroutine(&cl, subroutine);
+                out.write(ctx->generator.get_vm_code());
+                if(map.has_value()) {
+                    map->add(ctx->generator.get_vm_code(), ctx->generator.get_source_segments());
+                    map_out->write(map->get_text());
+                    map->clear_text();
+                }
+                ctx->generator.clear_vm_code();
+            });
+
+            ast_class* cl = ctx->lexer.get_class();
+            if(!declared)
+                declare(*cl);
+            ctx->class_name = cl->identifier;
+            // Only classes adding statics are to blame once the program is over the limit
+            auto statics = resolver::count_statics(*cl);
+            program_statics += statics;
+            if(statics > 0)
+                resolver::check_program_statics(program_statics);
+
+            auto write_error = out.commit();
+            if(write_error.empty() && map_out.has_value()) {
+                // A class without subroutines still gets the header
+                map_out->write(map->get_text());
+                write_error = map_out->commit();
+            }
+            if(!write_error.empty())
+                throw std::runtime_error(write_error);
+        } catch(const std::runtime_error& e) {
+            auto file_name = std::filesystem::relative(ctx->source_path, source_path);
             errors.emplace_back(std::string("[") + file_name.generic_string() + "]: " + e.what());
         }
+
+        std::string().swap(ctx->source_code);
     }
 
     if(!errors.empty())
         throw error(errors);
+
+    if(!_write_depfiles)
+        return;
+
+    std::vector<file_io::write_request> requests;
+    _add_depfiles(_contexts, requests);
+    auto write_errors = file_io::write_all(requests);
+    if(!write_errors.empty())
+        throw error(write_errors);
+}
+
+void compiler::_read_and_parse(const std::filesystem::path &source_path, bool incremental) {
+    std::vector<std::filesystem::path> paths;
+    paths.reserve(_contexts.size());
+    for(context* ctx : _contexts)
+        paths.push_back(ctx->source_path);
+
+    auto options_hash = _options_hash();
+
+    // Parsing a file starts as soon as its bytes arrive instead of after every read completed.
+    // A file's read span runs from the submission of the batch to the arrival of its bytes
+    std::vector<std::future<void>> futures(_contexts.size());
+    auto read_start = tracer::clock::now();
+    file_io::read_all(paths, [this, &futures, incremental, options_hash, read_start](size_t index, file_io::read_result result) {
+        context* ctx = _contexts[index];
+        if(ctx->trace != nullptr)
+            ctx->trace->record("read", &ctx->source_path, read_start, tracer::clock::now());
+        ctx->source_code = std::move(result.contents);
+
+        if(incremental && result.error.empty()) {
+            ctx->source_hash = class_summary::hash(ctx->source_code, options_hash);
+            if(ctx->summary.has_value() && ctx->summary->source_hash == ctx->source_hash)
+                return;
+        }
+
+        futures[index] = std::async(std::launch::async, [ctx, error = std::move(result.error)] {
+            if(!error.empty())
+                throw std::runtime_error(error);
+
+            _parse(ctx);
+        });
+    });
+
+    _collect_errors(futures, _contexts, source_path);
+}
+
+void compiler::_load_summaries() {
+    std::vector<std::filesystem::path> paths;
+    paths.reserve(_contexts.size());
+    for(context* ctx : _contexts)
+        paths.push_back(ctx->summary_path);
+
+    // A missing or unreadable summary only means the class is compiled again
+    file_io::read_all(paths, [this](size_t index, file_io::read_result result) {
+        context* ctx = _contexts[index];
+        if(result.error.empty() && std::filesystem::exists(ctx->output_path))
+            ctx->summary = class_summary::parse(result.contents);
+    });
+}
+
+void compiler::_count_statics(const std::filesystem::path& source_path) {
+    uint64_t program_statics = 0;
+    for(context* ctx : _contexts) {
+        if(ctx->parsed) {
+            ctx->class_name = ctx->lexer.get_class()->identifier;
+            ctx->static_count = resolver::count_statics(*ctx->lexer.get_class());
+        } else {
+            ctx->class_name = ctx->summary->class_name;
+            ctx->static_count = ctx->summary->static_count;
+        }
+
+        program_statics += ctx->static_count;
+        try {
+            resolver::check_program_statics(program_statics);
+        } catch(const std::runtime_error& e) {
+            auto file_name = std::filesystem::relative(ctx->source_path, source_path);
+            throw error(std::list<std::string>{std::string("[") + file_name.generic_string() + "]: " + e.what()});
+        }
+    }
+}
+
+void compiler::_plan_instrumentation() {
+    // Profile.dump prints through the OS, counting inside it would recurse
+    static const std::set<std::string> os_classes = {"Array", "Keyboard", "Math", "Memory", "Output", "Screen", "String", "Sys"};
+
+    // Profile holds its table of counter arrays in a static of its own
+    uint64_t program_statics = 1;
+    for(context* ctx : _contexts)
+        program_statics += ctx->static_count;
+
+    for(size_t class_id = 0; class_id < _contexts.size(); class_id++) {
+        context* ctx = _contexts[class_id];
+        if(ctx->class_name == generator::PROFILE_CLASS)
+            throw error(fmt::format("Class {} is reserved for instrumentation", generator::PROFILE_CLASS));
+        if(os_classes.count(ctx->class_name) > 0)
+            continue;
+
+        // The counter array takes the static after the class's own
+        auto instrumentation = _instrumentation;
+        instrumentation.class_id = class_id;
+        instrumentation.counters_static = ctx->static_count;
+        program_statics++;
+        if(program_statics > resolver::MAX_STATIC_COUNT)
+            throw error(fmt::format("Too many static variables in the program to instrument {} (limit {})", ctx->class_name, resolver::MAX_STATIC_COUNT));
+
+        ctx->generator.set_instrumentation(instrumentation);
+    }
+}
+
+void compiler::_generate_profile() {
+    std::vector<std::vector<std::string>> class_sites;
+    class_sites.reserve(_contexts.size());
+    for(context* ctx : _contexts)
+        class_sites.push_back(ctx->generator.get_profile_sites());
+
+    generator profile;
+    profile.run_profile(class_sites);
+    _profile_code = profile.get_vm_code();
+
+    if(_output_format == output_format_t::BINARY) {
+        std::ostringstream out(std::ios::binary);
+        bytecode::write(bytecode::encode(vm_instruction::parse_all(_profile_code)), out);
+        _profile_binary = out.str();
+    }
+}
+
+void compiler::_plan_incremental(const std::filesystem::path &source_path) {
+    std::vector<context*> changed;
+    for(context* ctx : _contexts) {
+        ctx->changed = ctx->parsed;
+        ctx->generate = ctx->changed;
+        if(ctx->changed)
+            changed.push_back(ctx);
+    }
+
+    if(changed.size() == _contexts.size())
+        return;
+
+    // References of the changed classes, resolved again after inlining
+    _run_parallel(&compiler::_resolve, changed, source_path);
+
+    std::unordered_map<std::string, context*> classes;
+    for(context* ctx : _contexts)
+        classes[ctx->class_name] = ctx;
+
+    auto for_each_use = [&classes](context* ctx, const std::function<void(context*)>& visit) {
+        if(ctx->changed) {
+            for(const auto& referenced : ctx->resolver.get_referenced_classes()) {
+                auto use = classes.find(referenced);
+                if(use != classes.end())
+                    visit(use->second);
+            }
+        } else {
+            for(const auto& referenced : ctx->summary->uses) {
+                auto use = classes.find(referenced.class_name);
+                if(use != classes.end())
+                    visit(use->second);
+            }
+        }
+    };
+
+    // An unchanged class is stale when a class it uses was changed, added or removed, and so is every
+    // class using a stale one (inlined bodies and field indices cross classes). Statics are numbered
+    // per class, other classes never affect them.
+    std::unordered_map<context*, std::vector<context*>> users;
+    std::deque<context*> stale;
+    for(context* ctx : _contexts) {
+        if(ctx->changed) {
+            stale.push_back(ctx);
+            continue;
+        }
+
+        bool is_stale = false;
+        for(const auto& use : ctx->summary->uses) {
+            auto current = classes.find(use.class_name);
+            auto current_hash = current == classes.end() ? std::nullopt : std::optional(current->second->source_hash);
+            is_stale = is_stale || current_hash != use.source_hash;
+        }
+        for_each_use(ctx, [&users, ctx](context* use) { users[use].push_back(ctx); });
+
+        if(is_stale) {
+            ctx->generate = true;
+            stale.push_back(ctx);
+        }
+    }
+
+    while(!stale.empty()) {
+        auto ctx = stale.front();
+        stale.pop_front();
+        for(context* user : users[ctx]) {
+            if(!user->generate) {
+                user->generate = true;
+                stale.push_back(user);
+            }
+        }
+    }
+
+    // The inliner needs the bodies of everything a regenerated class reaches
+    std::deque<context*> reachable;
+    for(context* ctx : _contexts) {
+        if(ctx->generate)
+            reachable.push_back(ctx);
+    }
+
+    while(!reachable.empty()) {
+        auto ctx = reachable.front();
+        reachable.pop_front();
+        for_each_use(ctx, [&reachable](context* use) {
+            if(!use->parsed && !use->needed) {
+                use->needed = true;
+                reachable.push_back(use);
+            }
+        });
+    }
+
+    // Regenerated classes are parsed in full, the ones only needed for what the inliner may copy out
+    // of them are skimmed
+    std::vector<context*> parse;
+    for(context* ctx : _contexts) {
+        if(ctx->parsed || (!ctx->generate && !ctx->needed))
+            continue;
+        if(!ctx->generate)
+            ctx->lexer.set_skim(true);
+        parse.push_back(ctx);
+    }
+    _run_parallel(&compiler::_parse, parse, source_path);
+
+    std::vector<context*> stale_parsed;
+    for(context* ctx : parse) {
+        if(ctx->generate)
+            stale_parsed.push_back(ctx);
+    }
+    _run_parallel(&compiler::_resolve, stale_parsed, source_path);
+
+    class_summary::call_set calls;
+    for(context* ctx : _contexts) {
+        if(!ctx->generate)
+            continue;
+        for(const auto& subroutine : ctx->lexer.get_class()->subroutines)
+            class_summary::collect_calls(subroutine.statements, calls);
+    }
+    _parse_called_bodies(std::move(calls), classes, source_path);
+}
+
+/*
+ * Parses the skimmed bodies of the called subroutines, then of those they call, and so on. Inlining
+ * into a callee happens before the callee is inlined itself, so a regenerated class depends on
+ * every body it reaches through calls, not only on those it calls directly.
+ */
+void compiler::_parse_called_bodies(class_summary::call_set calls, const std::unordered_map<std::string, context*>& classes, const std::filesystem::path& source_path) {
+    while(!calls.empty()) {
+        std::vector<context*> pending;
+        for(const auto& call : calls) {
+            auto dot = call.first.find('.');
+            auto callee = classes.find(call.first.substr(0, dot));
+            if(callee == classes.end() || !callee->second->parsed)
+                continue;
+
+            context* ctx = callee->second;
+            for(const auto& subroutine : ctx->lexer.get_class()->subroutines) {
+                if(!subroutine.skimmed || subroutine.identifier != call.first.substr(dot + 1))
+                    continue;
+                if(ctx->requested_bodies.empty())
+                    pending.push_back(ctx);
+                ctx->requested_bodies.insert(subroutine.identifier);
+            }
+        }
+
+        _run_parallel(&compiler::_parse_bodies, pending, source_path);
+
+        calls.clear();
+        for(context* ctx : pending) {
+            for(const auto& subroutine : ctx->lexer.get_class()->subroutines) {
+                if(ctx->requested_bodies.count(subroutine.identifier) > 0)
+                    class_summary::collect_calls(subroutine.statements, calls);
+            }
+            ctx->requested_bodies.clear();
+        }
+    }
+}
+
+uint64_t compiler::_options_hash() const {
+    // Any option that changes the output invalidates every summary
+    auto options = fmt::format("{} {} {} {} {} {} {}", (int)_output_format, _inline_budget, _costs.multiply, _costs.divide,
+                               _instrumentation.enabled, _instrumentation.loops, _write_source_maps);
+    return class_summary::hash(options);
+}
+
+void compiler::_write_outputs(const std::vector<context*>& contexts, const std::filesystem::path &source_path, bool incremental) {
+    if(_output_format == output_format_t::BINARY)
+        _run_parallel(&compiler::_encode, contexts, source_path);
+
+    std::vector<file_io::write_request> requests;
+    requests.reserve(contexts.size() * 3);
+    for(context* ctx : contexts) {
+        const std::string* contents = ctx->output_format == output_format_t::BINARY ? &ctx->binary : &ctx->generator.get_vm_code();
+        requests.push_back({ctx->output_path, contents});
+        if(ctx->source_map)
+            requests.push_back({ctx->output_path.string() + SOURCE_MAP_EXTENSION, &ctx->source_map_text});
+    }
+
+    if(_instrumentation.enabled) {
+        bool binary = _output_format == output_format_t::BINARY;
+        auto profile_path = source_path / (std::string(generator::PROFILE_CLASS) + (binary ? BINARY_OUTPUT_FILE_EXTENSION : OUTPUT_FILE_EXTENSION));
+        requests.push_back({profile_path, binary ? &_profile_binary : &_profile_code});
+    }
+
+    if(_write_depfiles)
+        _add_depfiles(contexts, requests);
+
+    auto errors = file_io::write_all(requests);
+    if(!errors.empty())
+        throw error(errors);
+
+    if(!incremental)
+        return;
+
+    // Summaries go last, a summary must never describe an output that failed to be written
+    requests.clear();
+    std::unordered_map<std::string, const context*> classes;
+    for(context* ctx : _contexts)
+        classes[ctx->class_name] = ctx;
+
+    for(context* ctx : contexts) {
+        auto summary = class_summary::build(*ctx->lexer.get_class(), ctx->source_hash);
+        for(const auto& referenced : ctx->resolver.get_referenced_classes()) {
+            auto use = classes.find(referenced);
+            summary.uses.push_back({referenced, use == classes.end() ? std::nullopt : std::optional(use->second->source_hash)});
+        }
+
+        ctx->summary_text = summary.serialize();
+        requests.push_back({ctx->summary_path, &ctx->summary_text});
+    }
+
+    errors = file_io::write_all(requests);
+    if(!errors.empty())
+        throw error(errors);
+}
+
+void compiler::_add_depfiles(const std::vector<context*>& contexts, std::vector<file_io::write_request>& requests) {
+    std::unordered_map<std::string, const context*> classes;
+    for(context* ctx : _contexts)
+        classes[ctx->class_name] = ctx;
+
+    // Classes without a source (the OS when it is not compiled along) have nothing to depend on
+    for(context* ctx : contexts) {
+        std::list<const std::filesystem::path*> sources = {&ctx->source_path};
+        for(const auto& referenced : ctx->resolver.get_referenced_classes()) {
+            auto use = classes.find(referenced);
+            if(use != classes.end())
+                sources.push_back(&use->second->source_path);
+        }
+
+        ctx->depfile = _make_depfile(ctx->output_path, sources);
+        requests.push_back({ctx->output_path.string() + DEPFILE_EXTENSION, &ctx->depfile});
+    }
+}
+
+void compiler::_link_asm(const std::filesystem::path &source_path) {
+    translator translator;
+    for(context* ctx : _contexts)
+        translator.add(ctx->source_path.stem().string(), ctx->generator.get_vm_code());
+    if(_instrumentation.enabled)
+        translator.add(generator::PROFILE_CLASS, _profile_code);
+
+    try {
+        translator.run();
+    } catch(const std::runtime_error& e) {
+        throw error(e.what());
+    }
+
+    auto program_name = source_path.has_filename() ? source_path.filename() : source_path.parent_path().filename();
+    std::string asm_code;
+    for(const auto& line : translator.get_asm_code()) {
+        asm_code += line;
+        asm_code += '\n';
+    }
+
+    _write_linked(source_path / (program_name.string() + ASM_OUTPUT_FILE_EXTENSION), asm_code);
+}
+
+void compiler::_link_c(const std::filesystem::path &source_path) {
+    c_generator generator;
+    for(context* ctx : _contexts)
+        generator.add(ctx->lexer.get_class());
+
+    auto program_name = source_path.has_filename() ? source_path.filename() : source_path.parent_path().filename();
+    try {
+        generator.run(program_name.string());
+    } catch(const std::runtime_error& e) {
+        throw error(e.what());
+    }
+
+    _write_linked(source_path / (program_name.string() + C_OUTPUT_FILE_EXTENSION), generator.get_c_code());
+}
+
+void compiler::_write_linked(const std::filesystem::path &output_path, const std::string &contents) {
+    std::vector<file_io::write_request> requests = {{output_path, &contents}};
+
+    // The linked program depends on every source
+    std::string depfile;
+    if(_write_depfiles) {
+        std::list<const std::filesystem::path*> sources;
+        for(context* ctx : _contexts)
+            sources.push_back(&ctx->source_path);
+
+        depfile = _make_depfile(output_path, sources);
+        requests.push_back({output_path.string() + DEPFILE_EXTENSION, &depfile});
+    }
+
+    auto errors = file_io::write_all(requests);
+    if(!errors.empty())
+        throw error(errors);
+}
+
+std::string compiler::_make_depfile(const std::filesystem::path& target, const std::list<const std::filesystem::path*>& sources) {
+    // Make syntax, which Ninja also reads: spaces and '#' are escaped with a backslash, '$' is doubled
+    auto escape = [](const std::filesystem::path& path) {
+        std::string escaped;
+        for(char c : path.string()) {
+            if(c == ' ' || c == '#')
+                escaped += '\\';
+            else if(c == '$')
+                escaped += '$';
+            escaped += c;
+        }
+        return escaped;
+    };
+
+    std::string depfile = escape(target) + ":";
+    for(auto source : sources)
+        depfile += " \\\n  " + escape(*source);
+    depfile += '\n';
+
+    return depfile;
 }
 
 void compiler::_scan_source_path(std::filesystem::path &source_path, std::list<std::filesystem::path>& source_files) {
@@ -66,24 +690,80 @@ void compiler::_scan_source_path(std::filesystem::path &source_path, std::list<s
     }
 }
 
-void compiler::_compile(compiler::context *ctx) {
-    std::ifstream source_file_stream(ctx->source_path);
+void compiler::_parse(compiler::context *ctx) {
+    // The pull tokenizer runs inside the parser, tokenizing has no span of its own
+    tracer::span span(ctx->trace, "parse", &ctx->source_path);
+    ctx->tokenizer.run(ctx->source_code);
+    ctx->lexer.run(ctx->tokenizer);
+    ctx->parsed = true;
+}
 
-    if(source_file_stream.fail())
-        throw std::runtime_error("Failed to open file");
+// Resolved right away, the calls they make decide which bodies are parsed next
+void compiler::_parse_bodies(compiler::context *ctx) {
+    tracer::span span(ctx->trace, "parse bodies", &ctx->source_path);
+    ast_class* cl = ctx->lexer.get_class();
+    ctx->resolver.declare_class(cl);
+    for(auto& subroutine : cl->subroutines) {
+        if(ctx->requested_bodies.count(subroutine.identifier) == 0)
+            continue;
 
-    std::string source_code((std::istreambuf_iterator<char>(source_file_stream)),(std::istreambuf_iterator<char>()));
+        ctx->lexer.parse_body(subroutine);
+        ctx->resolver.resolve_subroutine(subroutine);
+    }
+}
 
-    ctx->tokenizer.run(source_code);
-    ctx->lexer.run(ctx->tokenizer);
-    ctx->generator.run(ctx->lexer.get_class());
+void compiler::_resolve(compiler::context *ctx) {
+    tracer::span span(ctx->trace, "resolve", &ctx->source_path);
+    pipeline::resolve(ctx->resolver, ctx->lexer.get_class());
+}
 
-    std::ofstream output_file(ctx->output_path);
+void compiler::_generate(compiler::context *ctx) {
+    tracer::span span(ctx->trace, "generate", &ctx->source_path);
+    // The C backend walks the pruned AST of every class once all are generated
+    bool c = ctx->output_format == output_format_t::C;
+    pipeline::generate(c ? nullptr : &ctx->generator, ctx->lexer.get_class());
+    if(c)
+        return;
 
-    for(const auto& line : ctx->generator.get_vm_code())
-        output_file << line << std::endl;
+    if(ctx->source_map) {
+        source_map map(ctx->source_path.filename().string(), ctx->source_code);
+        map.add(ctx->generator.get_vm_code(), ctx->generator.get_source_segments());
+        ctx->source_map_text = map.get_text();
+    }
+}
+
+void compiler::_encode(compiler::context *ctx) {
+    tracer::span span(ctx->trace, "encode", &ctx->source_path);
+    std::ostringstream out(std::ios::binary);
+    bytecode::write(bytecode::encode(vm_instruction::parse_all(ctx->generator.get_vm_code())), out);
+    ctx->binary = out.str();
+}
 
-    output_file.close();
+void compiler::_begin_phase() {
+    _phase_start = std::chrono::steady_clock::now();
+    _phase_allocations = allocation_counter::count();
 }
 
+void compiler::_end_phase(const char* name) {
+    auto now = std::chrono::steady_clock::now();
+    if(_tracer != nullptr)
+        _tracer->record(name, nullptr, _phase_start, now);
+
+    phase_stats stats;
+    stats.name = name;
+    stats.milliseconds = std::chrono::duration<double, std::milli>(now - _phase_start).count();
+    stats.allocations = allocation_counter::count() - _phase_allocations;
+    _phase_stats.push_back(std::move(stats));
 
+    _begin_phase();
+}
+
+void compiler::_write_trace(const std::string& json) {
+    if(_tracer == nullptr)
+        return;
+    _tracer.reset();
+
+    auto errors = file_io::write_all({{_trace_path.value(), &json}});
+    if(!errors.empty())
+        throw error(errors);
+}
@@ -0,0 +1,593 @@
+#include "emulator.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+static constexpr uint32_t ENTRY_RETURN = UINT32_MAX;
+
+enum struct native_t : int16_t {
+    MATH_INIT, MATH_ABS, MATH_MULTIPLY, MATH_DIVIDE, MATH_MIN, MATH_MAX, MATH_SQRT,
+    MEMORY_INIT, MEMORY_PEEK, MEMORY_POKE, MEMORY_ALLOC, MEMORY_DEALLOC,
+    ARRAY_NEW, ARRAY_DISPOSE,
+    STRING_NEW, STRING_DISPOSE, STRING_LENGTH, STRING_CHAR_AT, STRING_SET_CHAR_AT, STRING_APPEND_CHAR,
+    STRING_ERASE_LAST_CHAR, STRING_INT_VALUE, STRING_SET_INT, STRING_BACK_SPACE, STRING_DOUBLE_QUOTE, STRING_NEW_LINE,
+    OUTPUT_INIT, OUTPUT_MOVE_CURSOR, OUTPUT_PRINT_CHAR, OUTPUT_PRINT_STRING, OUTPUT_PRINT_INT, OUTPUT_PRINTLN, OUTPUT_BACK_SPACE,
+    SCREEN_INIT, SCREEN_CLEAR_SCREEN, SCREEN_SET_COLOR, SCREEN_DRAW_PIXEL, SCREEN_DRAW_LINE, SCREEN_DRAW_RECTANGLE, SCREEN_DRAW_CIRCLE,
+    KEYBOARD_INIT, KEYBOARD_KEY_PRESSED, KEYBOARD_READ_CHAR, KEYBOARD_READ_LINE, KEYBOARD_READ_INT,
+    SYS_HALT, SYS_ERROR, SYS_WAIT
+};
+
+static const char* NATIVE_NAMES[] = {
+    "Math.init", "Math.abs", "Math.multiply", "Math.divide", "Math.min", "Math.max", "Math.sqrt",
+    "Memory.init", "Memory.peek", "Memory.poke", "Memory.alloc", "Memory.deAlloc",
+    "Array.new", "Array.dispose",
+    "String.new", "String.dispose", "String.length", "String.charAt", "String.setCharAt", "String.appendChar",
+    "String.eraseLastChar", "String.intValue", "String.setInt", "String.backSpace", "String.doubleQuote", "String.newLine",
+    "Output.init", "Output.moveCursor", "Output.printChar", "Output.printString", "Output.printInt", "Output.println", "Output.backSpace",
+    "Screen.init", "Screen.clearScreen", "Screen.setColor", "Screen.drawPixel", "Screen.drawLine", "Screen.drawRectangle", "Screen.drawCircle",
+    "Keyboard.init", "Keyboard.keyPressed", "Keyboard.readChar", "Keyboard.readLine", "Keyboard.readInt",
+    "Sys.halt", "Sys.error", "Sys.wait"
+};
+
+void emulator::load(const std::filesystem::path &path) {
+    std::vector<std::filesystem::path> files;
+    if(std::filesystem::is_directory(path)) {
+        for(const auto& entry : std::filesystem::directory_iterator(path)) {
+            if(entry.is_regular_file() && entry.path().extension() == ".vm")
+                files.push_back(entry.path());
+        }
+    } else {
+        files.push_back(path);
+    }
+
+    // Sorted so static segments are laid out the same way on every run
+    std::sort(files.begin(), files.end());
+
+    if(files.empty())
+        throw std::runtime_error(path.string() + " contains no .vm files");
+
+    uint16_t next_static = STATIC_BASE;
+    for(const auto& file : files) {
+        std::ifstream in(file);
+        if(in.fail())
+            throw std::runtime_error("Failed to open " + file.string());
+
+        std::vector<vm_instruction> code;
+        std::string line;
+        while(std::getline(in, line)) {
+            auto comment = line.find("//");
+            if(comment != std::string::npos)
+                line.erase(comment);
+            if(line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+            code.push_back(vm_instruction::parse(line));
+        }
+
+        _load_unit(file.stem().string(), code, next_static);
+    }
+
+    _link_natives();
+}
+
+void emulator::_load_unit(const std::string &unit_name, const std::vector<vm_instruction> &code, uint16_t &next_static) {
+    std::unordered_map<std::string, uint32_t> labels;
+    std::vector<std::pair<uint32_t, std::string>> branches;
+    std::string function_name;
+    uint16_t static_count = 0;
+
+    for(const auto& vm : code) {
+        instruction ins{vm.op, vm.segment, vm.index, 0};
+        switch(vm.op) {
+            case vm_instruction::op_t::FUNCTION: {
+                auto index = _get_function(vm.name);
+                auto& fn = _functions[index];
+                if(fn.native >= 0 || fn.entry != UINT32_MAX)
+                    throw std::runtime_error("Duplicate function " + vm.name);
+                fn.entry = _code.size();
+                fn.local_count = vm.index;
+                fn.static_base = next_static;
+                function_name = vm.name;
+                continue;
+            }
+            case vm_instruction::op_t::LABEL:
+                if(!labels.emplace(function_name + "$" + vm.name, _code.size()).second)
+                    throw std::runtime_error(unit_name + ": duplicate label " + function_name + "$" + vm.name);
+                continue;
+            case vm_instruction::op_t::GOTO:
+            case vm_instruction::op_t::IF_GOTO:
+                branches.emplace_back(_code.size(), function_name + "$" + vm.name);
+                break;
+            case vm_instruction::op_t::CALL:
+                ins.target = _get_function(vm.name);
+                break;
+            case vm_instruction::op_t::PUSH:
+            case vm_instruction::op_t::POP:
+                if(vm.segment == vm_instruction::segment_t::STATIC)
+                    static_count = std::max<uint16_t>(static_count, vm.index + 1);
+                break;
+            default:
+                break;
+        }
+
+        _code.push_back(ins);
+    }
+
+    for(const auto& [offset, label] : branches) {
+        auto check = labels.find(label);
+        if(check == labels.end())
+            throw std::runtime_error(unit_name + ": undefined label " + label);
+        _code[offset].target = check->second;
+    }
+
+    next_static += static_count;
+    if(next_static > STACK_BASE)
+        throw std::runtime_error("Static segments exceed the available RAM");
+}
+
+void emulator::_link_natives() {
+    for(int16_t native = 0; native < (int16_t)(sizeof(NATIVE_NAMES) / sizeof(NATIVE_NAMES[0])); native++) {
+        auto check = _function_indices.find(NATIVE_NAMES[native]);
+        if(check != _function_indices.end() && _functions[check->second].entry == UINT32_MAX)
+            _functions[check->second].native = native;
+    }
+
+    for(const auto& fn : _functions) {
+        if(fn.native < 0 && fn.entry == UINT32_MAX)
+            throw std::runtime_error("Undefined function " + fn.name);
+    }
+}
+
+uint32_t emulator::_get_function(const std::string &name) {
+    auto check = _function_indices.find(name);
+    if(check != _function_indices.end())
+        return check->second;
+
+    function fn;
+    fn.name = name;
+    fn.entry = UINT32_MAX;
+    _functions.push_back(fn);
+    return _function_indices[name] = _functions.size() - 1;
+}
+
+void emulator::run(const std::string &entry) {
+    auto check = _function_indices.find(entry);
+    if(check == _function_indices.end() || _functions[check->second].native >= 0)
+        throw std::runtime_error("Entry point " + entry + " not found");
+
+    _ram.fill(0);
+    _ram[SP] = STACK_BASE;
+    _ram[LCL] = STACK_BASE;
+    _ram[ARG] = STACK_BASE;
+    _frames.clear();
+    _executed = 0;
+    _halted = false;
+    _output.clear();
+    _heap_next = HEAP_BASE;
+    _heap_free.clear();
+    _heap_used.clear();
+
+    _current = check->second;
+    _frames.push_back({_current, ENTRY_RETURN});
+    _call(_current, 0, ENTRY_RETURN);
+    uint32_t pc = _functions[_current].entry;
+
+    while(!_halted) {
+        if(_executed >= _options.max_instructions)
+            throw std::runtime_error(fmt::format("Instruction limit of {} reached", _options.max_instructions));
+
+        const auto& ins = _code[pc++];
+        _executed++;
+        _functions[_current].executed++;
+
+        switch(ins.op) {
+            case vm_instruction::op_t::PUSH:
+                if(ins.segment == vm_instruction::segment_t::CONSTANT)
+                    _push((int16_t)ins.index);
+                else
+                    _push(_segment(ins.segment, ins.index));
+                break;
+            case vm_instruction::op_t::POP: {
+                auto value = _pop();
+                _segment(ins.segment, ins.index) = value;
+                break;
+            }
+            case vm_instruction::op_t::ADD: {
+                auto b = _pop();
+                auto a = _pop();
+                _push((int16_t)(a + b));
+                break;
+            }
+            case vm_instruction::op_t::SUB: {
+                auto b = _pop();
+                auto a = _pop();
+                _push((int16_t)(a - b));
+                break;
+            }
+            case vm_instruction::op_t::NEG:
+                _push((int16_t)-_pop());
+                break;
+            case vm_instruction::op_t::EQ: {
+                auto b = _pop();
+                auto a = _pop();
+                _push(a == b ? -1 : 0);
+                break;
+            }
+            case vm_instruction::op_t::GT: {
+                auto b = _pop();
+                auto a = _pop();
+                _push(a > b ? -1 : 0);
+                break;
+            }
+            case vm_instruction::op_t::LT: {
+                auto b = _pop();
+                auto a = _pop();
+                _push(a < b ? -1 : 0);
+                break;
+            }
+            case vm_instruction::op_t::AND: {
+                auto b = _pop();
+                auto a = _pop();
+                _push((int16_t)(a & b));
+                break;
+            }
+            case vm_instruction::op_t::OR: {
+                auto b = _pop();
+                auto a = _pop();
+                _push((int16_t)(a | b));
+                break;
+            }
+            case vm_instruction::op_t::NOT:
+                _push((int16_t)~_pop());
+                break;
+            case vm_instruction::op_t::GOTO:
+                pc = ins.target;
+                break;
+            case vm_instruction::op_t::IF_GOTO:
+                if(_pop() != 0)
+                    pc = ins.target;
+                break;
+            case vm_instruction::op_t::CALL: {
+                auto& callee = _functions[ins.target];
+                callee.calls++;
+                if(callee.native >= 0) {
+                    auto args = &_memory(_ram[SP] - ins.index);
+                    auto result = _call_native(callee.native, args, ins.index);
+                    _ram[SP] = (int16_t)(_ram[SP] - ins.index);
+                    _push(result);
+                } else {
+                    _frames.push_back({_current, pc});
+                    _call(ins.target, ins.index, pc);
+                    _current = ins.target;
+                    pc = callee.entry;
+                }
+                break;
+            }
+            case vm_instruction::op_t::RETURN: {
+                auto caller = _frames.back();
+                _frames.pop_back();
+                _return();
+                if(caller.return_address == ENTRY_RETURN) {
+                    _halted = true;
+                } else {
+                    _current = caller.function;
+                    pc = caller.return_address;
+                }
+                break;
+            }
+            default:
+                throw std::runtime_error("Unexpected VM command");
+        }
+    }
+}
+
+void emulator::_call(uint32_t function_index, uint16_t arg_count, uint32_t return_address) {
+    _push((int16_t)return_address);
+    _push(_ram[LCL]);
+    _push(_ram[ARG]);
+    _push(_ram[THIS]);
+    _push(_ram[THAT]);
+    _ram[ARG] = (int16_t)(_ram[SP] - arg_count - 5);
+    _ram[LCL] = _ram[SP];
+
+    for(uint16_t i = 0; i < _functions[function_index].local_count; i++)
+        _push(0);
+}
+
+void emulator::_return() {
+    auto frame = _ram[LCL];
+    _memory(_ram[ARG]) = _pop();
+    _ram[SP] = (int16_t)(_ram[ARG] + 1);
+    _ram[THAT] = _memory(frame - 1);
+    _ram[THIS] = _memory(frame - 2);
+    _ram[ARG] = _memory(frame - 3);
+    _ram[LCL] = _memory(frame - 4);
+}
+
+int16_t emulator::_call_native(int16_t native, const int16_t *args, uint16_t arg_count) {
+    auto arg = [&](uint16_t i) -> int16_t {
+        if(i >= arg_count)
+            throw std::runtime_error(fmt::format("{} called with too few arguments", NATIVE_NAMES[native]));
+        return args[i];
+    };
+
+    switch((native_t)native) {
+        case native_t::MATH_INIT:
+        case native_t::MEMORY_INIT:
+        case native_t::OUTPUT_INIT:
+        case native_t::SCREEN_INIT:
+        case native_t::KEYBOARD_INIT:
+        case native_t::SCREEN_CLEAR_SCREEN:
+        case native_t::SCREEN_SET_COLOR:
+        case native_t::SCREEN_DRAW_PIXEL:
+        case native_t::SCREEN_DRAW_LINE:
+        case native_t::SCREEN_DRAW_RECTANGLE:
+        case native_t::SCREEN_DRAW_CIRCLE:
+        case native_t::SYS_WAIT:
+            return 0;
+        case native_t::MATH_ABS:
+            return (int16_t)std::abs(arg(0));
+        case native_t::MATH_MULTIPLY:
+            return (int16_t)(arg(0) * arg(1));
+        case native_t::MATH_DIVIDE:
+            if(arg(1) == 0)
+                _error(3);
+            return (int16_t)(arg(0) / arg(1));
+        case native_t::MATH_MIN:
+            return std::min(arg(0), arg(1));
+        case native_t::MATH_MAX:
+            return std::max(arg(0), arg(1));
+        case native_t::MATH_SQRT:
+            if(arg(0) < 0)
+                _error(4);
+            return (int16_t)std::sqrt((double)arg(0));
+        case native_t::MEMORY_PEEK:
+            return _memory(arg(0));
+        case native_t::MEMORY_POKE:
+            _memory(arg(0)) = arg(1);
+            return 0;
+        case native_t::MEMORY_ALLOC:
+            return (int16_t)_alloc(arg(0));
+        case native_t::MEMORY_DEALLOC:
+        case native_t::ARRAY_DISPOSE:
+        case native_t::STRING_DISPOSE:
+            _free(arg(0));
+            return 0;
+        case native_t::ARRAY_NEW:
+            if(arg(0) <= 0)
+                _error(2);
+            return (int16_t)_alloc(arg(0));
+        case native_t::STRING_NEW: {
+            if(arg(0) < 0)
+                _error(14);
+            auto str = _alloc((int16_t)(arg(0) + 2));
+            _memory(str) = arg(0);
+            _memory(str + 1) = 0;
+            return (int16_t)str;
+        }
+        case native_t::STRING_LENGTH:
+            return _memory(arg(0) + 1);
+        case native_t::STRING_CHAR_AT:
+            if(arg(1) < 0 || arg(1) >= _memory(arg(0) + 1))
+                _error(15);
+            return _memory(arg(0) + 2 + arg(1));
+        case native_t::STRING_SET_CHAR_AT:
+            if(arg(1) < 0 || arg(1) >= _memory(arg(0) + 1))
+                _error(16);
+            _memory(arg(0) + 2 + arg(1)) = arg(2);
+            return 0;
+        case native_t::STRING_APPEND_CHAR: {
+            auto length = _memory(arg(0) + 1);
+            if(length >= _memory(arg(0)))
+                _error(17);
+            _memory(arg(0) + 2 + length) = arg(1);
+            _memory(arg(0) + 1) = (int16_t)(length + 1);
+            return arg(0);
+        }
+        case native_t::STRING_ERASE_LAST_CHAR:
+            if(_memory(arg(0) + 1) == 0)
+                _error(18);
+            _memory(arg(0) + 1)--;
+            return 0;
+        case native_t::STRING_INT_VALUE: {
+            auto str = _read_string(arg(0));
+            int16_t value = 0;
+            size_t i = !str.empty() && str[0] == '-' ? 1 : 0;
+            for(; i < str.size() && std::isdigit((unsigned char)str[i]); i++)
+                value = (int16_t)(value * 10 + (str[i] - '0'));
+            return !str.empty() && str[0] == '-' ? (int16_t)-value : value;
+        }
+        case native_t::STRING_SET_INT: {
+            auto digits = std::to_string(arg(1));
+            if((int16_t)digits.size() > _memory(arg(0)))
+                _error(19);
+            for(size_t i = 0; i < digits.size(); i++)
+                _memory(arg(0) + 2 + (int32_t)i) = digits[i];
+            _memory(arg(0) + 1) = (int16_t)digits.size();
+            return 0;
+        }
+        case native_t::STRING_BACK_SPACE:
+            return 129;
+        case native_t::STRING_DOUBLE_QUOTE:
+            return 34;
+        case native_t::STRING_NEW_LINE:
+            return 128;
+        case native_t::OUTPUT_MOVE_CURSOR:
+        case native_t::OUTPUT_PRINTLN:
+            _output += '\n';
+            return 0;
+        case native_t::OUTPUT_PRINT_CHAR:
+            if(arg(0) == 128)
+                _output += '\n';
+            else if(arg(0) == 129) {
+                if(!_output.empty())
+                    _output.pop_back();
+            } else
+                _output += (char)arg(0);
+            return 0;
+        case native_t::OUTPUT_PRINT_STRING:
+            _output += _read_string(arg(0));
+            return 0;
+        case native_t::OUTPUT_PRINT_INT:
+            _output += std::to_string(arg(0));
+            return 0;
+        case native_t::OUTPUT_BACK_SPACE:
+            if(!_output.empty())
+                _output.pop_back();
+            return 0;
+        case native_t::KEYBOARD_KEY_PRESSED:
+            return _next_key();
+        case native_t::KEYBOARD_READ_CHAR: {
+            int16_t key;
+            while((key = _next_key()) == 0) {
+                if(_options.keys.empty())
+                    throw std::runtime_error("Keyboard input exhausted");
+            }
+            _output += (char)key;
+            return key;
+        }
+        case native_t::KEYBOARD_READ_LINE: {
+            _output += _read_string(arg(0));
+            std::string line;
+            int16_t key;
+            while((key = _next_key()) != 128) {
+                if(key == 0 && _options.keys.empty())
+                    break;
+                if(key != 0)
+                    line += (char)key;
+            }
+            _output += line + '\n';
+            return (int16_t)_new_string(line);
+        }
+        case native_t::KEYBOARD_READ_INT: {
+            _output += _read_string(arg(0));
+            if(_options.inputs.empty())
+                throw std::runtime_error("Keyboard input exhausted");
+            auto value = _options.inputs.front();
+            _options.inputs.pop_front();
+            _output += std::to_string(value) + '\n';
+            return value;
+        }
+        case native_t::SYS_HALT:
+            _halted = true;
+            return 0;
+        case native_t::SYS_ERROR:
+            _error(arg(0));
+            return 0;
+    }
+
+    throw std::runtime_error("Unknown native function");
+}
+
+int16_t& emulator::_segment(vm_instruction::segment_t segment, uint16_t index) {
+    switch(segment) {
+        case vm_instruction::segment_t::CONSTANT:
+            throw std::runtime_error("The constant segment cannot be written");
+        case vm_instruction::segment_t::LOCAL:
+            return _memory(_ram[LCL] + index);
+        case vm_instruction::segment_t::ARGUMENT:
+            return _memory(_ram[ARG] + index);
+        case vm_instruction::segment_t::THIS:
+            return _memory((uint16_t)_ram[THIS] + index);
+        case vm_instruction::segment_t::THAT:
+            return _memory((uint16_t)_ram[THAT] + index);
+        case vm_instruction::segment_t::POINTER:
+            if(index > 1)
+                throw std::runtime_error("pointer index out of range");
+            return _ram[THIS + index];
+        case vm_instruction::segment_t::TEMP:
+            if(index > 7)
+                throw std::runtime_error("temp index out of range");
+            return _ram[TEMP_BASE + index];
+        case vm_instruction::segment_t::STATIC:
+            return _memory(_functions[_current].static_base + index);
+    }
+
+    throw std::runtime_error("Unknown segment");
+}
+
+int16_t& emulator::_memory(int32_t address) {
+    if(address < 0 || address >= (int32_t)_ram.size())
+        throw std::runtime_error(fmt::format("Memory access out of range ({})", address));
+    return _ram[address];
+}
+
+void emulator::_push(int16_t value) {
+    _memory(_ram[SP]) = value;
+    _ram[SP]++;
+}
+
+int16_t emulator::_pop() {
+    _ram[SP]--;
+    return _memory(_ram[SP]);
+}
+
+uint16_t emulator::_alloc(int16_t size) {
+    if(size <= 0)
+        _error(5);
+
+    for(auto it = _heap_free.begin(); it != _heap_free.end(); it++) {
+        if(it->second < size)
+            continue;
+
+        auto address = it->first;
+        auto remaining = it->second - size;
+        _heap_free.erase(it);
+        if(remaining > 0)
+            _heap_free[address + size] = remaining;
+        _heap_used[address] = size;
+        return address;
+    }
+
+    if(_heap_next + size > HEAP_END)
+        _error(6);
+
+    auto address = _heap_next;
+    _heap_next += size;
+    _heap_used[address] = size;
+    return address;
+}
+
+void emulator::_free(uint16_t address) {
+    auto check = _heap_used.find(address);
+    if(check == _heap_used.end())
+        return;
+
+    _heap_free[address] = check->second;
+    _heap_used.erase(check);
+}
+
+uint16_t emulator::_new_string(const std::string &value) {
+    auto str = _alloc((int16_t)(value.size() + 2));
+    _memory(str) = (int16_t)value.size();
+    _memory(str + 1) = (int16_t)value.size();
+    for(size_t i = 0; i < value.size(); i++)
+        _memory(str + 2 + (int32_t)i) = value[i];
+    return str;
+}
+
+std::string emulator::_read_string(uint16_t address) {
+    std::string str;
+    auto length = _memory(address + 1);
+    for(int16_t i = 0; i < length; i++)
+        str += (char)_memory(address + 2 + i);
+    return str;
+}
+
+int16_t emulator::_next_key() {
+    if(_options.keys.empty())
+        return 0;
+
+    auto& key = _options.keys.front();
+    auto value = key.first;
+    if(--key.second == 0)
+        _options.keys.pop_front();
+    return value;
+}
+
+void emulator::_error(int16_t code) {
+    throw std::runtime_error(fmt::format("Sys.error({})", code));
+}
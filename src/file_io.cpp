@@ -0,0 +1,662 @@
+#include "file_io.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+    #define FILE_IO_URING 1
+
+    #include <linux/io_uring.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+#if __has_include(<unistd.h>)
+    #define FILE_IO_FSYNC 1
+
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+bool file_io::_use_uring = true;
+
+void file_io::read_all(const std::vector<std::filesystem::path> &paths, const read_callback &on_read) {
+    if(_use_uring && _read_uring(paths, on_read))
+        return;
+
+    _read_threaded(paths, on_read);
+}
+
+std::list<std::string> file_io::write_all(const std::vector<write_request> &requests) {
+    // Outputs whose bytes already match are left untouched, keeping their modification times
+    std::vector<std::filesystem::path> paths;
+    paths.reserve(requests.size());
+    for(const auto& request : requests)
+        paths.push_back(request.path);
+
+    std::vector<char> unchanged(requests.size(), false);
+    read_all(paths, [&requests, &unchanged](size_t index, read_result result) {
+        unchanged[index] = result.error.empty() && result.contents == *requests[index].contents;
+    });
+
+    // Changed outputs go to a temporary file next to the target, which is renamed over it once complete
+    // so that a crash or a concurrent reader never sees a partially written file
+    std::vector<write_request> temp_requests;
+    std::vector<size_t> temp_indices;
+    for(size_t i = 0; i < requests.size(); i++) {
+        if(unchanged[i])
+            continue;
+
+        temp_requests.push_back({_temp_path_for(requests[i].path), requests[i].contents});
+        temp_indices.push_back(i);
+    }
+
+    std::vector<std::string> write_errors(temp_requests.size());
+    if(!_use_uring || !_write_uring(temp_requests, write_errors))
+        _write_threaded(temp_requests, write_errors);
+
+    // The fsyncs wait on the disk, so the files are flushed in parallel
+    std::vector<std::future<void>> futures;
+    futures.reserve(temp_requests.size());
+    for(size_t i = 0; i < temp_requests.size(); i++) {
+        if(!write_errors[i].empty())
+            continue;
+        futures.push_back(std::async(std::launch::async, [&requests, &temp_requests, &temp_indices, &write_errors, i] {
+            write_errors[i] = _prepare_rename(temp_requests[i].path, requests[temp_indices[i]].path);
+        }));
+    }
+    for(auto& future : futures)
+        future.get();
+
+    std::list<std::string> errors;
+    std::vector<std::filesystem::path> directories;
+    for(size_t i = 0; i < temp_requests.size(); i++) {
+        const auto& path = requests[temp_indices[i]].path;
+        std::error_code ec;
+
+        if(write_errors[i].empty()) {
+            std::filesystem::rename(temp_requests[i].path, path, ec);
+            if(!ec) {
+                if(std::find(directories.begin(), directories.end(), path.parent_path()) == directories.end())
+                    directories.push_back(path.parent_path());
+                continue;
+            }
+            write_errors[i] = ec.message();
+        }
+
+        std::filesystem::remove(temp_requests[i].path, ec);
+        errors.push_back("Failed to write " + path.string() + ": " + write_errors[i]);
+    }
+
+    for(const auto& directory : directories)
+        _sync_directory(directory);
+    return errors;
+}
+
+std::string file_io::_prepare_rename(const std::filesystem::path &temp_path, const std::filesystem::path &path) {
+    // The temporary file is created 0644, a replaced output keeps its own permissions
+    std::error_code ec;
+    auto target = std::filesystem::status(path, ec);
+    if(!ec && std::filesystem::exists(target)) {
+        std::filesystem::permissions(temp_path, target.permissions(), ec);
+        if(ec)
+            return ec.message();
+    }
+
+#ifdef FILE_IO_FSYNC
+    // Without it a crash after the rename can leave an empty or truncated output in place
+    int fd = open(temp_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return std::strerror(errno);
+    bool synced = fsync(fd) == 0;
+    int error = errno;
+    close(fd);
+    if(!synced)
+        return std::strerror(error);
+#endif
+
+    return "";
+}
+
+void file_io::_sync_directory(const std::filesystem::path &directory) {
+#ifdef FILE_IO_FSYNC
+    // Makes the renames durable. Best effort, the outputs are already in place and some file
+    // systems cannot sync a directory
+    int fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0)
+        return;
+    fsync(fd);
+    close(fd);
+#else
+    (void)directory;
+#endif
+}
+
+std::filesystem::path file_io::_temp_path_for(const std::filesystem::path &path) {
+    static const std::string temp_suffix = "." + std::to_string(std::random_device()()) + ".tmp";
+
+    auto temp_path = path;
+    temp_path.replace_filename("." + path.filename().string() + temp_suffix);
+    return temp_path;
+}
+
+file_io::stream_writer::stream_writer(std::filesystem::path path)
+    : _path(std::move(path)), _temp_path(_temp_path_for(_path)), _out(_temp_path, std::ios::binary) { }
+
+file_io::stream_writer::~stream_writer() {
+    if(_committed)
+        return;
+
+    _out.close();
+    std::error_code ec;
+    std::filesystem::remove(_temp_path, ec);
+}
+
+void file_io::stream_writer::write(const std::string &data) {
+    _out.write(data.data(), (std::streamsize)data.size());
+}
+
+std::string file_io::stream_writer::commit() {
+    _committed = true;
+    _out.close();
+
+    std::error_code ec;
+    if(_out.fail()) {
+        std::filesystem::remove(_temp_path, ec);
+        return "Failed to write " + _path.string();
+    }
+
+    // Compare in chunks so the output never has to be held in memory
+    bool unchanged = false;
+    std::ifstream written(_temp_path, std::ios::binary);
+    std::ifstream existing(_path, std::ios::binary);
+    if(existing.good()) {
+        static constexpr std::streamsize CHUNK_SIZE = 1 << 16;
+        std::vector<char> written_chunk(CHUNK_SIZE);
+        std::vector<char> existing_chunk(CHUNK_SIZE);
+
+        unchanged = true;
+        while(unchanged) {
+            written.read(written_chunk.data(), CHUNK_SIZE);
+            existing.read(existing_chunk.data(), CHUNK_SIZE);
+            auto count = written.gcount();
+            unchanged = count == existing.gcount()
+                        && std::equal(written_chunk.begin(), written_chunk.begin() + count, existing_chunk.begin());
+            if(count < CHUNK_SIZE)
+                break;
+        }
+    }
+    written.close();
+    existing.close();
+
+    if(unchanged) {
+        std::filesystem::remove(_temp_path, ec);
+        return "";
+    }
+
+    auto error = _prepare_rename(_temp_path, _path);
+    if(error.empty()) {
+        std::filesystem::rename(_temp_path, _path, ec);
+        if(!ec) {
+            _sync_directory(_path.parent_path());
+            return "";
+        }
+        error = ec.message();
+    }
+
+    std::filesystem::remove(_temp_path, ec);
+    return "Failed to write " + _path.string() + ": " + error;
+}
+
+void file_io::_read_threaded(const std::vector<std::filesystem::path> &paths, const read_callback &on_read) {
+    std::vector<std::future<void>> futures;
+    futures.reserve(paths.size());
+
+    for(size_t i = 0; i < paths.size(); i++) {
+        futures.push_back(std::async(std::launch::async, [&paths, &on_read, i] {
+            read_result result;
+            std::ifstream in(paths[i], std::ios::binary);
+            if(in.fail()) {
+                result.error = "Failed to open file";
+            } else {
+                std::ostringstream contents;
+                contents << in.rdbuf();
+                result.contents = contents.str();
+            }
+
+            on_read(i, std::move(result));
+        }));
+    }
+
+    for(auto& future : futures)
+        future.get();
+}
+
+void file_io::_write_threaded(const std::vector<write_request> &requests, std::vector<std::string>& errors) {
+    std::vector<std::future<void>> futures;
+    futures.reserve(requests.size());
+
+    for(size_t i = 0; i < requests.size(); i++) {
+        futures.push_back(std::async(std::launch::async, [&requests, &errors, i] {
+            std::ofstream out(requests[i].path, std::ios::binary);
+            out.write(requests[i].contents->data(), (std::streamsize)requests[i].contents->size());
+            out.close();
+            if(out.fail())
+                errors[i] = std::strerror(errno);
+        }));
+    }
+
+    for(auto& future : futures)
+        future.get();
+}
+
+#ifdef FILE_IO_URING
+
+/*
+ * Minimal io_uring wrapper over the raw system calls, the submission and completion rings are
+ * mapped once and every request is identified by its 64-bit user data.
+ */
+class uring {
+private:
+    int _fd = -1;
+    unsigned _entries = 0;
+    unsigned _unsubmitted = 0;
+
+    void* _sq_ring = MAP_FAILED;
+    void* _cq_ring = MAP_FAILED;
+    size_t _sq_ring_size = 0;
+    size_t _cq_ring_size = 0;
+    io_uring_sqe* _sqes = (io_uring_sqe*)MAP_FAILED;
+    size_t _sqes_size = 0;
+
+    unsigned* _sq_head = nullptr;
+    unsigned* _sq_tail = nullptr;
+    unsigned* _sq_mask = nullptr;
+    unsigned* _sq_array = nullptr;
+    unsigned* _cq_head = nullptr;
+    unsigned* _cq_tail = nullptr;
+    unsigned* _cq_mask = nullptr;
+    io_uring_cqe* _cqes = nullptr;
+public:
+    explicit uring(unsigned entries) {
+        io_uring_params params{};
+        _fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if(_fd < 0)
+            return;
+
+        _entries = params.sq_entries;
+        _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(single_mmap)
+            _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+
+        _sq_ring = mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        _cq_ring = single_mmap ? _sq_ring : mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        _sqes = (io_uring_sqe*)mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+
+        if(_sq_ring == MAP_FAILED || _cq_ring == MAP_FAILED || _sqes == MAP_FAILED) {
+            _release();
+            return;
+        }
+
+        auto sq = (char*)_sq_ring;
+        _sq_head = (unsigned*)(sq + params.sq_off.head);
+        _sq_tail = (unsigned*)(sq + params.sq_off.tail);
+        _sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+        _sq_array = (unsigned*)(sq + params.sq_off.array);
+
+        auto cq = (char*)_cq_ring;
+        _cq_head = (unsigned*)(cq + params.cq_off.head);
+        _cq_tail = (unsigned*)(cq + params.cq_off.tail);
+        _cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+        _cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    }
+
+    ~uring() {
+        _release();
+    }
+
+    uring(const uring&) = delete;
+    uring& operator=(const uring&) = delete;
+
+    [[nodiscard]] bool valid() const { return _fd >= 0; };
+    [[nodiscard]] unsigned entries() const { return _entries; };
+
+    // Kernels before 5.6 set up rings but do not know the file opcodes
+    bool supports(std::initializer_list<uint8_t> ops) {
+        std::vector<char> buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+        auto probe = (io_uring_probe*)buffer.data();
+        if(syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+            return false;
+
+        for(auto op : ops) {
+            if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+        return true;
+    }
+
+    // Returns a cleared submission entry, or nullptr when the submission ring is full
+    io_uring_sqe* next_sqe() {
+        unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+        unsigned tail = *_sq_tail + _unsubmitted;
+        if(tail - head >= _entries)
+            return nullptr;
+
+        unsigned index = tail & *_sq_mask;
+        auto sqe = &_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        _sq_array[index] = index;
+        _unsubmitted++;
+        return sqe;
+    }
+
+    // Submits every prepared entry and blocks until at least one completion is available
+    void submit_and_wait() {
+        __atomic_store_n(_sq_tail, *_sq_tail + _unsubmitted, __ATOMIC_RELEASE);
+        auto to_submit = _unsubmitted;
+        _unsubmitted = 0;
+
+        while(true) {
+            auto result = syscall(__NR_io_uring_enter, _fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if(result >= 0)
+                return;
+            if(errno != EINTR)
+                throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+        }
+    }
+
+    template<typename Handler>
+    void drain(Handler&& handler) {
+        unsigned head = *_cq_head;
+        unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; head++) {
+            auto cqe = _cqes[head & *_cq_mask];
+            __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+            handler(cqe.user_data, cqe.res);
+        }
+    }
+private:
+    void _release() {
+        if(_sqes != MAP_FAILED)
+            munmap(_sqes, _sqes_size);
+        if(_cq_ring != MAP_FAILED && _cq_ring != _sq_ring)
+            munmap(_cq_ring, _cq_ring_size);
+        if(_sq_ring != MAP_FAILED)
+            munmap(_sq_ring, _sq_ring_size);
+        if(_fd >= 0)
+            close(_fd);
+
+        _sqes = (io_uring_sqe*)MAP_FAILED;
+        _sq_ring = _cq_ring = MAP_FAILED;
+        _fd = -1;
+    }
+};
+
+// Ring size, also the limit of files open at once
+static constexpr unsigned URING_ENTRIES = 64;
+// Largest single read or write request
+static constexpr size_t URING_MAX_TRANSFER = 1 << 30;
+
+enum struct uring_op_t : uint8_t {
+    OPEN,
+    STAT,
+    READ,
+    WRITE,
+    CLOSE
+};
+
+static uint64_t uring_user_data(size_t file, uring_op_t op) {
+    return ((uint64_t)file << 8) | (uint8_t)op;
+}
+
+/*
+ * Drives a batch of per-file request chains. start_file(i) returns the first request of file i,
+ * handle(file, op, result) may return the file's next request. Follow-up requests are submitted
+ * before new files are started, so a file finishes as early as possible.
+ */
+template<typename Prepare, typename Handle>
+static void uring_run(uring& ring, size_t file_count, Prepare&& prepare, Handle&& handle) {
+    std::deque<uint64_t> followups;
+    size_t next_file = 0;
+    unsigned in_flight = 0;
+    unsigned open_files = 0;
+
+    while(true) {
+        while(!followups.empty() || (next_file < file_count && open_files < URING_ENTRIES)) {
+            auto sqe = ring.next_sqe();
+            if(sqe == nullptr)
+                break;
+
+            uint64_t request;
+            if(!followups.empty()) {
+                request = followups.front();
+                followups.pop_front();
+            } else {
+                request = uring_user_data(next_file++, uring_op_t::OPEN);
+                open_files++;
+            }
+
+            prepare(sqe, request >> 8, (uring_op_t)(request & 0xFF));
+            sqe->user_data = request;
+            in_flight++;
+        }
+
+        if(in_flight == 0)
+            break;
+
+        ring.submit_and_wait();
+        ring.drain([&](uint64_t request, int32_t result) {
+            in_flight--;
+            auto file = request >> 8;
+            auto op = (uring_op_t)(request & 0xFF);
+
+            // A failed open and a finished close both end the file's chain
+            if(op == uring_op_t::CLOSE || (op == uring_op_t::OPEN && result < 0))
+                open_files--;
+
+            auto next = handle(file, op, result);
+            if(next.has_value())
+                followups.push_back(uring_user_data(file, next.value()));
+        });
+    }
+}
+
+bool file_io::_read_uring(const std::vector<std::filesystem::path> &paths, const read_callback &on_read) {
+    uring ring(URING_ENTRIES);
+    if(!ring.valid() || !ring.supports({IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE}))
+        return false;
+
+    struct file_state {
+        std::string path;
+        int fd = -1;
+        struct statx stat{};
+        size_t offset = 0;
+        read_result result;
+    };
+
+    std::vector<file_state> files(paths.size());
+    for(size_t i = 0; i < paths.size(); i++)
+        files[i].path = paths[i].string();
+
+    auto prepare = [&](io_uring_sqe* sqe, size_t index, uring_op_t op) {
+        auto& file = files[index];
+        switch(op) {
+            case uring_op_t::OPEN:
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (uint64_t)file.path.c_str();
+                sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                break;
+            case uring_op_t::STAT:
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = file.fd;
+                sqe->addr = (uint64_t)"";
+                sqe->len = STATX_SIZE;
+                sqe->off = (uint64_t)&file.stat;
+                sqe->statx_flags = AT_EMPTY_PATH;
+                break;
+            case uring_op_t::READ:
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = file.fd;
+                sqe->addr = (uint64_t)(file.result.contents.data() + file.offset);
+                sqe->len = (uint32_t)std::min(file.result.contents.size() - file.offset, URING_MAX_TRANSFER);
+                sqe->off = file.offset;
+                break;
+            default:
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = file.fd;
+                break;
+        }
+    };
+
+    auto handle = [&](size_t index, uring_op_t op, int32_t result) -> std::optional<uring_op_t> {
+        auto& file = files[index];
+        auto complete = [&]() {
+            on_read(index, std::move(file.result));
+            return uring_op_t::CLOSE;
+        };
+
+        if(result < 0 && op != uring_op_t::CLOSE) {
+            if(result == -EINTR || result == -EAGAIN)
+                return op;
+
+            file.result.contents.clear();
+            file.result.error = op == uring_op_t::OPEN ? "Failed to open file" : std::string("Failed to read file: ") + std::strerror(-result);
+            if(op == uring_op_t::OPEN) {
+                on_read(index, std::move(file.result));
+                return std::nullopt;
+            }
+            return complete();
+        }
+
+        switch(op) {
+            case uring_op_t::OPEN:
+                file.fd = result;
+                return uring_op_t::STAT;
+            case uring_op_t::STAT:
+                file.result.contents.resize(file.stat.stx_size);
+                if(file.result.contents.empty())
+                    return complete();
+                return uring_op_t::READ;
+            case uring_op_t::READ:
+                file.offset += result;
+                // The file may have shrunk since it was stat'ed
+                if(result == 0)
+                    file.result.contents.resize(file.offset);
+                if(file.offset == file.result.contents.size())
+                    return complete();
+                return uring_op_t::READ;
+            default:
+                return std::nullopt;
+        }
+    };
+
+    uring_run(ring, files.size(), prepare, handle);
+    return true;
+}
+
+bool file_io::_write_uring(const std::vector<write_request> &requests, std::vector<std::string> &errors) {
+    uring ring(URING_ENTRIES);
+    if(!ring.valid() || !ring.supports({IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE}))
+        return false;
+
+    struct file_state {
+        std::string path;
+        int fd = -1;
+        size_t offset = 0;
+    };
+
+    std::vector<file_state> files(requests.size());
+    for(size_t i = 0; i < requests.size(); i++)
+        files[i].path = requests[i].path.string();
+
+    auto prepare = [&](io_uring_sqe* sqe, size_t index, uring_op_t op) {
+        auto& file = files[index];
+        const auto& contents = *requests[index].contents;
+        switch(op) {
+            case uring_op_t::OPEN:
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = (uint64_t)file.path.c_str();
+                sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+                sqe->len = 0644;
+                break;
+            case uring_op_t::WRITE:
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->fd = file.fd;
+                sqe->addr = (uint64_t)(contents.data() + file.offset);
+                sqe->len = (uint32_t)std::min(contents.size() - file.offset, URING_MAX_TRANSFER);
+                sqe->off = file.offset;
+                break;
+            default:
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = file.fd;
+                break;
+        }
+    };
+
+    auto handle = [&](size_t index, uring_op_t op, int32_t result) -> std::optional<uring_op_t> {
+        auto& file = files[index];
+        const auto& contents = *requests[index].contents;
+
+        if(result < 0) {
+            if(result == -EINTR || result == -EAGAIN)
+                return op;
+
+            if(errors[index].empty())
+                errors[index] = std::strerror(-result);
+            return op == uring_op_t::WRITE ? std::optional(uring_op_t::CLOSE) : std::nullopt;
+        }
+
+        switch(op) {
+            case uring_op_t::OPEN:
+                file.fd = result;
+                return contents.empty() ? uring_op_t::CLOSE : uring_op_t::WRITE;
+            case uring_op_t::WRITE:
+                file.offset += result;
+                return file.offset == contents.size() ? uring_op_t::CLOSE : uring_op_t::WRITE;
+            default:
+                return std::nullopt;
+        }
+    };
+
+    uring_run(ring, files.size(), prepare, handle);
+    return true;
+}
+
+bool file_io::uring_available() {
+    if(!_use_uring)
+        return false;
+
+    uring ring(URING_ENTRIES);
+    return ring.valid() && ring.supports({IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE});
+}
+
+#else
+
+bool file_io::_read_uring(const std::vector<std::filesystem::path>&, const read_callback&) {
+    return false;
+}
+
+bool file_io::_write_uring(const std::vector<write_request>&, std::vector<std::string>&) {
+    return false;
+}
+
+bool file_io::uring_available() {
+    return false;
+}
+
+#endif
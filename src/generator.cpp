@@ -1,27 +1,30 @@
 #include "generator.hpp"
+#include "pruner.hpp"
 
 #include <fmt/format.h>
 
+#include <cstdlib>
+#include <iterator>
 #include <stdexcept>
 
-#define GEN_DYNAMIC(fmt_str, ...) _vm_code.emplace_back(fmt::format(#fmt_str, __VA_ARGS__));
-#define GEN(code) _vm_code.emplace_back(#code);
-
-std::atomic_uint16_t generator::_next_static_index = 0;
+// Instructions are formatted straight into the code buffer, emitting one does not allocate
+#define GEN_DYNAMIC(fmt_str, ...) fmt::format_to(std::back_inserter(_vm_code), #fmt_str "\n", __VA_ARGS__);
+#define GEN(code) _vm_code.append(#code "\n");
 
 void generator::run(ast_class *ast) {
-    _next_this_index = 0;
     _top_level = ast;
 
-    for(const auto& var : ast->variables) {
-        for(const auto& identifier : var.identifiers) {
-            if(_global_symbols.count(identifier) > 0)
-                throw std::runtime_error("duplicate identifier '" + identifier + "'");
-
-            if(var.is_static)
-                _global_symbols[identifier] = symbol(symbol::segment_t::STATIC, _get_next_static_index(), var.type);
-            else
-                _global_symbols[identifier] = symbol(symbol::segment_t::THIS, _next_this_index++, var.type);
+    // The counter array is sized on first entry, so every site must be known up front
+    _profile_sites.clear();
+    _next_profile_site = 0;
+    if(_instrumentation.enabled) {
+        for(const auto& subroutine : ast->subroutines) {
+            auto name = ast->identifier + "." + subroutine.identifier;
+            _profile_sites.push_back(name);
+
+            uint32_t loop = 0;
+            if(_instrumentation.loops)
+                _collect_profile_sites(name, subroutine.statements, loop);
         }
     }
 
@@ -29,84 +32,165 @@ void generator::run(ast_class *ast) {
         _generate_subroutine(subroutine);
 }
 
-void generator::_generate_subroutine(const ast_class_subroutine &subroutine) {
-    _subroutine_symbols.clear();
-    _next_local_index = 0;
-    _next_arg_index = subroutine.type == ast_class_subroutine::type_t::METHOD ? 1 : 0;
-
-    for(const auto& local : subroutine.locals) {
-        for(const auto& identifier : local.identifiers) {
-            if(_global_symbols.count(identifier) > 0 || _subroutine_symbols.count(identifier) > 0)
-                throw std::runtime_error("duplicate identifier '" + identifier + "'");
+void generator::run_subroutine(ast_class *ast, const ast_class_subroutine &subroutine) {
+    _top_level = ast;
+    _generate_subroutine(subroutine);
+}
 
-            _subroutine_symbols[identifier] = symbol(symbol::segment_t::LOCAL, _next_local_index++, local.type);
-        }
-    }
+void generator::_generate_subroutine(const ast_class_subroutine &subroutine) {
+    _that_base.reset();
+    auto start = _vm_code.size();
+    if(_record_source_map)
+        _mark_source(subroutine.span);
 
-    GEN_DYNAMIC(function {}.{} {}, _top_level->identifier, subroutine.identifier, _subroutine_symbols.size())
+    GEN_DYNAMIC(function {}.{} {}, _top_level->identifier, subroutine.identifier, subroutine.local_count)
     if(subroutine.type == ast_class_subroutine::type_t::METHOD) {
         GEN(push argument 0)
         GEN(pop pointer 0)
     } else if(subroutine.type == ast_class_subroutine::type_t::CONSTRUCTOR) {
-        GEN_DYNAMIC(push constant {}, _next_this_index)
+        GEN_DYNAMIC(push constant {}, _top_level->field_count)
         GEN(call Memory.alloc 1)
         GEN(pop pointer 0)
     }
 
-    for(const auto& arg : subroutine.parameters) {
-        if(_global_symbols.count(arg.identifier) > 0 || _subroutine_symbols.count(arg.identifier) > 0)
-            throw std::runtime_error(fmt::format("duplicate identifier '{}'", arg.identifier));
-
-        _subroutine_symbols[arg.identifier] = symbol(symbol::segment_t::ARGUMENT, _next_arg_index++, arg.type);
+    _in_main = false;
+    if(!_profile_sites.empty()) {
+        auto site = _next_profile_site++;
+        auto label_num = _next_label++;
+
+        GEN_DYNAMIC(push static {}, _instrumentation.counters_static)
+        GEN_DYNAMIC(if-goto PROFILE_READY_{}, label_num)
+        GEN_DYNAMIC(push constant {}, _instrumentation.class_id)
+        GEN_DYNAMIC(push constant {}, _profile_sites.size())
+        GEN_DYNAMIC(call {}.register 2, PROFILE_CLASS)
+        GEN_DYNAMIC(pop static {}, _instrumentation.counters_static)
+        GEN_DYNAMIC(label PROFILE_READY_{}, label_num)
+        _generate_profile_count(site);
+
+        // The program ends when Main.main returns, the counts are printed just before
+        _in_main = _top_level->identifier == "Main" && subroutine.identifier == "main";
     }
 
     _generate_statements(subroutine.statements);
+    _remove_dead_code(start);
 }
 
 void generator::_generate_if_statement(const ast_statement_if *if_statement) {
     auto label_num = _next_label++;
-    auto true_label = fmt::format("IF_TRUE_{}", label_num);
-    auto end_label = fmt::format("IF_END_{}", label_num);
-    _generate_expression(if_statement->conditional);
-    GEN_DYNAMIC(if-goto {}, true_label)
+
+    // The true branch falls through when jumping away on a false condition needs no extra not
+    if(!_branch_needs_not(if_statement->conditional, false)) {
+        bool has_else = !if_statement->false_statements.empty();
+        _generate_branch(if_statement->conditional, false, has_else ? "IF_FALSE" : "IF_END", label_num);
+        _generate_statements(if_statement->true_statements);
+        if(has_else) {
+            GEN_DYNAMIC(goto IF_END_{}, label_num)
+            GEN_DYNAMIC(label IF_FALSE_{}, label_num)
+            _that_base.reset();
+            _generate_statements(if_statement->false_statements);
+        }
+        GEN_DYNAMIC(label IF_END_{}, label_num)
+        _that_base.reset();
+        return;
+    }
+
+    _generate_branch(if_statement->conditional, true, "IF_TRUE", label_num);
     _generate_statements(if_statement->false_statements);
-    GEN_DYNAMIC(goto {}, end_label)
-    GEN_DYNAMIC(label {}, true_label)
+    GEN_DYNAMIC(goto IF_END_{}, label_num)
+    GEN_DYNAMIC(label IF_TRUE_{}, label_num)
+    _that_base.reset();
     _generate_statements(if_statement->true_statements);
-    GEN_DYNAMIC(label {}, end_label)
+    GEN_DYNAMIC(label IF_END_{}, label_num)
+    _that_base.reset();
 }
 
 void generator::_generate_let_statement(const ast_statement_let *let_statement) {
     if(let_statement->array_access.has_value()) {
-        GEN_DYNAMIC(push {}, _get_symbol(let_statement->identifier).to_string())
+        const auto& base = let_statement->slot;
+        auto index = pruner::fold(let_statement->array_access.value());
+        if(index.has_value() && index.value() >= 0) {
+            // Evaluating the assignment first is only safe when no call can change the base variable
+            if(!_uses_that(let_statement->assignment)) {
+                _load_that_base(base);
+                _generate_expression(let_statement->assignment);
+                GEN_DYNAMIC(pop that {}, index.value())
+                return;
+            } else if(base.segment == symbol::segment_t::LOCAL || base.segment == symbol::segment_t::ARGUMENT) {
+                _generate_expression(let_statement->assignment);
+                _load_that_base(base);
+                GEN_DYNAMIC(pop that {}, index.value())
+                return;
+            }
+        }
+
+        GEN_DYNAMIC(push {} {}, symbol::segment_to_string(base.segment), base.index)
         _generate_expression(let_statement->array_access.value());
         GEN(add)
-        GEN(pop temp 0)
-        _generate_expression(let_statement->assignment);
-        GEN(push temp 0)
-        GEN(pop pointer 1)
-        GEN(pop that 0)
+
+        // pointer 1 can be set before the assignment when evaluating it leaves that segment alone
+        if(!_uses_that(let_statement->assignment)) {
+            GEN(pop pointer 1)
+            _generate_expression(let_statement->assignment);
+            GEN(pop that 0)
+        } else {
+            // The address stays on the stack, a callee's do statements and stores overwrite temp 0
+            _generate_expression(let_statement->assignment);
+            GEN(pop temp 0)
+            GEN(pop pointer 1)
+            GEN(push temp 0)
+            GEN(pop that 0)
+        }
+        _that_base.reset();
     } else {
         _generate_expression(let_statement->assignment);
-        GEN_DYNAMIC(pop {}, _get_symbol(let_statement->identifier).to_string())
+        GEN_DYNAMIC(pop {} {}, symbol::segment_to_string(let_statement->slot.segment), let_statement->slot.index)
+        if(_that_base == let_statement->slot)
+            _that_base.reset();
     }
 }
 
 void generator::_generate_while_statement(const ast_statement_while *while_statement) {
     auto label_num = _next_label++;
-    auto begin_label = fmt::format("WHILE_BEGIN_{}", label_num);
-    auto end_label = fmt::format("WHILE_END_{}", label_num);
-    GEN_DYNAMIC(label {}, begin_label)
-    _generate_expression(while_statement->conditional);
-    GEN(not)
-    GEN_DYNAMIC(if-goto {}, end_label)
+    // The loop only continues while the condition is -1, ~ of anything else is nonzero
+    auto condition = pruner::fold(while_statement->conditional);
+    bool forever = condition == -1;
+    // A boolean condition sits below the body so every iteration ends in a single conditional jump
+    bool rotated = !forever && _is_boolean(while_statement->conditional);
+
+    if(rotated) {
+        GEN_DYNAMIC(goto WHILE_COND_{}, label_num)
+    } else if(!forever) {
+        GEN_DYNAMIC(label WHILE_COND_{}, label_num)
+        _that_base.reset();
+        _generate_expression(while_statement->conditional);
+        GEN(not)
+        GEN_DYNAMIC(if-goto WHILE_END_{}, label_num)
+    }
+    GEN_DYNAMIC(label WHILE_BODY_{}, label_num)
+    // Site numbers follow the pre-order of _collect_profile_sites, the array exists since the entry count
+    if(!_profile_sites.empty() && _instrumentation.loops)
+        _generate_profile_count(_next_profile_site++);
+    _that_base.reset();
     _generate_statements(while_statement->statements);
-    GEN_DYNAMIC(goto {}, begin_label)
-    GEN_DYNAMIC(label {}, end_label)
+    if(!rotated) {
+        GEN_DYNAMIC(goto {}_{}, forever ? "WHILE_BODY" : "WHILE_COND", label_num)
+        if(!forever)
+            GEN_DYNAMIC(label WHILE_END_{}, label_num)
+        _that_base.reset();
+        return;
+    }
+
+    GEN_DYNAMIC(label WHILE_COND_{}, label_num)
+    _that_base.reset();
+    _generate_branch(while_statement->conditional, true, "WHILE_BODY", label_num);
 }
 
 void generator::_generate_return_statement(const ast_statement_return *return_statement) {
     _generate_expression(return_statement->value);
+    if(_in_main) {
+        GEN_DYNAMIC(call {}.dump 0, PROFILE_CLASS)
+        GEN(pop temp 0)
+    }
     GEN(return)
 }
 
@@ -116,7 +200,11 @@ void generator::_generate_do_statement(const ast_statement_do *do_statement) {
 }
 
 void generator::_generate_statements(const std::list<ast_statement *> &statements) {
+    auto enclosing = _current_span;
     for(const auto& statement : statements) {
+        if(_record_source_map)
+            _mark_source(statement->span);
+
         switch(statement->type) {
             case ast_statement::type_t::IF:
                 _generate_if_statement((ast_statement_if*)statement);
@@ -135,60 +223,177 @@ void generator::_generate_statements(const std::list<ast_statement *> &statement
                 break;
         }
     }
+
+    // The rest of the enclosing statement, such as the jumps after an if's branch
+    if(_record_source_map && !statements.empty())
+        _mark_source(enclosing);
+}
+
+void generator::_mark_source(const ast_span &span) {
+    _current_span = span;
+    // A segment that got no code yet is taken over
+    if(!_source_segments.empty() && _source_segments.back().vm_offset == _vm_code.size())
+        _source_segments.back().span = span;
+    else
+        _source_segments.push_back({_vm_code.size(), span});
 }
 
 void generator::_generate_expression(const ast_expression &expression) {
-    _generate_term(expression.primary);
+    _generate_expression(expression, expression.secondaries.cend());
+}
 
-    for(const auto& pair : expression.secondaries) {
-        _generate_term(pair.second);
-        switch(pair.first) {
-            case ast_binary_op::ADD:
-                GEN(add)
+// Generates the expression up to, not including, the secondary at end
+void generator::_generate_expression(const ast_expression &expression, secondary_iterator end) {
+    emit_task task{emit_task::kind_t::EXPRESSION};
+    task.expression = &expression;
+    task.secondary = end;
+    _emit(task);
+}
+
+void generator::_generate_term(const ast_term *term) {
+    emit_task task{emit_task::kind_t::TERM};
+    task.term = term;
+    _emit(task);
+}
+
+void generator::_generate_subroutine_call(const ast_subroutine_call &call) {
+    emit_task task{emit_task::kind_t::CALL};
+    task.call = &call;
+    _emit(task);
+}
+
+/*
+ * Runs the task and everything it expands into. Expansions are pushed in reverse so they run in
+ * source order, nested subexpressions only grow _emit_stack and never the call stack.
+ */
+void generator::_emit(const emit_task &task) {
+    auto base = _emit_stack.size();
+    _emit_stack.push_back(task);
+
+    while(_emit_stack.size() > base) {
+        auto current = _emit_stack.back();
+        _emit_stack.pop_back();
+
+        switch(current.kind) {
+            case emit_task::kind_t::EXPRESSION: {
+                const auto& expression = *current.expression;
+                auto first = expression.secondaries.cbegin();
+                auto end = current.secondary;
+
+                // Multiplication commutes, so a constant left operand can be applied to the right one
+                bool constant_left = first != end && first->first == ast_binary_op::MULTIPLY
+                        && pruner::fold(expression.primary).has_value();
+
+                for(auto secondary = end; secondary != first; ) {
+                    secondary--;
+                    if(constant_left && secondary == first)
+                        break;
+
+                    emit_task secondary_task{emit_task::kind_t::SECONDARY};
+                    secondary_task.secondary = secondary;
+                    _emit_stack.push_back(secondary_task);
+                }
+
+                if(constant_left) {
+                    emit_task multiply_task{emit_task::kind_t::MULTIPLY_CONSTANT};
+                    multiply_task.term = expression.primary;
+                    _emit_stack.push_back(multiply_task);
+                    _emit_term(first->second);
+                } else {
+                    _emit_term(expression.primary);
+                }
                 break;
-            case ast_binary_op::SUBTRACT:
-                GEN(sub)
+            }
+            case emit_task::kind_t::SECONDARY: {
+                const auto& pair = *current.secondary;
+                auto constant = pair.first == ast_binary_op::MULTIPLY || pair.first == ast_binary_op::DIVIDE
+                        ? pruner::fold(pair.second) : std::nullopt;
+                if(pair.first == ast_binary_op::MULTIPLY && constant.has_value()
+                        && _try_generate_multiply_constant((uint16_t)constant.value()))
+                    break;
+                if(pair.first == ast_binary_op::DIVIDE && constant.has_value()
+                        && _try_generate_divide_constant((uint16_t)constant.value()))
+                    break;
+
+                emit_task op_task{emit_task::kind_t::BINARY_OP};
+                op_task.binary_op = pair.first;
+                _emit_stack.push_back(op_task);
+                _emit_term(pair.second);
                 break;
-            case ast_binary_op::MULTIPLY:
-                GEN(call Math.multiply 2)
+            }
+            case emit_task::kind_t::MULTIPLY_CONSTANT: {
+                auto constant = (uint16_t)pruner::fold(current.term).value_or(0);
+                if(_try_generate_multiply_constant(constant))
+                    break;
+
+                emit_task op_task{emit_task::kind_t::BINARY_OP};
+                op_task.binary_op = ast_binary_op::MULTIPLY;
+                _emit_stack.push_back(op_task);
+                _emit_term(current.term);
                 break;
-            case ast_binary_op::DIVIDE:
-                GEN(call Math.divide 2)
+            }
+            case emit_task::kind_t::TERM:
+                _emit_term(current.term);
                 break;
-            case ast_binary_op::AND:
-                GEN(and)
+            case emit_task::kind_t::BINARY_OP:
+                _emit_binary_op(current.binary_op);
                 break;
-            case ast_binary_op::OR:
-                GEN(or)
+            case emit_task::kind_t::UNARY_OP:
+                if(current.unary_op == ast_unary_op::NEGATE) {
+                    GEN(neg)
+                } else {
+                    GEN(not)
+                }
                 break;
-            case ast_binary_op::GREATER:
-                GEN(gt)
+            case emit_task::kind_t::ARRAY_READ:
+                GEN(add)
+                GEN(pop pointer 1)
+                GEN(push that 0)
+                _that_base.reset();
                 break;
-            case ast_binary_op::LESSER:
-                GEN(lt)
+            case emit_task::kind_t::CALL: {
+                const auto& call = *current.call;
+                if(call.receiver == ast_subroutine_call::receiver_t::VARIABLE) {
+                    GEN_DYNAMIC(push {} {}, symbol::segment_to_string(call.receiver_slot.segment), call.receiver_slot.index)
+                } else if(call.receiver == ast_subroutine_call::receiver_t::THIS) {
+                    GEN(push pointer 0)
+                }
+
+                emit_task end_task{emit_task::kind_t::CALL_END};
+                end_task.call = &call;
+                _emit_stack.push_back(end_task);
+                for(auto argument = call.arguments.crbegin(); argument != call.arguments.crend(); argument++) {
+                    emit_task argument_task{emit_task::kind_t::EXPRESSION};
+                    argument_task.expression = &*argument;
+                    argument_task.secondary = argument->secondaries.cend();
+                    _emit_stack.push_back(argument_task);
+                }
                 break;
-            case ast_binary_op::EQUAL:
-                GEN(eq)
+            }
+            case emit_task::kind_t::CALL_END: {
+                const auto& call = *current.call;
+                auto arg_count = call.arguments.size();
+                if(call.receiver != ast_subroutine_call::receiver_t::NONE)
+                    arg_count++;
+
+                GEN_DYNAMIC(call {}.{} {}, call.callee_class, call.subroutine_identifier, arg_count)
+                _that_base.reset();
                 break;
+            }
         }
     }
 }
 
-void generator::_generate_term(const ast_term *term) {
+// Emits a leaf term right away, pushes the tasks of a compound one
+void generator::_emit_term(const ast_term *term) {
     switch(term->type) {
         case ast_term::type_t::INTEGER:
             GEN_DYNAMIC(push constant {}, ((ast_term_integer*)term)->value)
             break;
-        case ast_term::type_t::STRING: {
-            auto str_term = (ast_term_string*)term;
-            GEN_DYNAMIC(push constant {}, str_term->value.length())
-            GEN(call String.new 1)
-            for(const auto& ch : str_term->value) {
-                GEN_DYNAMIC(push constant {}, (uint16_t)ch)
-                GEN(call String.appendChar 2)
-            }
+        case ast_term::type_t::STRING:
+            _generate_string(((ast_term_string*)term)->value);
+            _that_base.reset();
             break;
-        }
         case ast_term::type_t::NUL:
             GEN(push constant 0)
             break;
@@ -204,86 +409,571 @@ void generator::_generate_term(const ast_term *term) {
             break;
         case ast_term::type_t::VARIABLE: {
             auto var_term = (ast_term_variable*)term;
-            GEN_DYNAMIC(push {}, _get_symbol(var_term->identifier).to_string());
+            GEN_DYNAMIC(push {} {}, symbol::segment_to_string(var_term->slot.segment), var_term->slot.index)
             break;
         }
         case ast_term::type_t::ARRAY: {
             auto array_term = (ast_term_array*)term;
-            GEN_DYNAMIC(push {}, _get_symbol(array_term->identifier).to_string())
-            _generate_expression(array_term->access);
-            GEN(add)
-            GEN(pop pointer 1)
-            GEN(push that 0)
+            const auto& base = array_term->slot;
+            auto index = pruner::fold(array_term->access);
+            if(index.has_value() && index.value() >= 0) {
+                _load_that_base(base);
+                GEN_DYNAMIC(push that {}, index.value())
+                break;
+            }
+
+            GEN_DYNAMIC(push {} {}, symbol::segment_to_string(base.segment), base.index)
+            _emit_stack.push_back({emit_task::kind_t::ARRAY_READ});
+
+            emit_task access_task{emit_task::kind_t::EXPRESSION};
+            access_task.expression = &array_term->access;
+            access_task.secondary = array_term->access.secondaries.cend();
+            _emit_stack.push_back(access_task);
             break;
         }
-        case ast_term::type_t::EXPRESSION:
-            _generate_expression(((ast_term_expression*)term)->expression);
+        case ast_term::type_t::EXPRESSION: {
+            const auto& expression = ((ast_term_expression*)term)->expression;
+            emit_task expression_task{emit_task::kind_t::EXPRESSION};
+            expression_task.expression = &expression;
+            expression_task.secondary = expression.secondaries.cend();
+            _emit_stack.push_back(expression_task);
             break;
+        }
         case ast_term::type_t::UNARY: {
             auto unary_term = (ast_term_unary*)term;
-            _generate_term(unary_term->term);
-            if(unary_term->op == ast_unary_op::NEGATE) {
-                GEN(neg)
-            } else {
-                GEN(not)
-            }
+            emit_task op_task{emit_task::kind_t::UNARY_OP};
+            op_task.unary_op = unary_term->op;
+            _emit_stack.push_back(op_task);
+
+            emit_task operand_task{emit_task::kind_t::TERM};
+            operand_task.term = unary_term->term;
+            _emit_stack.push_back(operand_task);
             break;
         }
-        case ast_term::type_t::SUBROUTINE_CALL:
-            _generate_subroutine_call(((ast_term_subroutine_call*)term)->call);
+        case ast_term::type_t::SUBROUTINE_CALL: {
+            emit_task call_task{emit_task::kind_t::CALL};
+            call_task.call = &((ast_term_subroutine_call*)term)->call;
+            _emit_stack.push_back(call_task);
             break;
+        }
     }
 }
 
-void generator::_generate_subroutine_call(const ast_subroutine_call &call) {
-    uint16_t arg_count = call.arguments.size();
-    std::string callee;
-    if(call.callee_identifier.has_value()) {
-        callee = call.callee_identifier.value();
-        auto symbol = _try_get_symbol(call.callee_identifier.value());
-        if(symbol.has_value()) {
-            arg_count++;
-            callee = symbol.value().type;
-            GEN_DYNAMIC(push {}, symbol->to_string())
+void generator::_emit_binary_op(ast_binary_op op) {
+    switch(op) {
+        case ast_binary_op::ADD:
+            GEN(add)
+            break;
+        case ast_binary_op::SUBTRACT:
+            GEN(sub)
+            break;
+        case ast_binary_op::MULTIPLY:
+            GEN(call Math.multiply 2)
+            _that_base.reset();
+            break;
+        case ast_binary_op::DIVIDE:
+            GEN(call Math.divide 2)
+            _that_base.reset();
+            break;
+        case ast_binary_op::AND:
+            GEN(and)
+            break;
+        case ast_binary_op::OR:
+            GEN(or)
+            break;
+        case ast_binary_op::GREATER:
+            GEN(gt)
+            break;
+        case ast_binary_op::LESSER:
+            GEN(lt)
+            break;
+        case ast_binary_op::EQUAL:
+            GEN(eq)
+            break;
+    }
+}
+
+/*
+ * Drops the instructions after a goto or return up to the next label, gotos to the label right
+ * after them and labels nothing jumps to, repeating until nothing changes. Works on the text of
+ * the function starting at start, which is only rewritten when something was dropped. Source
+ * segments of the function move along with the lines they start on.
+ */
+void generator::_remove_dead_code(size_t start) {
+    static constexpr std::string_view LABEL = "label ", GOTO = "goto ", IF_GOTO = "if-goto ", RETURN = "return";
+    auto starts_with = [](std::string_view line, std::string_view prefix) { return line.substr(0, prefix.size()) == prefix; };
+
+    _lines.clear();
+    std::string_view code(_vm_code);
+    for(size_t begin = start, end; begin < code.size(); begin = end + 1) {
+        end = code.find('\n', begin);
+        _lines.push_back(code.substr(begin, end - begin));
+    }
+    _keep_line.assign(_lines.size(), true);
+
+    bool removed = false;
+    for(bool changed = true; changed; ) {
+        changed = false;
+
+        bool reachable = true;
+        for(size_t i = 0; i < _lines.size(); i++) {
+            if(!_keep_line[i])
+                continue;
+
+            auto line = _lines[i];
+            if(starts_with(line, LABEL)) {
+                reachable = true;
+            } else if(!reachable) {
+                _keep_line[i] = false;
+                changed = true;
+                continue;
+            }
+
+            if(starts_with(line, GOTO) || line == RETURN)
+                reachable = false;
         }
+
+        _jump_targets.clear();
+        for(size_t i = 0; i < _lines.size(); i++) {
+            if(!_keep_line[i])
+                continue;
+
+            auto line = _lines[i];
+            if(starts_with(line, GOTO)) {
+                auto next = i + 1;
+                while(next < _lines.size() && !_keep_line[next])
+                    next++;
+
+                auto target = line.substr(GOTO.size());
+                if(next < _lines.size() && starts_with(_lines[next], LABEL) && _lines[next].substr(LABEL.size()) == target) {
+                    _keep_line[i] = false;
+                    changed = true;
+                } else {
+                    _jump_targets.insert(target);
+                }
+            } else if(starts_with(line, IF_GOTO)) {
+                _jump_targets.insert(line.substr(IF_GOTO.size()));
+            }
+        }
+
+        for(size_t i = 0; i < _lines.size(); i++) {
+            if(_keep_line[i] && starts_with(_lines[i], LABEL) && _jump_targets.count(_lines[i].substr(LABEL.size())) == 0) {
+                _keep_line[i] = false;
+                changed = true;
+            }
+        }
+
+        removed = removed || changed;
+    }
+
+    if(!removed)
+        return;
+
+    auto segment = _source_segments.size();
+    while(segment > 0 && _source_segments[segment - 1].vm_offset >= start)
+        segment--;
+
+    std::string kept;
+    kept.reserve(code.size() - start);
+    for(size_t i = 0; i < _lines.size(); i++) {
+        auto offset = (size_t)(_lines[i].data() - code.data());
+        for(; segment < _source_segments.size() && _source_segments[segment].vm_offset <= offset; segment++)
+            _source_segments[segment].vm_offset = start + kept.size();
+
+        if(_keep_line[i]) {
+            kept += _lines[i];
+            kept += '\n';
+        }
+    }
+    for(; segment < _source_segments.size(); segment++)
+        _source_segments[segment].vm_offset = start + kept.size();
+    _vm_code.replace(start, std::string::npos, kept);
+}
+
+void generator::_generate_string(const std::string &str) {
+    GEN_DYNAMIC(push constant {}, str.length())
+    GEN(call String.new 1)
+    for(const auto& ch : str) {
+        GEN_DYNAMIC(push constant {}, (uint16_t)ch)
+        GEN(call String.appendChar 2)
+    }
+}
+
+// Increments the site's counter, 6 instructions, leaves pointer 1 on the counter array
+void generator::_generate_profile_count(uint32_t site) {
+    GEN_DYNAMIC(push static {}, _instrumentation.counters_static)
+    GEN(pop pointer 1)
+    GEN_DYNAMIC(push that {}, site)
+    GEN(push constant 1)
+    GEN(add)
+    GEN_DYNAMIC(pop that {}, site)
+    _that_base.reset();
+}
+
+void generator::_collect_profile_sites(const std::string& subroutine, const std::list<ast_statement *> &statements, uint32_t& loop) {
+    for(auto statement : statements) {
+        if(statement->type == ast_statement::type_t::WHILE) {
+            _profile_sites.push_back(fmt::format("{} loop {}", subroutine, loop++));
+            _collect_profile_sites(subroutine, ((ast_statement_while*)statement)->statements, loop);
+        } else if(statement->type == ast_statement::type_t::IF) {
+            _collect_profile_sites(subroutine, ((ast_statement_if*)statement)->true_statements, loop);
+            _collect_profile_sites(subroutine, ((ast_statement_if*)statement)->false_statements, loop);
+        }
+    }
+}
+
+/*
+ * Profile.register(class id, count) returns the zeroed counter array of a class and records it in
+ * the table held by static 0, Profile.dump prints "<site> <count>" for every registered class.
+ * Profile.alloc(size) allocates a zeroed array, Array.new leaves memory as it was.
+ */
+void generator::run_profile(const std::vector<std::vector<std::string>> &class_sites) {
+    GEN_DYNAMIC(function {}.alloc 1, PROFILE_CLASS)
+    GEN(push argument 0)
+    GEN(call Array.new 1)
+    GEN(pop local 0)
+    GEN(label ZERO)
+    GEN(push argument 0)
+    GEN(push constant 0)
+    GEN(eq)
+    GEN(if-goto ZEROED)
+    GEN(push argument 0)
+    GEN(push constant 1)
+    GEN(sub)
+    GEN(pop argument 0)
+    GEN(push local 0)
+    GEN(push argument 0)
+    GEN(add)
+    GEN(pop pointer 1)
+    GEN(push constant 0)
+    GEN(pop that 0)
+    GEN(goto ZERO)
+    GEN(label ZEROED)
+    GEN(push local 0)
+    GEN(return)
+
+    GEN_DYNAMIC(function {}.register 1, PROFILE_CLASS)
+    GEN(push static 0)
+    GEN(if-goto TABLE_READY)
+    GEN_DYNAMIC(push constant {}, class_sites.size())
+    GEN_DYNAMIC(call {}.alloc 1, PROFILE_CLASS)
+    GEN(pop static 0)
+    GEN(label TABLE_READY)
+    GEN(push argument 1)
+    GEN_DYNAMIC(call {}.alloc 1, PROFILE_CLASS)
+    GEN(pop local 0)
+    GEN(push static 0)
+    GEN(push argument 0)
+    GEN(add)
+    GEN(pop pointer 1)
+    GEN(push local 0)
+    GEN(pop that 0)
+    GEN(push local 0)
+    GEN(return)
+
+    GEN_DYNAMIC(function {}.dump 1, PROFILE_CLASS)
+    GEN(push static 0)
+    GEN(if-goto DUMP)
+    GEN(push constant 0)
+    GEN(return)
+    GEN(label DUMP)
+    GEN(call Output.println 0)
+    GEN(pop temp 0)
+    for(size_t class_id = 0; class_id < class_sites.size(); class_id++) {
+        const auto& sites = class_sites[class_id];
+        if(sites.empty())
+            continue;
+
+        GEN(push static 0)
+        GEN_DYNAMIC(push constant {}, class_id)
+        GEN(add)
+        GEN(pop pointer 1)
+        GEN(push that 0)
+        GEN(pop local 0)
+        GEN(push local 0)
+        GEN(push constant 0)
+        GEN(eq)
+        GEN_DYNAMIC(if-goto SKIP_{}, class_id)
+
+        // Printing may move pointer 1, it is set again for every count
+        for(size_t site = 0; site < sites.size(); site++) {
+            _generate_string(sites[site] + " ");
+            GEN(call Output.printString 1)
+            GEN(pop temp 0)
+            GEN(push local 0)
+            GEN(pop pointer 1)
+            GEN_DYNAMIC(push that {}, site)
+            GEN(call Output.printInt 1)
+            GEN(pop temp 0)
+            GEN(call Output.println 0)
+            GEN(pop temp 0)
+        }
+        GEN_DYNAMIC(label SKIP_{}, class_id)
+    }
+    GEN(push constant 0)
+    GEN(return)
+}
+
+bool generator::_try_generate_multiply_constant(uint16_t constant) {
+    // Negative factors are usually cheaper as the positive sequence followed by a negation
+    uint16_t negated = -constant;
+    bool negate = _generate_multiply_sequence(negated, false) + 1 < _generate_multiply_sequence(constant, false);
+    auto factor = negate ? negated : constant;
+
+    if(_generate_multiply_sequence(factor, false) + (negate ? 1 : 0) >= _costs.multiply)
+        return false;
+
+    _generate_multiply_sequence(factor, true);
+    if(negate)
+        GEN(neg)
+
+    return true;
+}
+
+bool generator::_try_generate_divide_constant(uint16_t constant) {
+    // The VM has no right shift, so only unit divisors can avoid Math.divide
+    if(constant == 1)
+        return true;
+
+    if(constant == (uint16_t)-1 && _costs.divide > 1) {
+        GEN(neg)
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Multiplies the value on top of the stack by the given constant using doubling and addition,
+ * temp 1 holds the original value and temp 2 the accumulator while it is being doubled.
+ * Returns the number of VM instructions the sequence needs.
+ */
+uint16_t generator::_generate_multiply_sequence(uint16_t constant, bool emit) {
+    if(constant == 0) {
+        if(emit) {
+            GEN(pop temp 1)
+            GEN(push constant 0)
+        }
+        return 2;
+    } else if(constant == 1) {
+        return 0;
+    }
+
+    int bit = 15;
+    while(((constant >> bit) & 1) == 0)
+        bit--;
+
+    uint16_t cost = 2;
+    if(emit) {
+        GEN(pop temp 1)
+        GEN(push temp 1)
+    }
+
+    // While the accumulator still equals the original value it can be doubled from temp 1
+    bool accumulator_is_value = true;
+    for(bit--; bit >= 0; bit--) {
+        if(accumulator_is_value) {
+            cost += 2;
+            if(emit) {
+                GEN(push temp 1)
+                GEN(add)
+            }
+            accumulator_is_value = false;
+        } else {
+            cost += 4;
+            if(emit) {
+                GEN(pop temp 2)
+                GEN(push temp 2)
+                GEN(push temp 2)
+                GEN(add)
+            }
+        }
+
+        if((constant >> bit) & 1) {
+            cost += 2;
+            if(emit) {
+                GEN(push temp 1)
+                GEN(add)
+            }
+        }
+    }
+
+    return cost;
+}
+
+void generator::_load_that_base(const ast_slot &base) {
+    if(_that_base == base)
+        return;
+
+    GEN_DYNAMIC(push {} {}, symbol::segment_to_string(base.segment), base.index)
+    GEN(pop pointer 1)
+
+    // Fields and statics can change behind our back through aliasing writes, only locals and arguments are cached
+    if(base.segment == symbol::segment_t::LOCAL || base.segment == symbol::segment_t::ARGUMENT)
+        _that_base = base;
+    else
+        _that_base.reset();
+}
+
+/*
+ * Jumps to the label when the condition evaluates to jump_if. Enclosing parentheses and ~ are
+ * folded into jump_if, and a false jump on a comparison with a constant uses the inverse
+ * comparison, x < k is false exactly when x > k - 1.
+ */
+void generator::_generate_branch(const ast_expression &condition, bool jump_if, const char* label, uint32_t label_num) {
+    auto peeled = _peel_condition(condition);
+    jump_if = jump_if != peeled.negated;
+    int16_t inverted;
+
+    if(peeled.term != nullptr) {
+        _generate_term(peeled.term);
+    } else if(!jump_if && _try_invert_comparison(*peeled.expression, inverted)) {
+        _generate_inverted_comparison(*peeled.expression, inverted);
+        jump_if = true;
     } else {
-        callee = _top_level->identifier;
-        GEN(push pointer 0)
-        arg_count++;
+        _generate_expression(*peeled.expression);
     }
 
-    for(const auto& param : call.arguments) {
-        _generate_expression(param);
+    if(!jump_if)
+        GEN(not)
+    GEN_DYNAMIC(if-goto {}_{}, label, label_num)
+}
+
+bool generator::_branch_needs_not(const ast_expression &condition, bool jump_if) {
+    auto peeled = _peel_condition(condition);
+    int16_t inverted;
+    if(jump_if != peeled.negated)
+        return false;
+    return peeled.term != nullptr || !_try_invert_comparison(*peeled.expression, inverted);
+}
+
+generator::condition generator::_peel_condition(const ast_expression &expression) {
+    condition peeled;
+    peeled.expression = &expression;
+
+    while(peeled.expression->secondaries.empty()) {
+        auto term = peeled.expression->primary;
+
+        // ~ is bitwise, it only negates the condition when its operand is 0 or -1
+        while(term->type == ast_term::type_t::UNARY && ((ast_term_unary*)term)->op == ast_unary_op::INVERT
+                && _is_boolean(((ast_term_unary*)term)->term)) {
+            peeled.negated = !peeled.negated;
+            term = ((ast_term_unary*)term)->term;
+        }
+
+        if(term->type != ast_term::type_t::EXPRESSION) {
+            peeled.expression = nullptr;
+            peeled.term = term;
+            break;
+        }
+        peeled.expression = &((ast_term_expression*)term)->expression;
     }
-    GEN_DYNAMIC(call {}.{} {}, callee, call.subroutine_identifier, arg_count)
 
+    return peeled;
 }
 
-std::optional<symbol> generator::_try_get_symbol(const std::string &identifier) {
-    auto global_check = _global_symbols.find(identifier);
-    if(global_check != _global_symbols.end())
-        return global_check->second;
+bool generator::_is_boolean(const ast_expression &expression) {
+    bool boolean = _is_boolean(expression.primary);
+    for(const auto& pair : expression.secondaries) {
+        switch(pair.first) {
+            case ast_binary_op::EQUAL:
+            case ast_binary_op::LESSER:
+            case ast_binary_op::GREATER:
+                boolean = true;
+                break;
+            case ast_binary_op::AND:
+            case ast_binary_op::OR:
+                boolean = boolean && _is_boolean(pair.second);
+                break;
+            default:
+                boolean = false;
+                break;
+        }
+    }
+
+    return boolean;
+}
 
-    auto subroutine_check = _subroutine_symbols.find(identifier);
-    if(subroutine_check != _subroutine_symbols.end())
-        return subroutine_check->second;
+bool generator::_is_boolean(const ast_term *term) {
+    switch(term->type) {
+        case ast_term::type_t::TRUE:
+        case ast_term::type_t::FALSE:
+            return true;
+        case ast_term::type_t::EXPRESSION:
+            return _is_boolean(((ast_term_expression*)term)->expression);
+        case ast_term::type_t::UNARY:
+            return ((ast_term_unary*)term)->op == ast_unary_op::INVERT && _is_boolean(((ast_term_unary*)term)->term);
+        default:
+            return false;
+    }
+}
 
-    return std::nullopt;
+// Finds the constant of the comparison equivalent to the negated trailing comparison
+bool generator::_try_invert_comparison(const ast_expression &expression, int16_t &inverted) {
+    if(expression.secondaries.empty())
+        return false;
+
+    const auto& last = expression.secondaries.back();
+    auto constant = pruner::fold(last.second);
+    if(!constant.has_value())
+        return false;
+
+    int32_t value;
+    if(last.first == ast_binary_op::LESSER)
+        value = constant.value() - 1;
+    else if(last.first == ast_binary_op::GREATER)
+        value = constant.value() + 1;
+    else
+        return false;
+
+    // -32768 cannot be pushed as a constant
+    if(value < -INT16_MAX || value > INT16_MAX)
+        return false;
+
+    inverted = (int16_t)value;
+    return true;
 }
 
+void generator::_generate_inverted_comparison(const ast_expression &expression, int16_t inverted) {
+    _generate_expression(expression, std::prev(expression.secondaries.cend()));
 
-symbol generator::_get_symbol(const std::string& identifier) {
-    auto get = _try_get_symbol(identifier);
-    if(get.has_value())
-        return get.value();
+    GEN_DYNAMIC(push constant {}, std::abs(inverted))
+    if(inverted < 0)
+        GEN(neg)
 
-    throw std::runtime_error(fmt::format("symbol '{}' not found", identifier));
+    if(expression.secondaries.back().first == ast_binary_op::LESSER) {
+        GEN(gt)
+    } else {
+        GEN(lt)
+    }
 }
 
-uint16_t generator::_get_next_static_index() {
-    return _next_static_index.fetch_add(1, std::memory_order_relaxed);
+bool generator::_uses_that(const ast_expression &expression) {
+    if(_uses_that(expression.primary))
+        return true;
+
+    for(const auto& pair : expression.secondaries) {
+        if(_uses_that(pair.second))
+            return true;
+    }
+
+    return false;
 }
 
-void generator::reset() {
-    _next_static_index = 0;
-}
\ No newline at end of file
+bool generator::_uses_that(const ast_term *term) {
+    switch(term->type) {
+        // Array reads overwrite pointer 1. return restores THAT, so a call leaves it alone, but its
+        // arguments may read arrays (they are not inspected) and the callee may assign the static or
+        // field being stored through. Strings are built with calls
+        case ast_term::type_t::ARRAY:
+        case ast_term::type_t::SUBROUTINE_CALL:
+        case ast_term::type_t::STRING:
+            return true;
+        case ast_term::type_t::EXPRESSION:
+            return _uses_that(((ast_term_expression*)term)->expression);
+        case ast_term::type_t::UNARY:
+            return _uses_that(((ast_term_unary*)term)->term);
+        default:
+            return false;
+    }
+}
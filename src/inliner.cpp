@@ -0,0 +1,516 @@
+#include "inliner.hpp"
+#include "pruner.hpp"
+
+// The AST is recursive, disable recursion check
+// NOLINTBEGIN(misc-no-recursion)
+
+void inliner::run(const std::vector<ast_class*>& classes) {
+    _classes.clear();
+
+    for(auto cl : classes) {
+        auto& info = _classes[cl->identifier];
+        info.ast = cl;
+
+        uint32_t next_field_index = 0;
+        for(const auto& var : cl->variables) {
+            for(const auto& identifier : var.identifiers) {
+                info.variable_types[identifier] = var.type;
+                if(!var.is_static)
+                    info.fields[identifier] = next_field_index++;
+            }
+        }
+
+        for(const auto& subroutine : cl->subroutines)
+            info.subroutines[subroutine.identifier] = &subroutine;
+    }
+
+    if(_size_budget == 0)
+        return;
+
+    for(auto cl : classes) {
+        _caller_class = &_classes[cl->identifier];
+        for(auto& subroutine : cl->subroutines) {
+            _caller_subroutine = &subroutine;
+            _inline_statements(subroutine.statements);
+        }
+    }
+
+    _caller_class = nullptr;
+    _caller_subroutine = nullptr;
+}
+
+void inliner::_inline_statements(std::list<ast_statement*>& statements) {
+    for(auto it = statements.begin(); it != statements.end();) {
+        auto statement = *it;
+        switch(statement->type) {
+            case ast_statement::type_t::LET: {
+                auto let_statement = (ast_statement_let*)statement;
+                if(let_statement->array_access.has_value())
+                    _inline_expression(let_statement->array_access.value());
+                _inline_expression(let_statement->assignment);
+                break;
+            }
+            case ast_statement::type_t::IF: {
+                auto if_statement = (ast_statement_if*)statement;
+                _inline_expression(if_statement->conditional);
+                _inline_statements(if_statement->true_statements);
+                _inline_statements(if_statement->false_statements);
+                break;
+            }
+            case ast_statement::type_t::WHILE: {
+                auto while_statement = (ast_statement_while*)statement;
+                _inline_expression(while_statement->conditional);
+                _inline_statements(while_statement->statements);
+                break;
+            }
+            case ast_statement::type_t::DO: {
+                auto do_statement = (ast_statement_do*)statement;
+                _inline_call_arguments(do_statement->call);
+
+                std::list<ast_statement*> replacement;
+                if(_try_inline_do(do_statement->call, replacement)) {
+                    for(auto inlined : replacement)
+                        inlined->span = statement->span;
+                    statements.splice(it, replacement);
+                    it = statements.erase(it);
+                    ast_free(statement);
+                    continue;
+                }
+                break;
+            }
+            case ast_statement::type_t::RETURN:
+                _inline_expression(((ast_statement_return*)statement)->value);
+                break;
+        }
+
+        it++;
+    }
+}
+
+void inliner::_inline_expression(ast_expression &expression) {
+    _inline_term(expression.primary);
+    for(auto& pair : expression.secondaries)
+        _inline_term(pair.second);
+}
+
+void inliner::_inline_term(ast_term*& term) {
+    switch(term->type) {
+        case ast_term::type_t::ARRAY:
+            _inline_expression(((ast_term_array*)term)->access);
+            break;
+        case ast_term::type_t::EXPRESSION:
+            _inline_expression(((ast_term_expression*)term)->expression);
+            break;
+        case ast_term::type_t::UNARY:
+            _inline_term(((ast_term_unary*)term)->term);
+            break;
+        case ast_term::type_t::SUBROUTINE_CALL: {
+            auto& call = ((ast_term_subroutine_call*)term)->call;
+            _inline_call_arguments(call);
+
+            auto replacement = _try_inline_call(call);
+            if(replacement != nullptr) {
+                ast_free(term);
+                term = replacement;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void inliner::_inline_call_arguments(ast_subroutine_call &call) {
+    for(auto& argument : call.arguments)
+        _inline_expression(argument);
+}
+
+ast_term* inliner::_try_inline_call(const ast_subroutine_call &call) {
+    substitution subst;
+    auto callee = _resolve_callee(call, subst);
+    if(callee == nullptr || callee->return_type == "void" || callee->statements.size() != 1)
+        return nullptr;
+
+    auto statement = callee->statements.front();
+    if(statement->type != ast_statement::type_t::RETURN)
+        return nullptr;
+
+    const auto& value = ((ast_statement_return*)statement)->value;
+
+    if(!_bind_arguments(*callee, call, subst))
+        return nullptr;
+
+    uint32_t size = 0;
+    if(!_is_inlinable_expression(value, subst, size) || size > _size_budget)
+        return nullptr;
+
+    _record_inlined(subst);
+    if(value.secondaries.empty())
+        return _clone_term(value.primary, subst);
+
+    return new ast_term_expression(_clone_expression(value, subst));
+}
+
+bool inliner::_try_inline_do(const ast_subroutine_call &call, std::list<ast_statement*>& replacement) {
+    substitution subst;
+    auto callee = _resolve_callee(call, subst);
+    if(callee == nullptr || callee->return_type != "void" || callee->statements.empty() || callee->statements.size() > 2)
+        return false;
+
+    if(callee->statements.back()->type != ast_statement::type_t::RETURN)
+        return false;
+
+    if(callee->statements.size() == 1) {
+        // Empty body, the call only evaluates its arguments, which _bind_arguments requires to be pure
+        if(!_bind_arguments(*callee, call, subst))
+            return false;
+
+        _record_inlined(subst);
+        return true;
+    }
+
+    auto statement = callee->statements.front();
+    if(statement->type != ast_statement::type_t::LET)
+        return false;
+
+    auto let_statement = (ast_statement_let*)statement;
+    if(let_statement->array_access.has_value())
+        return false;
+
+    // The target must outlive the call, so only fields and statics of the callee class qualify
+    const auto& target = let_statement->identifier;
+    bool target_is_field = subst.callee_class->fields.count(target) > 0;
+    if(!target_is_field && (subst.callee_class != _caller_class || subst.callee_class->variable_types.count(target) == 0))
+        return false;
+    if(target_is_field && callee->type == ast_class_subroutine::type_t::FUNCTION)
+        return false;
+
+    if(!_bind_arguments(*callee, call, subst))
+        return false;
+
+    uint32_t size = 1;
+    if(!_is_inlinable_expression(let_statement->assignment, subst, size) || size > _size_budget)
+        return false;
+
+    auto inlined = new ast_statement_let();
+    if(subst.receiver != nullptr && target_is_field) {
+        inlined->identifier = *subst.receiver;
+        inlined->array_access = ast_expression(new ast_term_integer(subst.callee_class->fields.at(target)));
+    } else {
+        inlined->identifier = target;
+    }
+    inlined->assignment = _clone_expression(let_statement->assignment, subst);
+
+    _record_inlined(subst);
+    replacement.push_back(inlined);
+    return true;
+}
+
+void inliner::_record_inlined(const substitution &subst) {
+    // The copied body may hold code already inlined into the callee from further classes
+    const ast_class* callee = subst.callee_class->ast;
+    auto& inlined = _caller_class->ast->inlined_classes;
+    if(callee == _caller_class->ast)
+        return;
+
+    inlined.insert(callee->identifier);
+    inlined.insert(callee->inlined_classes.begin(), callee->inlined_classes.end());
+}
+
+const ast_class_subroutine* inliner::_resolve_callee(const ast_subroutine_call &call, inliner::substitution &subst) {
+    const class_info* callee_class;
+    auto expected_type = ast_class_subroutine::type_t::METHOD;
+
+    if(!call.callee_identifier.has_value()) {
+        if(_caller_subroutine->type == ast_class_subroutine::type_t::FUNCTION)
+            return nullptr;
+
+        callee_class = _caller_class;
+    } else {
+        auto class_name = call.callee_identifier.value();
+        auto variable_type = _variable_type(class_name);
+        if(variable_type.has_value()) {
+            class_name = variable_type.value();
+            subst.receiver = &call.callee_identifier.value();
+        } else {
+            expected_type = ast_class_subroutine::type_t::FUNCTION;
+        }
+
+        auto class_check = _classes.find(class_name);
+        if(class_check == _classes.end())
+            return nullptr;
+
+        callee_class = &class_check->second;
+    }
+
+    // A skimmed body is unknown, the compiler parses every body a regenerated class can reach
+    auto subroutine_check = callee_class->subroutines.find(call.subroutine_identifier);
+    if(subroutine_check == callee_class->subroutines.end() || subroutine_check->second->type != expected_type || subroutine_check->second->skimmed)
+        return nullptr;
+
+    subst.callee_class = callee_class;
+    return subroutine_check->second;
+}
+
+bool inliner::_bind_arguments(const ast_class_subroutine &callee, const ast_subroutine_call &call, inliner::substitution &subst) {
+    if(callee.parameters.size() != call.arguments.size())
+        return false;
+
+    auto argument = call.arguments.cbegin();
+    for(const auto& parameter : callee.parameters) {
+        if(!_is_pure_expression(*argument))
+            return false;
+
+        // Arguments are substituted at every use, so only duplicate ones that are free to evaluate
+        uint32_t uses = 0;
+        for(const auto& statement : callee.statements) {
+            if(statement->type == ast_statement::type_t::RETURN)
+                uses += _count_uses(((ast_statement_return*)statement)->value, parameter.identifier);
+            else if(statement->type == ast_statement::type_t::LET)
+                uses += _count_uses(((ast_statement_let*)statement)->assignment, parameter.identifier);
+        }
+
+        if(uses > 1 && !_is_trivial_expression(*argument))
+            return false;
+
+        subst.arguments[parameter.identifier] = &(*argument);
+        argument++;
+    }
+
+    return true;
+}
+
+std::optional<std::string> inliner::_variable_type(const std::string &identifier) const {
+    for(const auto& parameter : _caller_subroutine->parameters) {
+        if(parameter.identifier == identifier)
+            return parameter.type;
+    }
+
+    for(const auto& local : _caller_subroutine->locals) {
+        for(const auto& local_identifier : local.identifiers) {
+            if(local_identifier == identifier)
+                return local.type;
+        }
+    }
+
+    auto class_check = _caller_class->variable_types.find(identifier);
+    if(class_check != _caller_class->variable_types.end())
+        return class_check->second;
+
+    return std::nullopt;
+}
+
+bool inliner::_is_inlinable_expression(const ast_expression &expression, const substitution& subst, uint32_t &size) const {
+    if(!_is_inlinable_term(expression.primary, subst, size))
+        return false;
+
+    for(const auto& pair : expression.secondaries) {
+        if(!_is_inlinable_term(pair.second, subst, size))
+            return false;
+    }
+
+    return true;
+}
+
+bool inliner::_is_inlinable_term(const ast_term *term, const substitution& subst, uint32_t &size) const {
+    size++;
+    switch(term->type) {
+        case ast_term::type_t::VARIABLE:
+            return _is_inlinable_identifier(((ast_term_variable*)term)->identifier, subst);
+        case ast_term::type_t::ARRAY: {
+            auto array_term = (ast_term_array*)term;
+
+            // The base must stay a plain identifier in the caller
+            auto argument = subst.arguments.find(array_term->identifier);
+            bool is_parameter = false;
+            if(argument != subst.arguments.end()) {
+                auto arg = argument->second;
+                if(!arg->secondaries.empty() || arg->primary->type != ast_term::type_t::VARIABLE)
+                    return false;
+                is_parameter = true;
+            }
+
+            if(!is_parameter && (subst.receiver != nullptr || !_is_inlinable_identifier(array_term->identifier, subst)))
+                return false;
+
+            return _is_inlinable_expression(array_term->access, subst, size);
+        }
+        case ast_term::type_t::EXPRESSION:
+            return _is_inlinable_expression(((ast_term_expression*)term)->expression, subst, size);
+        case ast_term::type_t::UNARY:
+            return _is_inlinable_term(((ast_term_unary*)term)->term, subst, size);
+        case ast_term::type_t::SUBROUTINE_CALL:
+            return false;
+        default:
+            return true;
+    }
+}
+
+bool inliner::_is_inlinable_identifier(const std::string &identifier, const substitution& subst) const {
+    if(subst.arguments.count(identifier) > 0)
+        return true;
+
+    if(subst.callee_class->fields.count(identifier) > 0)
+        return true;
+
+    // Statics live in the callee's own file, so they are only reachable from the same class
+    return subst.callee_class == _caller_class && subst.callee_class->variable_types.count(identifier) > 0;
+}
+
+ast_expression inliner::_clone_expression(const ast_expression &expression, const substitution& subst) {
+    ast_expression clone(_clone_term(expression.primary, subst));
+    for(const auto& pair : expression.secondaries)
+        clone.secondaries.emplace_back(pair.first, _clone_term(pair.second, subst));
+
+    return clone;
+}
+
+ast_term* inliner::_clone_term(const ast_term *term, const substitution& subst) {
+    switch(term->type) {
+        case ast_term::type_t::INTEGER:
+            return new ast_term_integer(((ast_term_integer*)term)->value);
+        case ast_term::type_t::STRING:
+            return new ast_term_string(((ast_term_string*)term)->value);
+        case ast_term::type_t::THIS:
+            if(subst.receiver != nullptr)
+                return new ast_term_variable(*subst.receiver);
+            return new ast_term(term->type);
+        case ast_term::type_t::VARIABLE:
+            return _clone_identifier(((ast_term_variable*)term)->identifier, subst);
+        case ast_term::type_t::ARRAY: {
+            auto array_term = (ast_term_array*)term;
+            auto clone = new ast_term_array(_clone_expression(array_term->access, subst));
+
+            auto argument = subst.arguments.find(array_term->identifier);
+            if(argument != subst.arguments.end())
+                clone->identifier = ((ast_term_variable*)argument->second->primary)->identifier;
+            else
+                clone->identifier = array_term->identifier;
+
+            return clone;
+        }
+        case ast_term::type_t::EXPRESSION:
+            return new ast_term_expression(_clone_expression(((ast_term_expression*)term)->expression, subst));
+        case ast_term::type_t::UNARY: {
+            auto unary_term = (ast_term_unary*)term;
+            return new ast_term_unary(unary_term->op, _clone_term(unary_term->term, subst));
+        }
+        case ast_term::type_t::SUBROUTINE_CALL: {
+            auto clone = new ast_term_subroutine_call(((ast_term_subroutine_call*)term)->call);
+            for(auto& argument : clone->call.arguments)
+                argument = _clone_expression(argument, subst);
+            return clone;
+        }
+        default:
+            return new ast_term(term->type);
+    }
+}
+
+ast_term* inliner::_clone_identifier(const std::string &identifier, const substitution& subst) {
+    auto argument = subst.arguments.find(identifier);
+    if(argument != subst.arguments.end()) {
+        const substitution identity;
+        if(argument->second->secondaries.empty())
+            return _clone_term(argument->second->primary, identity);
+
+        return new ast_term_expression(_clone_expression(*argument->second, identity));
+    }
+
+    if(subst.receiver != nullptr) {
+        auto field = subst.callee_class->fields.find(identifier);
+        if(field != subst.callee_class->fields.end()) {
+            auto access = new ast_term_array(ast_expression(new ast_term_integer(field->second)));
+            access->identifier = *subst.receiver;
+            return access;
+        }
+    }
+
+    return new ast_term_variable(identifier);
+}
+
+/*
+ * * and / call Math.multiply and Math.divide, which may raise Sys.error, unless the generator
+ * replaces them: a product with a constant factor, a quotient by 1 or -1.
+ */
+bool inliner::_is_pure_expression(const ast_expression &expression) {
+    if(!_is_pure_term(expression.primary))
+        return false;
+
+    for(auto pair = expression.secondaries.cbegin(); pair != expression.secondaries.cend(); pair++) {
+        if(!_is_pure_term(pair->second))
+            return false;
+
+        auto constant = pruner::fold(pair->second);
+        if(pair->first == ast_binary_op::MULTIPLY && !constant.has_value()
+                && (pair != expression.secondaries.cbegin() || !pruner::fold(expression.primary).has_value()))
+            return false;
+        if(pair->first == ast_binary_op::DIVIDE && constant != 1 && constant != -1)
+            return false;
+    }
+
+    return true;
+}
+
+bool inliner::_is_pure_term(const ast_term *term) {
+    switch(term->type) {
+        case ast_term::type_t::STRING:
+        case ast_term::type_t::SUBROUTINE_CALL:
+            return false;
+        case ast_term::type_t::ARRAY:
+            return _is_pure_expression(((ast_term_array*)term)->access);
+        case ast_term::type_t::EXPRESSION:
+            return _is_pure_expression(((ast_term_expression*)term)->expression);
+        case ast_term::type_t::UNARY:
+            return _is_pure_term(((ast_term_unary*)term)->term);
+        default:
+            return true;
+    }
+}
+
+bool inliner::_is_trivial_expression(const ast_expression &expression) {
+    if(!expression.secondaries.empty())
+        return false;
+
+    auto term = expression.primary;
+    if(term->type == ast_term::type_t::UNARY)
+        term = ((ast_term_unary*)term)->term;
+
+    switch(term->type) {
+        case ast_term::type_t::INTEGER:
+        case ast_term::type_t::NUL:
+        case ast_term::type_t::THIS:
+        case ast_term::type_t::TRUE:
+        case ast_term::type_t::FALSE:
+        case ast_term::type_t::VARIABLE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+uint32_t inliner::_count_uses(const ast_expression &expression, const std::string &identifier) {
+    uint32_t uses = _count_uses(expression.primary, identifier);
+    for(const auto& pair : expression.secondaries)
+        uses += _count_uses(pair.second, identifier);
+
+    return uses;
+}
+
+uint32_t inliner::_count_uses(const ast_term *term, const std::string &identifier) {
+    switch(term->type) {
+        case ast_term::type_t::VARIABLE:
+            return ((ast_term_variable*)term)->identifier == identifier ? 1 : 0;
+        case ast_term::type_t::ARRAY: {
+            auto array_term = (ast_term_array*)term;
+            return (array_term->identifier == identifier ? 1 : 0) + _count_uses(array_term->access, identifier);
+        }
+        case ast_term::type_t::EXPRESSION:
+            return _count_uses(((ast_term_expression*)term)->expression, identifier);
+        case ast_term::type_t::UNARY:
+            return _count_uses(((ast_term_unary*)term)->term, identifier);
+        default:
+            return 0;
+    }
+}
+
+// NOLINTEND(misc-no-recursion)
@@ -0,0 +1,89 @@
+#include "jackc.hpp"
+#include "tokenizer.hpp"
+#include "lexer.hpp"
+#include "pipeline.hpp"
+#include "resolver.hpp"
+#include "vm.hpp"
+#include "bytecode.hpp"
+
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+// Everything one source needs on its way through the pipeline
+struct jackc_unit {
+    const jackc::source* source = nullptr;
+    ::tokenizer tokenizer;
+    ::lexer lexer;
+    ::resolver resolver;
+    ::generator generator;
+};
+
+jackc::result jackc::compile(const std::vector<source> &sources, const options &options) {
+    result result;
+
+    std::vector<std::unique_ptr<jackc_unit>> units;
+    units.reserve(sources.size());
+    for(const auto& source : sources) {
+        auto& u = units.emplace_back(std::make_unique<jackc_unit>());
+        u->source = &source;
+        u->generator.set_cost_model(options.costs);
+    }
+
+    // Runs one step of every unit, a step that fails leaves a diagnostic for its source
+    auto run_step = [&units, &result](auto step) {
+        for(auto& u : units) {
+            try {
+                step(*u);
+            } catch(const std::runtime_error& e) {
+                result.diagnostics.push_back({u->source->name, e.what()});
+            }
+        }
+        return result.diagnostics.empty();
+    };
+
+    bool parsed = run_step([&options](jackc_unit& u) {
+        u.tokenizer.run(u.source->code);
+        u.lexer.set_max_nesting(options.max_nesting);
+        u.lexer.run(u.tokenizer);
+    });
+    if(!parsed)
+        return result;
+
+    std::vector<ast_class*> classes;
+    classes.reserve(units.size());
+    uint64_t program_statics = 0;
+    bool within_limits = run_step([&classes, &program_statics](jackc_unit& u) {
+        classes.push_back(u.lexer.get_class());
+        program_statics += resolver::count_statics(*u.lexer.get_class());
+        resolver::check_program_statics(program_statics);
+    });
+    if(!within_limits)
+        return result;
+
+    bool generated = pipeline::run(classes, options.inline_budget, [&run_step](pipeline::phase_t phase) {
+        if(phase == pipeline::phase_t::RESOLVE)
+            return run_step([](jackc_unit& u) { pipeline::resolve(u.resolver, u.lexer.get_class()); });
+        return run_step([](jackc_unit& u) { pipeline::generate(&u.generator, u.lexer.get_class()); });
+    });
+    if(!generated)
+        return result;
+
+    result.outputs.reserve(units.size());
+    for(auto& u : units) {
+        output out;
+        out.class_name = u->lexer.get_class()->identifier;
+
+        if(options.output_format == output_format_t::BINARY) {
+            std::ostringstream binary(std::ios::binary);
+            bytecode::write(bytecode::encode(vm_instruction::parse_all(u->generator.get_vm_code())), binary);
+            out.code = binary.str();
+        } else {
+            out.code = u->generator.get_vm_code();
+        }
+
+        result.outputs.push_back(std::move(out));
+    }
+
+    return result;
+}
@@ -1,27 +1,46 @@
 #include "lexer.hpp"
 
-// This is a recursive parser, disable recursion check
+// Statements are parsed recursively (expressions are not), disable recursion check
 // NOLINTBEGIN(misc-no-recursion)
 
+lexer::~lexer() {
+    if(_class != nullptr)
+        ast_free(_class);
+}
+
 void lexer::run(tokenizer &tokenizer) {
+    if(_class != nullptr)
+        ast_free(_class);
+    _class = nullptr;
+
     _tokenizer = &tokenizer;
     _tokenizer->reset();
 
     _class = _parse_class();
 }
 
+void lexer::run(tokenizer &tokenizer, const subroutine_callback &on_subroutine) {
+    _on_subroutine = &on_subroutine;
+    try {
+        run(tokenizer);
+    } catch(...) {
+        _on_subroutine = nullptr;
+        throw;
+    }
+    _on_subroutine = nullptr;
+}
+
 bool lexer::_check_token(token::type_t type) {
     return _tokenizer->peek().type == type;
 }
 
 bool lexer::_check_token(token::type_t type, const token::value_t &value) {
-    auto peek = _tokenizer->peek();
-    bool q = peek.type == type && peek.value == value;
-    return q;
+    const auto& peek = _tokenizer->peek();
+    return peek.type == type && peek.value == value;
 }
 
 bool lexer::_check_subroutine() {
-    auto peek = _tokenizer->peek();
+    const auto& peek = _tokenizer->peek();
     if(peek.type == token::type_t::KEYWORD) {
         auto value = peek.get_value<token::keyword_t>();
         return value == token::keyword_t::FUNCTION || value == token::keyword_t::METHOD || value == token::keyword_t::CONSTRUCTOR;
@@ -30,7 +49,7 @@ bool lexer::_check_subroutine() {
 }
 
 bool lexer::_check_type() {
-    auto peek = _tokenizer->peek();
+    const auto& peek = _tokenizer->peek();
     if(peek.type == token::type_t::KEYWORD) {
         auto value = peek.get_value<token::keyword_t>();
         return value == token::keyword_t::INT || value == token::keyword_t::CHAR || value == token::keyword_t::BOOL;
@@ -41,7 +60,7 @@ bool lexer::_check_type() {
 }
 
 bool lexer::_check_type_voidable() {
-    auto peek = _tokenizer->peek();
+    const auto& peek = _tokenizer->peek();
     if(peek.type == token::type_t::KEYWORD) {
         auto value = peek.get_value<token::keyword_t>();
         return value == token::keyword_t::INT || value == token::keyword_t::CHAR || value == token::keyword_t::BOOL || value == token::keyword_t::VOID;
@@ -52,7 +71,7 @@ bool lexer::_check_type_voidable() {
 }
 
 bool lexer::_check_op() {
-    auto peek = _tokenizer->peek();
+    const auto& peek = _tokenizer->peek();
     if(peek.type == token::type_t::SYMBOL) {
         auto val = peek.get_value<token::symbol_t>();
         return val == '+' || val == '-' || val == '*' || val == '/' || val == '&' || val == '|' || val == '<' || val == '>' || val == '=';
@@ -62,7 +81,7 @@ bool lexer::_check_op() {
 }
 
 bool lexer::_check_unary_op() {
-    auto peek = _tokenizer->peek();
+    const auto& peek = _tokenizer->peek();
     if(peek.type == token::type_t::SYMBOL) {
         auto val = peek.get_value<token::symbol_t>();
         return val == '-' || val == '~';
@@ -72,7 +91,7 @@ bool lexer::_check_unary_op() {
 }
 
 bool lexer::_check_class_variable_declaration() {
-    auto peek = _tokenizer->peek();
+    const auto& peek = _tokenizer->peek();
     if(peek.type == token::type_t::KEYWORD) {
         auto val = peek.get_value<token::keyword_t>();
         return val == token::keyword_t::FIELD || val == token::keyword_t::STATIC;
@@ -89,13 +108,13 @@ token lexer::_expect_token(token::type_t expected_type) {
 }
 
 token lexer::_expect_token(token::type_t expected_type, const token::value_t& expected_value) {
-    auto expected_token = token {
-        .type   = expected_type,
-        .value  = expected_value
-    };
-
-    if(!_check_token(expected_type, expected_value))
+    if(!_check_token(expected_type, expected_value)) {
+        auto expected_token = token {
+            .type   = expected_type,
+            .value  = expected_value
+        };
         throw std::runtime_error("Expected token value '" + token::to_string(expected_token) + "' got '" + token::to_string(_tokenizer->peek()) + "'");
+    }
 
     return _tokenizer->next();
 }
@@ -135,7 +154,8 @@ token lexer::_expect_unary_op() {
 }
 
 ast_class * lexer::_parse_class() {
-    auto cl = new ast_class();
+    // Owned by the lexer from the start, so a syntax error does not leak what was already parsed
+    auto cl = _class = new ast_class();
 
     _expect_token(token::type_t::KEYWORD, token::keyword_t::CLASS);
 
@@ -165,18 +185,26 @@ ast_class * lexer::_parse_class() {
         cl->variables.push_back(var);
     }
 
-    while(_check_subroutine())
-        cl->subroutines.push_back(_parse_class_subroutine_declaration());
+    while(_check_subroutine()) {
+        auto& subroutine = cl->subroutines.emplace_back();
+        _parse_class_subroutine_declaration(subroutine);
+
+        if(_on_subroutine != nullptr) {
+            (*_on_subroutine)(*cl, subroutine);
+            ast_free(subroutine.statements);
+            cl->subroutines.pop_back();
+        }
+    }
 
     _expect_token(token::type_t::SYMBOL, '}');
 
     return cl;
 }
 
-ast_class_subroutine lexer::_parse_class_subroutine_declaration() {
-    ast_class_subroutine subroutine;
-
-    auto kw = _expect_subroutine().get_value<token::keyword_t>();
+void lexer::_parse_class_subroutine_declaration(ast_class_subroutine& subroutine) {
+    auto subroutine_token = _expect_subroutine();
+    subroutine.span.begin = subroutine_token.offset;
+    auto kw = subroutine_token.get_value<token::keyword_t>();
     switch(kw) {
         case token::keyword_t::CONSTRUCTOR:
             subroutine.type = ast_class_subroutine::type_t::CONSTRUCTOR;
@@ -230,33 +258,61 @@ ast_class_subroutine lexer::_parse_class_subroutine_declaration() {
         subroutine.locals.push_back(local);
     }
 
-    _parse_statements(subroutine.statements);
+    if(_skim) {
+        subroutine.body.begin = _tokenizer->skip_block();
+        subroutine.skimmed = true;
+    } else {
+        subroutine.body.begin = _tokenizer->peek().offset;
+        _parse_statements(subroutine.statements);
+    }
 
+    subroutine.body.end = _tokenizer->peek().offset;
     _expect_token(token::type_t::SYMBOL, '}');
+    subroutine.span.end = _tokenizer->get_consumed_end();
+}
 
-    return subroutine;
+void lexer::parse_body(ast_class_subroutine &subroutine) {
+    if(!subroutine.skimmed)
+        return;
+
+    _tokenizer->seek(subroutine.body.begin);
+    _parse_statements(subroutine.statements);
+    // Brace matching found the end of the body, the statements must end there too
+    if(!_check_token(token::type_t::SYMBOL, '}'))
+        _expect_token(token::type_t::SYMBOL, '}');
+    if(_tokenizer->peek().offset != subroutine.body.end)
+        throw std::runtime_error("Unbalanced braces in the body of " + subroutine.identifier);
+    subroutine.skimmed = false;
 }
 
 ast_statement *lexer::_parse_statement() {
-    if(_check_token(token::type_t::KEYWORD)) {
-        auto val = _tokenizer->peek().get_value<token::keyword_t>();
-        switch(val) {
-            case token::keyword_t::LET:
-                return _parse_let_statement();
-            case token::keyword_t::IF:
-                return _parse_if_statement();
-            case token::keyword_t::WHILE:
-                return _parse_while_statement();
-            case token::keyword_t::DO:
-                return _parse_do_statement();
-            case token::keyword_t::RETURN:
-                return _parse_return_statement();
-            default:
-                break;
-        }
+    if(!_check_token(token::type_t::KEYWORD))
+        return nullptr;
+
+    auto begin = _tokenizer->peek().offset;
+    ast_statement* statement;
+    switch(_tokenizer->peek().get_value<token::keyword_t>()) {
+        case token::keyword_t::LET:
+            statement = _parse_let_statement();
+            break;
+        case token::keyword_t::IF:
+            statement = _parse_if_statement();
+            break;
+        case token::keyword_t::WHILE:
+            statement = _parse_while_statement();
+            break;
+        case token::keyword_t::DO:
+            statement = _parse_do_statement();
+            break;
+        case token::keyword_t::RETURN:
+            statement = _parse_return_statement();
+            break;
+        default:
+            return nullptr;
     }
 
-    return nullptr;
+    statement->span = {begin, _tokenizer->get_consumed_end()};
+    return statement;
 }
 
 ast_statement_let * lexer::_parse_let_statement() {
@@ -342,21 +398,148 @@ ast_statement_return * lexer::_parse_return_statement() {
     return ret_statement;
 }
 
+/*
+ * Parenthesized, indexed, argument and unary subterms are parsed with an explicit stack of the
+ * enclosing expressions instead of recursing, so deeply nested input cannot overflow the call stack.
+ * Nesting beyond _max_nesting is reported as an error, later passes still recurse over the tree.
+ */
 ast_expression lexer::_parse_expression() {
-    ast_expression expr(_parse_term());
+    struct frame {
+        enum struct kind_t {
+            TOP,
+            PARENTHESES,
+            ARRAY,
+            CALL
+        };
+
+        kind_t kind;
+        ast_expression expression;
+        // Precedes the term being parsed unless it is the primary
+        ast_binary_op op = ast_binary_op::ADD;
+        // Applied to the term being parsed once it is complete, innermost last
+        std::vector<ast_unary_op> unary_ops;
+        // ARRAY: the indexed variable, CALL: the call whose arguments are being parsed
+        std::string identifier;
+        ast_subroutine_call call;
+
+        explicit frame(kind_t kind) : kind(kind) {};
+    };
 
-    while(_check_op()) {
-        ast_expression::op_term_t term;
-        term.first = _binary_op_from_token(_expect_op());
-        term.second = _parse_term();
+    std::vector<frame> frames;
+    frames.emplace_back(frame::kind_t::TOP);
+    uint32_t depth = 0;
 
-        expr.secondaries.push_back(term);
-    }
+    auto enter = [this, &depth] {
+        if(++depth > _max_nesting)
+            throw std::runtime_error("Expression nested deeper than " + std::to_string(_max_nesting) + " levels");
+    };
 
-    return expr;
+    try {
+        while(true) {
+            ast_term* term = nullptr;
+
+            if(_check_unary_op()) {
+                enter();
+                frames.back().unary_ops.push_back(_unary_op_from_token(_expect_unary_op()));
+                continue;
+            } else if(_check_token(token::type_t::SYMBOL, '(')) {
+                _expect_token(token::type_t::SYMBOL, '(');
+                enter();
+                frames.emplace_back(frame::kind_t::PARENTHESES);
+                continue;
+            } else if(_check_token(token::type_t::IDENTIFIER)) {
+                const auto& peek = _tokenizer->peek(1);
+                bool is_call = peek.type == token::type_t::SYMBOL
+                        && (peek.get_value<token::symbol_t>() == '(' || peek.get_value<token::symbol_t>() == '.');
+
+                if(is_call) {
+                    auto call = _parse_subroutine_call_head();
+                    if(!_check_token(token::type_t::SYMBOL, ')')) {
+                        enter();
+                        frames.emplace_back(frame::kind_t::CALL).call = std::move(call);
+                        continue;
+                    }
+
+                    _expect_token(token::type_t::SYMBOL, ')');
+                    term = new ast_term_subroutine_call(std::move(call));
+                } else {
+                    auto identifier = token::to_string(_expect_token(token::type_t::IDENTIFIER));
+                    if(_check_token(token::type_t::SYMBOL, '[')) {
+                        _expect_token(token::type_t::SYMBOL, '[');
+                        enter();
+                        frames.emplace_back(frame::kind_t::ARRAY).identifier = std::move(identifier);
+                        continue;
+                    }
+
+                    term = new ast_term_variable(identifier);
+                }
+            } else {
+                term = _parse_constant_term();
+            }
+
+            // A complete term is added to its expression, which in turn may complete the enclosing term
+            while(term != nullptr) {
+                auto& top = frames.back();
+                while(!top.unary_ops.empty()) {
+                    term = new ast_term_unary(top.unary_ops.back(), term);
+                    top.unary_ops.pop_back();
+                    depth--;
+                }
+
+                if(top.expression.primary == nullptr)
+                    top.expression.primary = term;
+                else
+                    top.expression.secondaries.emplace_back(top.op, term);
+                term = nullptr;
+
+                if(_check_op()) {
+                    top.op = _binary_op_from_token(_expect_op());
+                    break;
+                }
+
+                switch(top.kind) {
+                    case frame::kind_t::TOP:
+                        return std::move(top.expression);
+                    case frame::kind_t::PARENTHESES:
+                        _expect_token(token::type_t::SYMBOL, ')');
+                        term = new ast_term_expression(std::move(top.expression));
+                        break;
+                    case frame::kind_t::ARRAY: {
+                        _expect_token(token::type_t::SYMBOL, ']');
+                        auto array = new ast_term_array(std::move(top.expression));
+                        array->identifier = std::move(top.identifier);
+                        term = array;
+                        break;
+                    }
+                    case frame::kind_t::CALL:
+                        top.call.arguments.push_back(std::move(top.expression));
+                        top.expression = ast_expression();
+                        if(_check_token(token::type_t::SYMBOL, ',')) {
+                            // The frame stays for the next argument
+                            _expect_token(token::type_t::SYMBOL, ',');
+                            continue;
+                        }
+
+                        _expect_token(token::type_t::SYMBOL, ')');
+                        term = new ast_term_subroutine_call(std::move(top.call));
+                        break;
+                }
+
+                frames.pop_back();
+                depth--;
+            }
+        }
+    } catch(...) {
+        for(auto& frame : frames) {
+            ast_free(frame.expression);
+            ast_free(frame.call);
+        }
+        throw;
+    }
 }
 
-ast_subroutine_call lexer::_parse_subroutine_call() {
+// Parses up to and including the opening parenthesis of the arguments
+ast_subroutine_call lexer::_parse_subroutine_call_head() {
     ast_subroutine_call call(token::to_string(_expect_token(token::type_t::IDENTIFIER)));
 
     if(_check_token(token::type_t::SYMBOL, '.')) {
@@ -368,30 +551,40 @@ ast_subroutine_call lexer::_parse_subroutine_call() {
 
     _expect_token(token::type_t::SYMBOL, '(');
 
-    if(!_check_token(token::type_t::SYMBOL, ')')) {
-        call.arguments.push_back(_parse_expression());
+    return call;
+}
 
-        while (_check_token(token::type_t::SYMBOL, ',')) {
-            _expect_token(token::type_t::SYMBOL, ',');
+ast_subroutine_call lexer::_parse_subroutine_call() {
+    auto call = _parse_subroutine_call_head();
 
+    try {
+        if(!_check_token(token::type_t::SYMBOL, ')')) {
             call.arguments.push_back(_parse_expression());
+
+            while (_check_token(token::type_t::SYMBOL, ',')) {
+                _expect_token(token::type_t::SYMBOL, ',');
+
+                call.arguments.push_back(_parse_expression());
+            }
         }
-    }
 
-    _expect_token(token::type_t::SYMBOL, ')');
+        _expect_token(token::type_t::SYMBOL, ')');
+    } catch(...) {
+        ast_free(call);
+        throw;
+    }
 
     return call;
 }
 
-ast_term * lexer::_parse_term() {
-    ast_term* term;
+ast_term * lexer::_parse_constant_term() {
     if(_check_token(token::type_t::INT_CONSTANT)) {
         auto value = _expect_token(token::type_t::INT_CONSTANT).get_value<token::int_constant_t>();
-        term = new ast_term_integer(value);
+        return new ast_term_integer(value);
 
     } else if(_check_token(token::type_t::STRING_CONSTANT)) {
         auto value = _expect_token(token::type_t::STRING_CONSTANT).get_value<token::string_constant_t>();
-        term = new ast_term_string(value);
+        return new ast_term_string(value);
 
     } else if(_check_token(token::type_t::KEYWORD, token::keyword_t::FALSE)
             || _check_token(token::type_t::KEYWORD, token::keyword_t::TRUE)
@@ -415,39 +608,10 @@ ast_term * lexer::_parse_term() {
             default:
                 break;
         }
-        term = new ast_term(type);
-
-    } else if(_check_token(token::type_t::IDENTIFIER)) {
-        auto peek = _tokenizer->peek(1);
-        if(peek.type == token::type_t::SYMBOL && peek.get_value<token::symbol_t>() == '(' || peek.get_value<token::symbol_t>() == '.') {
-            term = new ast_term_subroutine_call(_parse_subroutine_call());
-        } else {
-            auto identifier = token::to_string(_expect_token(token::type_t::IDENTIFIER));
-
-            if(_check_token(token::type_t::SYMBOL, '[')) {
-                _expect_token(token::type_t::SYMBOL, '[');
-
-                auto array = new ast_term_array(_parse_expression());
-                array->identifier = identifier;
-                term = array;
-
-                _expect_token(token::type_t::SYMBOL, ']');
-            } else {
-                term = new ast_term_variable(identifier);
-            }
-        }
-    } else if(_check_token(token::type_t::SYMBOL, '(')) {
-        _expect_token(token::type_t::SYMBOL, '(');
-
-        term = new ast_term_expression(_parse_expression());
-
-        _expect_token(token::type_t::SYMBOL, ')');
-    } else if(_check_unary_op()) {
-        term = new ast_term_unary(_unary_op_from_token(_expect_unary_op()), _parse_term());
-    } else
-        throw std::runtime_error("No valid term could be found");
+        return new ast_term(type);
+    }
 
-    return term;
+    throw std::runtime_error("No valid term could be found");
 }
 
 void lexer::_parse_statements(std::list<ast_statement *> &statements) {
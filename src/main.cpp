@@ -1,23 +1,96 @@
 #include "compiler.hpp"
 
 #include <iostream>
+#include <limits>
+#include <optional>
+
+static bool starts_with(const std::string& str, const std::string& prefix) {
+    return str.rfind(prefix, 0) == 0;
+}
+
+// The value of a --name=value option, a whole number from 0 to max
+static uint32_t parse_count(const std::string& arg, uint32_t max) {
+    auto value = arg.substr(arg.find('=') + 1);
+    size_t end;
+    auto count = std::stoll(value, &end);
+    if(end != value.size() || count < 0 || count > max)
+        throw std::out_of_range(arg);
+
+    return count;
+}
 
 int main(int argc, char** argv) {
-    if(argc < 2) {
+    compiler compiler;
+    std::optional<std::string> source_path;
+    bool print_stats = false;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        try {
+            if(arg == "--asm") {
+                compiler.set_output_format(compiler::output_format_t::ASM);
+            } else if(arg == "--c") {
+                compiler.set_output_format(compiler::output_format_t::C);
+            } else if(arg == "--binary") {
+                compiler.set_output_format(compiler::output_format_t::BINARY);
+            } else if(arg == "--depfile") {
+                compiler.set_write_depfiles(true);
+            } else if(arg == "--incremental") {
+                compiler.set_incremental(true);
+            } else if(arg == "--instrument") {
+                compiler.set_instrument(true, false);
+            } else if(arg == "--instrument=loops") {
+                compiler.set_instrument(true, true);
+            } else if(arg == "--no-io-uring") {
+                file_io::set_use_uring(false);
+            } else if(arg == "--source-map") {
+                compiler.set_write_source_maps(true);
+            } else if(arg == "--stream") {
+                compiler.set_streaming(true);
+            } else if(arg == "--stats") {
+                print_stats = true;
+            } else if(starts_with(arg, "--inline-budget=")) {
+                compiler.set_inline_budget(parse_count(arg, std::numeric_limits<uint16_t>::max()));
+            } else if(starts_with(arg, "--trace=")) {
+                compiler.set_trace_path(arg.substr(arg.find('=') + 1));
+            } else if(starts_with(arg, "--max-nesting=")) {
+                compiler.set_max_nesting(parse_count(arg, std::numeric_limits<uint32_t>::max()));
+            } else if(starts_with(arg, "--")) {
+                std::cerr << "Unknown option '" << arg << "'" << std::endl;
+                return 1;
+            } else if(source_path.has_value()) {
+                std::cerr << "Only 1 source path allowed" << std::endl;
+                return 1;
+            } else {
+                source_path = arg;
+            }
+        } catch(const std::logic_error&) {
+            std::cerr << "Invalid value for option '" << arg << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    if(!source_path.has_value()) {
         std::cerr << "A source path must be provided" << std::endl;
         return 1;
-    } else if(argc > 2) {
-        std::cerr << "Only 1 argument allowed" << std::endl;
     }
 
-    compiler compiler;
-
     try {
-        compiler.run(argv[1]);
+        compiler.run(source_path.value());
     } catch(const compiler::error& e) {
         std::cerr << e.what() << std::endl;
         return 1;
     }
 
+    if(print_stats) {
+        for(const auto& phase : compiler.get_phase_stats()) {
+            std::cerr << phase.name << "\t" << phase.milliseconds << " ms";
+            if(allocation_counter::enabled())
+                std::cerr << "\t" << phase.allocations << " allocations";
+            std::cerr << std::endl;
+        }
+    }
+
     return 0;
-}
\ No newline at end of file
+}
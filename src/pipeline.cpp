@@ -0,0 +1,23 @@
+#include "pipeline.hpp"
+#include "inliner.hpp"
+#include "pruner.hpp"
+
+bool pipeline::run(const std::vector<ast_class*> &classes, uint16_t inline_budget, const std::function<bool(phase_t)> &run_phase) {
+    // Callees are measured for inlining without their dead tails
+    for(ast_class* cl : classes)
+        pruner().run(cl);
+    inliner(inline_budget).run(classes);
+
+    return run_phase(phase_t::RESOLVE) && run_phase(phase_t::GENERATE);
+}
+
+void pipeline::resolve(resolver &resolver, ast_class *cl) {
+    resolver.run(cl);
+}
+
+void pipeline::generate(generator *generator, ast_class *cl) {
+    // Again, for the constant conditions inlining created
+    pruner().run(cl);
+    if(generator != nullptr)
+        generator->run(cl);
+}
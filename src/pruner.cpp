@@ -0,0 +1,148 @@
+#include "pruner.hpp"
+
+// The AST is recursive, disable recursion check
+// NOLINTBEGIN(misc-no-recursion)
+
+void pruner::run(ast_class *ast) {
+    for(auto& subroutine : ast->subroutines)
+        run(subroutine);
+}
+
+void pruner::run(ast_class_subroutine &subroutine) {
+    _prune(subroutine.statements);
+}
+
+bool pruner::_prune(std::list<ast_statement *> &statements) {
+    for(auto it = statements.begin(); it != statements.end(); ) {
+        auto statement = *it;
+        bool terminates = false;
+
+        switch(statement->type) {
+            case ast_statement::type_t::IF: {
+                auto if_statement = (ast_statement_if*)statement;
+                auto condition = fold(if_statement->conditional);
+                if(condition.has_value()) {
+                    // The taken branch replaces the if and is pruned as part of this list
+                    auto& taken = condition.value() != 0 ? if_statement->true_statements : if_statement->false_statements;
+                    statements.splice(std::next(it), taken);
+                    ast_free(statement);
+                    it = statements.erase(it);
+                    continue;
+                }
+
+                bool true_terminates = _prune(if_statement->true_statements);
+                bool false_terminates = _prune(if_statement->false_statements);
+                terminates = true_terminates && false_terminates;
+                break;
+            }
+            case ast_statement::type_t::WHILE: {
+                auto while_statement = (ast_statement_while*)statement;
+                auto condition = fold(while_statement->conditional);
+                // The loop runs while its condition is -1, any other constant never enters it
+                if(condition.has_value() && condition != -1) {
+                    ast_free(statement);
+                    it = statements.erase(it);
+                    continue;
+                }
+
+                _prune(while_statement->statements);
+                terminates = condition == -1;
+                break;
+            }
+            case ast_statement::type_t::RETURN:
+                terminates = true;
+                break;
+            default:
+                break;
+        }
+
+        it++;
+        if(terminates) {
+            for(auto dead = it; dead != statements.end(); dead++)
+                ast_free(*dead);
+            statements.erase(it, statements.end());
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::optional<int16_t> pruner::fold(const ast_expression &expression) {
+    auto value = fold(expression.primary);
+
+    // Jack has no precedence, operators apply strictly left to right
+    for(const auto& pair : expression.secondaries) {
+        if(!value.has_value())
+            return std::nullopt;
+
+        auto operand = fold(pair.second);
+        if(!operand.has_value())
+            return std::nullopt;
+
+        auto left = (uint16_t)value.value();
+        auto right = (uint16_t)operand.value();
+        switch(pair.first) {
+            case ast_binary_op::ADD:
+                value = (int16_t)(uint16_t)(left + right);
+                break;
+            case ast_binary_op::SUBTRACT:
+                value = (int16_t)(uint16_t)(left - right);
+                break;
+            case ast_binary_op::MULTIPLY:
+                // uint16_t operands promote to int, where 65535 * 65535 overflows
+                value = (int16_t)(uint16_t)((uint32_t)left * right);
+                break;
+            case ast_binary_op::DIVIDE:
+                // Left to Math.divide, which reports division by zero at run time
+                if(operand.value() == 0)
+                    return std::nullopt;
+                value = (int16_t)(uint16_t)((int32_t)value.value() / operand.value());
+                break;
+            case ast_binary_op::AND:
+                value = (int16_t)(left & right);
+                break;
+            case ast_binary_op::OR:
+                value = (int16_t)(left | right);
+                break;
+            case ast_binary_op::LESSER:
+                value = value.value() < operand.value() ? -1 : 0;
+                break;
+            case ast_binary_op::GREATER:
+                value = value.value() > operand.value() ? -1 : 0;
+                break;
+            case ast_binary_op::EQUAL:
+                value = value.value() == operand.value() ? -1 : 0;
+                break;
+        }
+    }
+
+    return value;
+}
+
+std::optional<int16_t> pruner::fold(const ast_term *term) {
+    switch(term->type) {
+        case ast_term::type_t::INTEGER:
+            return (int16_t)((const ast_term_integer*)term)->value;
+        case ast_term::type_t::TRUE:
+            return -1;
+        case ast_term::type_t::FALSE:
+        case ast_term::type_t::NUL:
+            return 0;
+        case ast_term::type_t::EXPRESSION:
+            return fold(((const ast_term_expression*)term)->expression);
+        case ast_term::type_t::UNARY: {
+            auto unary_term = (const ast_term_unary*)term;
+            auto operand = fold(unary_term->term);
+            if(!operand.has_value())
+                return std::nullopt;
+
+            auto bits = (uint16_t)operand.value();
+            return (int16_t)(uint16_t)(unary_term->op == ast_unary_op::NEGATE ? -bits : ~bits);
+        }
+        default:
+            return std::nullopt;
+    }
+}
+
+// NOLINTEND(misc-no-recursion)
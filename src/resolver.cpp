@@ -0,0 +1,212 @@
+#include "resolver.hpp"
+
+#include <fmt/format.h>
+
+#include <stdexcept>
+
+// The AST is recursive, disable recursion check
+// NOLINTBEGIN(misc-no-recursion)
+
+void resolver::run(ast_class *ast) {
+    declare_class(ast);
+
+    for(auto& subroutine : ast->subroutines)
+        resolve_subroutine(subroutine);
+}
+
+void resolver::declare_class(ast_class *ast) {
+    _global_symbols.clear();
+    _referenced_classes.clear();
+    _next_this_index = 0;
+    _top_level = ast;
+
+    // Inlined bodies depend on the layout of the class they came from
+    for(const auto& inlined : ast->inlined_classes)
+        _reference(inlined);
+
+    uint32_t next_static_index = 0;
+    for(const auto& var : ast->variables) {
+        _reference(var.type);
+        for(const auto& identifier : var.identifiers) {
+            if(_global_symbols.count(identifier) > 0)
+                throw std::runtime_error("duplicate identifier '" + identifier + "'");
+
+            if(var.is_static) {
+                auto index = next_static_index++;
+                _check_limit(index + 1, MAX_STATIC_COUNT, fmt::format("static variables in class {}", ast->identifier));
+                _global_symbols[identifier] = symbol(symbol::segment_t::STATIC, index, var.type);
+            } else {
+                _check_limit(_next_this_index + 1, MAX_CONSTANT, fmt::format("fields in class {}", ast->identifier));
+                _global_symbols[identifier] = symbol(symbol::segment_t::THIS, _next_this_index++, var.type);
+            }
+        }
+    }
+    ast->field_count = _next_this_index;
+}
+
+void resolver::resolve_subroutine(ast_class_subroutine &subroutine) {
+    _subroutine_symbols.clear();
+    _next_local_index = 0;
+    _next_arg_index = subroutine.type == ast_class_subroutine::type_t::METHOD ? 1 : 0;
+    _reference(subroutine.return_type);
+
+    for(const auto& local : subroutine.locals) {
+        _reference(local.type);
+        for(const auto& identifier : local.identifiers) {
+            if(_global_symbols.count(identifier) > 0 || _subroutine_symbols.count(identifier) > 0)
+                throw std::runtime_error("duplicate identifier '" + identifier + "'");
+
+            _check_limit(_next_local_index + 1, MAX_CONSTANT, fmt::format("locals in {}.{}", _top_level->identifier, subroutine.identifier));
+            _subroutine_symbols[identifier] = symbol(symbol::segment_t::LOCAL, _next_local_index++, local.type);
+        }
+    }
+    subroutine.local_count = _next_local_index;
+
+    for(const auto& arg : subroutine.parameters) {
+        _reference(arg.type);
+        if(_global_symbols.count(arg.identifier) > 0 || _subroutine_symbols.count(arg.identifier) > 0)
+            throw std::runtime_error(fmt::format("duplicate identifier '{}'", arg.identifier));
+
+        _check_limit(_next_arg_index + 1, MAX_CONSTANT, fmt::format("parameters of {}.{}", _top_level->identifier, subroutine.identifier));
+        _subroutine_symbols[arg.identifier] = symbol(symbol::segment_t::ARGUMENT, _next_arg_index++, arg.type);
+    }
+
+    _resolve_statements(subroutine.statements);
+}
+
+void resolver::_resolve_statements(const std::list<ast_statement *> &statements) {
+    for(const auto& statement : statements) {
+        switch(statement->type) {
+            case ast_statement::type_t::IF: {
+                auto if_statement = (ast_statement_if*)statement;
+                _resolve_expression(if_statement->conditional);
+                _resolve_statements(if_statement->true_statements);
+                _resolve_statements(if_statement->false_statements);
+                break;
+            }
+            case ast_statement::type_t::LET: {
+                auto let_statement = (ast_statement_let*)statement;
+                let_statement->slot = _get_slot(let_statement->identifier);
+                if(let_statement->array_access.has_value())
+                    _resolve_expression(let_statement->array_access.value());
+                _resolve_expression(let_statement->assignment);
+                break;
+            }
+            case ast_statement::type_t::WHILE: {
+                auto while_statement = (ast_statement_while*)statement;
+                _resolve_expression(while_statement->conditional);
+                _resolve_statements(while_statement->statements);
+                break;
+            }
+            case ast_statement::type_t::DO:
+                _resolve_subroutine_call(((ast_statement_do*)statement)->call);
+                break;
+            case ast_statement::type_t::RETURN:
+                _resolve_expression(((ast_statement_return*)statement)->value);
+                break;
+        }
+    }
+}
+
+void resolver::_resolve_expression(ast_expression &expression) {
+    _resolve_term(expression.primary);
+    for(auto& pair : expression.secondaries)
+        _resolve_term(pair.second);
+}
+
+void resolver::_resolve_term(ast_term *term) {
+    switch(term->type) {
+        case ast_term::type_t::STRING:
+            _check_limit(((ast_term_string*)term)->value.length(), MAX_CONSTANT, "characters in a string constant");
+            break;
+        case ast_term::type_t::VARIABLE: {
+            auto var_term = (ast_term_variable*)term;
+            var_term->slot = _get_slot(var_term->identifier);
+            break;
+        }
+        case ast_term::type_t::ARRAY: {
+            auto array_term = (ast_term_array*)term;
+            array_term->slot = _get_slot(array_term->identifier);
+            _resolve_expression(array_term->access);
+            break;
+        }
+        case ast_term::type_t::EXPRESSION:
+            _resolve_expression(((ast_term_expression*)term)->expression);
+            break;
+        case ast_term::type_t::UNARY:
+            _resolve_term(((ast_term_unary*)term)->term);
+            break;
+        case ast_term::type_t::SUBROUTINE_CALL:
+            _resolve_subroutine_call(((ast_term_subroutine_call*)term)->call);
+            break;
+        default:
+            break;
+    }
+}
+
+void resolver::_resolve_subroutine_call(ast_subroutine_call &call) {
+    _check_limit(call.arguments.size() + 1, MAX_CONSTANT, fmt::format("arguments in a call to {}", call.subroutine_identifier));
+
+    if(call.callee_identifier.has_value()) {
+        // A callee that names a variable is a method call on that object, otherwise it names a class
+        auto symbol = _try_get_symbol(call.callee_identifier.value());
+        if(symbol != nullptr) {
+            call.callee_class = symbol->type;
+            call.receiver = ast_subroutine_call::receiver_t::VARIABLE;
+            call.receiver_slot = ast_slot{symbol->segment, symbol->index};
+        } else {
+            call.callee_class = call.callee_identifier.value();
+            call.receiver = ast_subroutine_call::receiver_t::NONE;
+        }
+    } else {
+        call.callee_class = _top_level->identifier;
+        call.receiver = ast_subroutine_call::receiver_t::THIS;
+    }
+    _reference(call.callee_class);
+
+    for(auto& argument : call.arguments)
+        _resolve_expression(argument);
+}
+
+const symbol* resolver::_try_get_symbol(const std::string &identifier) {
+    auto global_check = _global_symbols.find(identifier);
+    if(global_check != _global_symbols.end())
+        return &global_check->second;
+
+    auto subroutine_check = _subroutine_symbols.find(identifier);
+    if(subroutine_check != _subroutine_symbols.end())
+        return &subroutine_check->second;
+
+    return nullptr;
+}
+
+ast_slot resolver::_get_slot(const std::string& identifier) {
+    auto symbol = _try_get_symbol(identifier);
+    if(symbol == nullptr)
+        throw std::runtime_error(fmt::format("symbol '{}' not found", identifier));
+
+    return ast_slot{symbol->segment, symbol->index};
+}
+
+void resolver::_reference(const std::string &type) {
+    if(type == "int" || type == "char" || type == "boolean" || type == "void" || type == _top_level->identifier)
+        return;
+
+    _referenced_classes.insert(type);
+}
+
+void resolver::_check_limit(uint64_t count, uint32_t limit, const std::string &what) {
+    if(count > limit)
+        throw std::runtime_error(fmt::format("too many {}, the Hack platform allows {}", what, limit));
+}
+
+uint32_t resolver::count_statics(const ast_class &ast) {
+    uint32_t count = 0;
+    for(const auto& var : ast.variables) {
+        if(var.is_static)
+            count += var.identifiers.size();
+    }
+    return count;
+}
+
+// NOLINTEND(misc-no-recursion)
@@ -0,0 +1,70 @@
+#include "source_map.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <iterator>
+
+source_map::source_map(const std::string &source_name, const std::string &source) {
+    _line_starts.push_back(0);
+    for(size_t i = 0; i < source.size(); i++) {
+        if(source[i] == '\n')
+            _line_starts.push_back((uint32_t)i + 1);
+    }
+
+    fmt::format_to(std::back_inserter(_text), "jack-map {}\nsource {}\n", VERSION, source_name);
+}
+
+void source_map::add(const std::string &vm_code, const std::vector<segment> &segments) {
+    // Segments start on line boundaries, so the lines are counted in a single pass
+    size_t counted = 0;
+    uint32_t line = _vm_lines;
+    auto line_at = [&](size_t offset) {
+        line += (uint32_t)std::count(vm_code.begin() + (ptrdiff_t)counted, vm_code.begin() + (ptrdiff_t)offset, '\n');
+        counted = offset;
+        return line;
+    };
+
+    // Neighbouring segments of the same span, around a nested statement that emitted nothing, are merged
+    uint32_t first = 0, last = 0;
+    ast_span span;
+    bool pending = false;
+    auto flush = [&]() {
+        if(!pending)
+            return;
+        fmt::format_to(std::back_inserter(_text), "{}-{} ", first + 1, last + 1);
+        _format_position(span.begin);
+        _text += '-';
+        _format_position(span.end);
+        _text += '\n';
+    };
+
+    for(size_t i = 0; i < segments.size(); i++) {
+        auto begin = segments[i].vm_offset;
+        auto end = i + 1 < segments.size() ? segments[i + 1].vm_offset : vm_code.size();
+        if(begin >= end)
+            continue;
+
+        auto begin_line = line_at(begin);
+        auto end_line = line_at(end);
+        const auto& next = segments[i].span;
+        if(pending && next.begin == span.begin && next.end == span.end && begin_line == last + 1) {
+            last = end_line - 1;
+            continue;
+        }
+
+        flush();
+        first = begin_line;
+        last = end_line - 1;
+        span = next;
+        pending = true;
+    }
+    flush();
+
+    _vm_lines = line_at(vm_code.size());
+}
+
+void source_map::_format_position(uint32_t offset) {
+    auto line = std::upper_bound(_line_starts.begin(), _line_starts.end(), offset) - 1;
+    fmt::format_to(std::back_inserter(_text), "{}:{}", line - _line_starts.begin() + 1, offset - *line + 1);
+}
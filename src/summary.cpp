@@ -0,0 +1,245 @@
+#include "summary.hpp"
+
+#include <fmt/format.h>
+
+#include <set>
+#include <sstream>
+
+// The AST is recursive, disable recursion check
+// NOLINTBEGIN(misc-no-recursion)
+
+typedef class_summary::call_set call_set_t;
+
+static void collect_calls(const ast_expression& expression, call_set_t& calls);
+
+static void collect_calls(const ast_subroutine_call& call, call_set_t& calls) {
+    calls.emplace(call.callee_class + "." + call.subroutine_identifier, (uint16_t)call.arguments.size());
+    for(const auto& argument : call.arguments)
+        collect_calls(argument, calls);
+}
+
+static void collect_calls(const ast_term* term, call_set_t& calls) {
+    switch(term->type) {
+        case ast_term::type_t::ARRAY:
+            collect_calls(((const ast_term_array*)term)->access, calls);
+            break;
+        case ast_term::type_t::EXPRESSION:
+            collect_calls(((const ast_term_expression*)term)->expression, calls);
+            break;
+        case ast_term::type_t::UNARY:
+            collect_calls(((const ast_term_unary*)term)->term, calls);
+            break;
+        case ast_term::type_t::SUBROUTINE_CALL:
+            collect_calls(((const ast_term_subroutine_call*)term)->call, calls);
+            break;
+        default:
+            break;
+    }
+}
+
+static void collect_calls(const ast_expression& expression, call_set_t& calls) {
+    collect_calls(expression.primary, calls);
+    for(const auto& pair : expression.secondaries)
+        collect_calls(pair.second, calls);
+}
+
+static void collect_calls(const std::list<ast_statement*>& statements, call_set_t& calls) {
+    for(auto statement : statements) {
+        switch(statement->type) {
+            case ast_statement::type_t::LET: {
+                auto let_statement = (const ast_statement_let*)statement;
+                if(let_statement->array_access.has_value())
+                    collect_calls(let_statement->array_access.value(), calls);
+                collect_calls(let_statement->assignment, calls);
+                break;
+            }
+            case ast_statement::type_t::IF: {
+                auto if_statement = (const ast_statement_if*)statement;
+                collect_calls(if_statement->conditional, calls);
+                collect_calls(if_statement->true_statements, calls);
+                collect_calls(if_statement->false_statements, calls);
+                break;
+            }
+            case ast_statement::type_t::WHILE: {
+                auto while_statement = (const ast_statement_while*)statement;
+                collect_calls(while_statement->conditional, calls);
+                collect_calls(while_statement->statements, calls);
+                break;
+            }
+            case ast_statement::type_t::DO:
+                collect_calls(((const ast_statement_do*)statement)->call, calls);
+                break;
+            case ast_statement::type_t::RETURN:
+                collect_calls(((const ast_statement_return*)statement)->value, calls);
+                break;
+        }
+    }
+}
+
+// NOLINTEND(misc-no-recursion)
+
+void class_summary::collect_calls(const std::list<ast_statement *> &statements, call_set &calls) {
+    ::collect_calls(statements, calls);
+}
+
+static const char* subroutine_kind_to_string(ast_class_subroutine::type_t type) {
+    switch(type) {
+        case ast_class_subroutine::type_t::METHOD:
+            return "method";
+        case ast_class_subroutine::type_t::CONSTRUCTOR:
+            return "constructor";
+        default:
+            return "function";
+    }
+}
+
+static std::optional<ast_class_subroutine::type_t> subroutine_kind_from_string(const std::string& str) {
+    if(str == "method")
+        return ast_class_subroutine::type_t::METHOD;
+    else if(str == "constructor")
+        return ast_class_subroutine::type_t::CONSTRUCTOR;
+    else if(str == "function")
+        return ast_class_subroutine::type_t::FUNCTION;
+
+    return std::nullopt;
+}
+
+class_summary class_summary::build(const ast_class &ast, uint64_t source_hash) {
+    class_summary summary;
+    summary.source_hash = source_hash;
+    summary.class_name = ast.identifier;
+    summary.field_count = ast.field_count;
+
+    for(const auto& var : ast.variables) {
+        if(var.is_static)
+            summary.static_count += var.identifiers.size();
+    }
+
+    call_set_t calls;
+    for(const auto& subroutine : ast.subroutines) {
+        class_summary::subroutine entry;
+        entry.type = subroutine.type;
+        entry.return_type = subroutine.return_type;
+        entry.identifier = subroutine.identifier;
+        entry.local_count = subroutine.local_count;
+        for(const auto& parameter : subroutine.parameters)
+            entry.parameter_types.push_back(parameter.type);
+        summary.subroutines.push_back(std::move(entry));
+
+        collect_calls(subroutine.statements, calls);
+    }
+    summary.calls.assign(calls.begin(), calls.end());
+
+    return summary;
+}
+
+std::string class_summary::serialize() const {
+    std::string out;
+    auto out_it = std::back_inserter(out);
+
+    fmt::format_to(out_it, "jack-summary {}\nsource {:016x}\nclass {}\nfields {}\nstatics {}\n",
+                   VERSION, source_hash, class_name, field_count, static_count);
+
+    for(const auto& subroutine : subroutines) {
+        fmt::format_to(out_it, "subroutine {} {} {} {}", subroutine_kind_to_string(subroutine.type),
+                       subroutine.return_type, subroutine.identifier, subroutine.local_count);
+        for(const auto& type : subroutine.parameter_types)
+            fmt::format_to(out_it, " {}", type);
+        out += '\n';
+    }
+
+    for(const auto& call : calls)
+        fmt::format_to(out_it, "call {} {}\n", call.first, call.second);
+
+    for(const auto& use : uses) {
+        if(use.source_hash.has_value())
+            fmt::format_to(out_it, "use {} {:016x}\n", use.class_name, use.source_hash.value());
+        else
+            fmt::format_to(out_it, "use {} -\n", use.class_name);
+    }
+
+    return out;
+}
+
+std::optional<class_summary> class_summary::parse(const std::string &text) {
+    class_summary summary;
+    std::istringstream in(text);
+    std::string line;
+
+    auto next_record = [&](const char* expected, std::istringstream& fields) {
+        if(!std::getline(in, line))
+            return false;
+
+        fields = std::istringstream(line);
+        std::string record;
+        return fields >> record && record == expected;
+    };
+
+    std::istringstream fields;
+    uint16_t version = 0;
+    if(!next_record("jack-summary", fields) || !(fields >> version) || version != VERSION)
+        return std::nullopt;
+    if(!next_record("source", fields) || !(fields >> std::hex >> summary.source_hash))
+        return std::nullopt;
+    if(!next_record("class", fields) || !(fields >> summary.class_name))
+        return std::nullopt;
+    if(!next_record("fields", fields) || !(fields >> summary.field_count))
+        return std::nullopt;
+    if(!next_record("statics", fields) || !(fields >> summary.static_count))
+        return std::nullopt;
+
+    while(std::getline(in, line)) {
+        fields = std::istringstream(line);
+        std::string record;
+        fields >> record;
+
+        if(record == "subroutine") {
+            class_summary::subroutine entry;
+            std::string kind;
+            if(!(fields >> kind >> entry.return_type >> entry.identifier >> entry.local_count))
+                return std::nullopt;
+
+            auto type = subroutine_kind_from_string(kind);
+            if(!type.has_value())
+                return std::nullopt;
+            entry.type = type.value();
+
+            std::string parameter_type;
+            while(fields >> parameter_type)
+                entry.parameter_types.push_back(parameter_type);
+            summary.subroutines.push_back(std::move(entry));
+        } else if(record == "call") {
+            std::pair<std::string, uint16_t> call;
+            if(!(fields >> call.first >> call.second))
+                return std::nullopt;
+            summary.calls.push_back(std::move(call));
+        } else if(record == "use") {
+            class_summary::use use;
+            std::string hash;
+            if(!(fields >> use.class_name >> hash))
+                return std::nullopt;
+
+            if(hash != "-") {
+                try {
+                    use.source_hash = std::stoull(hash, nullptr, 16);
+                } catch(const std::logic_error&) {
+                    return std::nullopt;
+                }
+            }
+            summary.uses.push_back(std::move(use));
+        } else if(!record.empty()) {
+            return std::nullopt;
+        }
+    }
+
+    return summary;
+}
+
+uint64_t class_summary::hash(const std::string &data, uint64_t seed) {
+    uint64_t hash = seed;
+    for(unsigned char c : data) {
+        hash ^= c;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
@@ -110,6 +110,8 @@ std::string token::type_to_string(token::type_t type) {
             return "stringConstant";
         case type_t::INT_CONSTANT:
             return "integerConstant";
+        case type_t::END:
+            return "end of file";
     }
 }
 
@@ -127,5 +129,7 @@ std::string token::to_string(const token &token) {
             return token.get_value<string_constant_t>();
         case type_t::INT_CONSTANT:
             return std::to_string(token.get_value<int_constant_t>());
+        case type_t::END:
+            return "end of file";
     }
 }
@@ -1,131 +1,187 @@
 #include "tokenizer.hpp"
 
-#include <sstream>
-#include <regex>
-#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
 #include <unordered_map>
 
 void tokenizer::reset() {
-    _tokens_it = _tokens.cbegin();
+    _position = 0;
+    _lookahead_start = 0;
+    _lookahead_count = 0;
 }
 
 const token& tokenizer::next() {
-    return *(_tokens_it++);
+    if(!_fill(1))
+        return _end;
+
+    _current = std::move(_lookahead[_lookahead_start]);
+    _lookahead_start = (_lookahead_start + 1) % LOOKAHEAD;
+    _lookahead_count--;
+    return _current;
 }
 
 const token& tokenizer::peek(uint32_t offset) {
-    auto tk = _tokens_it;
-    for(auto i = 0; i < offset; i++)
-        tk++;
-    return *tk;
+    if(offset >= LOOKAHEAD)
+        throw std::logic_error("Tokenizer lookahead exceeded");
+
+    if(!_fill(offset + 1))
+        return _end;
+
+    return _lookahead[(_lookahead_start + offset) % LOOKAHEAD];
 }
 
 bool tokenizer::has_next() {
-    return _tokens_it != _tokens.cend();
+    return _fill(1);
 }
 
-void tokenizer::run(std::string &source_code) {
-    _tokens.clear();
+uint32_t tokenizer::skip_block() {
+    // Tokens already scanned ahead are part of the block
+    auto start = _lookahead_count > 0 ? _lookahead[_lookahead_start].offset : (uint32_t)_position;
+    const auto& source_code = *_source;
+
+    size_t i = start;
+    uint32_t depth = 1;
+    while(true) {
+        _source_skip_whitespace(source_code, i);
+        if(i >= source_code.size())
+            throw std::runtime_error("Unterminated block, expected '}'");
+
+        char ch = source_code[i];
+        if(ch == '"') {
+            auto end = source_code.find('"', i + 1);
+            if(end == std::string::npos)
+                throw std::runtime_error("Unterminated string constant");
+            i = end + 1;
+        } else if(ch == '{') {
+            depth++;
+            i++;
+        } else if(ch == '}' && --depth == 0) {
+            break;
+        } else {
+            i++;
+        }
+    }
 
-    _source_remove_comments(source_code);
+    seek((uint32_t)i);
+    return start;
+}
 
-    token tk;
-    while(_source_next_token(tk, source_code))
-        _tokens.emplace_back(tk);
+void tokenizer::seek(uint32_t offset) {
+    _position = offset;
+    _lookahead_start = 0;
+    _lookahead_count = 0;
 }
 
-void tokenizer::_source_remove_comments(std::string &source_code) {
-    // Multi line comments
-    auto comment_multiline_ex = std::regex(R"(\/\*(\*(?!\/)|[^*])*\*\/)", std::regex_constants::ECMAScript);
-    source_code = std::regex_replace(source_code, comment_multiline_ex, "");
+void tokenizer::run(const std::string &source_code) {
+    _source = &source_code;
+    _end.offset = (uint32_t)source_code.size();
+    reset();
+}
 
-    // Single line comments
-    auto comment_ex = std::regex(R"((\/\/)(.+?)([\n\r]|\*\)))", std::regex_constants::ECMAScript);
-    source_code = std::regex_replace(source_code, comment_ex, "");
+bool tokenizer::_fill(uint32_t count) {
+    // Single forward pass, every character is looked at a constant number of times
+    while(_lookahead_count < count) {
+        auto& tk = _lookahead[(_lookahead_start + _lookahead_count) % LOOKAHEAD];
+        if(!_source_next_token(tk, *_source, _position))
+            return false;
+        tk.length = (uint32_t)_position - tk.offset;
+        _lookahead_count++;
+    }
+    return true;
+}
 
-    // Remove duplicate newlines
-    auto newline_ex = std::regex("(\n|\r){1,}", std::regex_constants::ECMAScript);
-    source_code = std::regex_replace(source_code, newline_ex, "\n");
+void tokenizer::_source_skip_whitespace(const std::string &source_code, size_t &i) {
+    while(i < source_code.size()) {
+        if(std::isspace((unsigned char)source_code[i])) {
+            i++;
+        } else if(source_code.compare(i, 2, "//") == 0) {
+            i = source_code.find('\n', i);
+            if(i == std::string::npos)
+                i = source_code.size();
+        } else if(source_code.compare(i, 2, "/*") == 0) {
+            auto end = source_code.find("*/", i + 2);
+            if(end == std::string::npos)
+                throw std::runtime_error("Unterminated comment");
+            i = end + 2;
+        } else {
+            break;
+        }
+    }
 }
 
-bool tokenizer::_source_next_token(token &token, std::string &source_code) {
-    const static auto REGEX_WHITESPACE  = std::regex(
-            "(\\s|\r|\n)+",
-            std::regex_constants::ECMAScript);
-    const static auto REGEX_SYMBOL      = std::regex(
-            R"(\{|\}|\(|\)|\[|\]|\.|,|;|\+|-|\*|\/|&|\||>|<|=|~)",
-            std::regex_constants::ECMAScript);
-    const static auto REGEX_KEYWORD     = std::regex(
-            "class|constructor|function|method|field|static|var|int|char|boolean|void|true|false|null|this|let|do|if|else|while|return",
-            std::regex_constants::ECMAScript);
-    const static auto REGEX_INT_CONST   = std::regex(
-            "\\d+",
-            std::regex_constants::ECMAScript);
-    const static auto REGEX_STR_CONST   = std::regex(
-            R"("[^"]*")",
-            std::regex_constants::ECMAScript);
-    const static auto REGEX_IDENTIFIER  = std::regex(
-            "([a-zA-Z]|_)([a-zA-Z]|\\d|_)*",
-            std::regex_constants::ECMAScript);
-
-    source_code = std::regex_replace(source_code, REGEX_WHITESPACE, "", std::regex_constants::match_continuous);
-
-    std::smatch matches;
-    std::string match;
-
-    std::regex_search(source_code, matches, REGEX_SYMBOL, std::regex_constants::match_continuous);
-    match = _check_matches(matches, source_code);
-    if(!match.empty()) {
+bool tokenizer::_source_next_token(token &token, const std::string &source_code, size_t &i) {
+    const static std::string SYMBOLS = "{}()[].,;+-*/&|<>=~";
+    const static std::unordered_map<std::string, token::keyword_t> KEYWORDS = {
+            {"class", token::keyword_t::CLASS}, {"constructor", token::keyword_t::CONSTRUCTOR},
+            {"function", token::keyword_t::FUNCTION}, {"method", token::keyword_t::METHOD},
+            {"field", token::keyword_t::FIELD}, {"static", token::keyword_t::STATIC},
+            {"var", token::keyword_t::VAR}, {"int", token::keyword_t::INT},
+            {"char", token::keyword_t::CHAR}, {"boolean", token::keyword_t::BOOL},
+            {"void", token::keyword_t::VOID}, {"true", token::keyword_t::TRUE},
+            {"false", token::keyword_t::FALSE}, {"null", token::keyword_t::NUL},
+            {"this", token::keyword_t::THIS}, {"let", token::keyword_t::LET},
+            {"do", token::keyword_t::DO}, {"if", token::keyword_t::IF},
+            {"else", token::keyword_t::ELSE}, {"while", token::keyword_t::WHILE},
+            {"return", token::keyword_t::RETURN}
+    };
+
+    _source_skip_whitespace(source_code, i);
+    if(i >= source_code.size())
+        return false;
+
+    auto start = i;
+    char ch = source_code[i];
+    token.offset = (uint32_t)start;
+
+    if(SYMBOLS.find(ch) != std::string::npos) {
+        i++;
         token.type = token::type_t::SYMBOL;
-        token.value = token::symbol_t(match[0]);
+        token.value = token::symbol_t(ch);
         return true;
     }
 
-    std::regex_search(source_code, matches, REGEX_KEYWORD, std::regex_constants::match_continuous);
-    match = _check_matches(matches, source_code);
-    if(std::isalnum(source_code[0])) {
-        source_code.insert(source_code.begin(), match.begin(), match.end());
-    } else if(!match.empty()) {
-        token.type = token::type_t::KEYWORD;
-        token.value = token::keyword_from_string(match);
-        return true;
-    }
+    if(std::isdigit((unsigned char)ch)) {
+        // Saturates instead of overflowing, so the error can quote the whole literal
+        uint32_t value = 0;
+        while(i < source_code.size() && std::isdigit((unsigned char)source_code[i]))
+            value = std::min<uint32_t>(value * 10 + (source_code[i++] - '0'), INT_CONSTANT_MAX + 1);
+        if(value > INT_CONSTANT_MAX)
+            throw std::runtime_error("Integer constant '" + source_code.substr(start, i - start) + "' is larger than " + std::to_string(INT_CONSTANT_MAX));
 
-    std::regex_search(source_code, matches, REGEX_INT_CONST, std::regex_constants::match_continuous);
-    match = _check_matches(matches, source_code);
-    if(!match.empty()) {
         token.type = token::type_t::INT_CONSTANT;
-        token.value = token::int_constant_t(std::stoi(match));
+        token.value = token::int_constant_t(value);
         return true;
     }
 
-    std::regex_search(source_code, matches, REGEX_STR_CONST, std::regex_constants::match_continuous);
-    match = _check_matches(matches, source_code);
-    if(!match.empty()) {
+    if(ch == '"') {
+        auto end = source_code.find('"', i + 1);
+        if(end == std::string::npos)
+            throw std::runtime_error("Unterminated string constant");
+        i = end + 1;
+
         token.type = token::type_t::STRING_CONSTANT;
-        token.value = token::string_constant_t(match.substr(1, match.size() - 2));
+        token.value = token::string_constant_t(source_code.substr(start + 1, end - start - 1));
         return true;
     }
 
-    std::regex_search(source_code, matches, REGEX_IDENTIFIER, std::regex_constants::match_continuous);
-    match = _check_matches(matches, source_code);
-    if(!match.empty()) {
-        token.type = token::type_t::IDENTIFIER;
-        token.value = token::identifier_t(match);
+    if(std::isalpha((unsigned char)ch) || ch == '_') {
+        while(i < source_code.size() && (std::isalnum((unsigned char)source_code[i]) || source_code[i] == '_'))
+            i++;
+
+        auto word = source_code.substr(start, i - start);
+        auto keyword = KEYWORDS.find(word);
+        if(keyword != KEYWORDS.end()) {
+            token.type = token::type_t::KEYWORD;
+            token.value = keyword->second;
+        } else {
+            token.type = token::type_t::IDENTIFIER;
+            token.value = token::identifier_t(std::move(word));
+        }
         return true;
     }
 
-    return false;
-}
-
-std::string tokenizer::_check_matches(const std::smatch &matches, std::string &source_code) {
-    if(!matches.empty()) {
-        std::string ret = matches[0].str();
-        source_code.erase(matches[0].first, matches[0].second);
-        return ret;
-    }
-
-    return "";
+    throw std::runtime_error(std::string("Unexpected character '") + ch + "'");
 }
 
 void tokenizer::_token_process_symbol(const token::symbol_t & symbol, std::string &str) {
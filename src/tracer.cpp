@@ -0,0 +1,74 @@
+#include "tracer.hpp"
+
+#include <fmt/format.h>
+
+#include <iterator>
+
+std::atomic<uint64_t> tracer::_next_id = 1;
+
+tracer::tracer() : _id(_next_id.fetch_add(1, std::memory_order_relaxed)), _start(clock::now()), _main_thread(std::this_thread::get_id()) {}
+
+void tracer::record(const char *name, const std::filesystem::path *file, clock::time_point begin, clock::time_point end) {
+    _thread_buffer().events.push_back({name, file, begin, end});
+}
+
+tracer::thread_buffer &tracer::_thread_buffer() {
+    thread_local uint64_t cached_id = 0;
+    thread_local thread_buffer* cached = nullptr;
+    if(cached_id == _id)
+        return *cached;
+
+    auto buffer = std::make_unique<thread_buffer>();
+    buffer->thread = std::this_thread::get_id();
+    // Most threads run a single task, a few spans each
+    buffer->events.reserve(16);
+
+    std::lock_guard<std::mutex> lock(_buffers_mutex);
+    cached = _buffers.emplace_back(std::move(buffer)).get();
+    cached_id = _id;
+    return *cached;
+}
+
+std::string tracer::to_json() const {
+    auto micros = [this](clock::time_point time) {
+        return std::chrono::duration<double, std::micro>(time - _start).count();
+    };
+
+    std::string out = "{\"traceEvents\":[\n";
+    uint32_t worker = 0;
+    for(size_t tid = 0; tid < _buffers.size(); tid++) {
+        const auto& buffer = *_buffers[tid];
+        auto name = buffer.thread == _main_thread ? std::string("main") : fmt::format("worker {}", ++worker);
+        fmt::format_to(std::back_inserter(out), "{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}},\n", tid, name);
+
+        for(const auto& event : buffer.events) {
+            fmt::format_to(std::back_inserter(out), "{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}",
+                           event.name, tid, micros(event.begin), micros(event.end) - micros(event.begin));
+            if(event.file != nullptr) {
+                out += ",\"args\":{\"file\":\"";
+                _append_escaped(out, event.file->filename().string());
+                out += "\"}";
+            }
+            out += "},\n";
+        }
+    }
+
+    // Chrome tolerates a trailing comma but other readers do not
+    if(out.back() == '\n' && out[out.size() - 2] == ',')
+        out.erase(out.size() - 2, 1);
+    out += "]}\n";
+    return out;
+}
+
+void tracer::_append_escaped(std::string &out, const std::string &str) {
+    for(char ch : str) {
+        if(ch == '"' || ch == '\\') {
+            out += '\\';
+            out += ch;
+        } else if((unsigned char)ch < 0x20) {
+            fmt::format_to(std::back_inserter(out), "\\u{:04x}", (unsigned)ch);
+        } else {
+            out += ch;
+        }
+    }
+}
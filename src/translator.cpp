@@ -0,0 +1,591 @@
+#include "translator.hpp"
+
+#include <fmt/format.h>
+
+#include <set>
+#include <stdexcept>
+
+#define ASM_DYNAMIC(fmt_str, ...) _asm_code.emplace_back(fmt::format(#fmt_str, __VA_ARGS__));
+#define ASM(code) _asm_code.emplace_back(#code);
+
+void translator::add(std::string unit_name, const std::string &vm_code) {
+    unit u;
+    u.name = std::move(unit_name);
+    u.code = vm_instruction::parse_all(vm_code);
+
+    _units.push_back(std::move(u));
+}
+
+void translator::run() {
+    _asm_code.clear();
+    _next_return = 0;
+
+    _check_calls();
+    _translate_bootstrap();
+    _translate_trampolines();
+
+    for(const auto& u : _units)
+        _translate_unit(u);
+}
+
+void translator::_check_calls() const {
+    // The assembler would make an undefined call target a RAM variable and jump to its address
+    std::set<std::string> defined;
+    std::set<std::string> called = {_entry()};
+    for(const auto& u : _units) {
+        for(const auto& instruction : u.code) {
+            if(instruction.op == vm_instruction::op_t::FUNCTION)
+                defined.insert(instruction.name);
+            else if(instruction.op == vm_instruction::op_t::CALL)
+                called.insert(instruction.name);
+        }
+    }
+
+    std::string undefined;
+    for(const auto& name : called) {
+        if(defined.count(name) == 0)
+            undefined += (undefined.empty() ? "" : ", ") + name;
+    }
+    if(!undefined.empty())
+        throw std::runtime_error("Calls to functions no class defines (link the OS sources too): " + undefined);
+}
+
+std::string translator::_entry() const {
+    // Without the OS linked in there is no Sys.init, so start the program directly
+    for(const auto& u : _units) {
+        for(const auto& instruction : u.code) {
+            if(instruction.op == vm_instruction::op_t::FUNCTION && instruction.name == "Sys.init")
+                return instruction.name;
+        }
+    }
+    return "Main.main";
+}
+
+void translator::_translate_bootstrap() {
+    std::string entry = _entry();
+
+    ASM(@256)
+    ASM(D=A)
+    ASM(@SP)
+    ASM(M=D)
+    _function = "$BOOT";
+    _call(entry, 0);
+    ASM(($HALT))
+    ASM(@$HALT)
+    ASM(0;JMP)
+}
+
+void translator::_translate_trampolines() {
+    // Expects the return address in D, the callee address in R13 and the argument count in R14
+    ASM(($CALL))
+    ASM(@SP)
+    ASM(A=M)
+    ASM(M=D)
+    for(const auto& pointer : {"LCL", "ARG", "THIS", "THAT"}) {
+        ASM_DYNAMIC(@{}, pointer)
+        ASM(D=M)
+        ASM(@SP)
+        ASM(AM=M+1)
+        ASM(M=D)
+    }
+    ASM(@SP)
+    ASM(MD=M+1)
+    ASM(@LCL)
+    ASM(M=D)
+    ASM(@R14)
+    ASM(D=D-M)
+    ASM(@5)
+    ASM(D=D-A)
+    ASM(@ARG)
+    ASM(M=D)
+    ASM(@R13)
+    ASM(A=M)
+    ASM(0;JMP)
+
+    ASM(($RETURN))
+    ASM(@LCL)
+    ASM(D=M)
+    ASM(@R13)
+    ASM(M=D)
+    ASM(@5)
+    ASM(A=D-A)
+    ASM(D=M)
+    ASM(@R14)
+    ASM(M=D)
+    ASM(@SP)
+    ASM(AM=M-1)
+    ASM(D=M)
+    ASM(@ARG)
+    ASM(A=M)
+    ASM(M=D)
+    ASM(@ARG)
+    ASM(D=M+1)
+    ASM(@SP)
+    ASM(M=D)
+    for(const auto& pointer : {"THAT", "THIS", "ARG", "LCL"}) {
+        ASM(@R13)
+        ASM(AM=M-1)
+        ASM(D=M)
+        ASM_DYNAMIC(@{}, pointer)
+        ASM(M=D)
+    }
+    ASM(@R14)
+    ASM(A=M)
+    ASM(0;JMP)
+
+    // Expects the return address in R15 and the difference of the operands on top of the stack
+    ASM(($EQ))
+    ASM(@SP)
+    ASM(A=M-1)
+    ASM(D=M)
+    ASM(M=-1)
+    ASM(@$EQ_END)
+    ASM(D;JEQ)
+    ASM(@SP)
+    ASM(A=M-1)
+    ASM(M=0)
+    ASM(($EQ_END))
+    ASM(@R15)
+    ASM(A=M)
+    ASM(0;JMP)
+
+    // Expect the return address in R15, x on top of the stack and y in R13. $GT and $LT replace x
+    // with the result, $DIFF pops it and returns x - y in D, or a value of its sign when it overflows
+    for(const auto& [name, jump] : {std::make_pair("GT", "JGT"), std::make_pair("LT", "JLT")}) {
+        ASM_DYNAMIC((${}), name)
+        _translate_signed_difference(name);
+        ASM(@SP)
+        ASM(A=M-1)
+        ASM(M=-1)
+        ASM_DYNAMIC(@${}_END, name)
+        ASM_DYNAMIC(D;{}, jump)
+        ASM(@SP)
+        ASM(A=M-1)
+        ASM(M=0)
+        ASM_DYNAMIC((${}_END), name)
+        ASM(@R15)
+        ASM(A=M)
+        ASM(0;JMP)
+    }
+
+    ASM(($DIFF))
+    _translate_signed_difference("DIFF");
+    ASM(@SP)
+    ASM(M=M-1)
+    ASM(@R15)
+    ASM(A=M)
+    ASM(0;JMP)
+}
+
+void translator::_translate_signed_difference(const std::string& name) {
+    // x - y overflows only when the signs differ, and then the sign of x decides
+    ASM(@SP)
+    ASM(A=M-1)
+    ASM(D=M)
+    ASM_DYNAMIC(@${}_X_NEGATIVE, name)
+    ASM(D;JLT)
+    ASM(@R13)
+    ASM(D=M)
+    ASM_DYNAMIC(@${}_SUBTRACT, name)
+    ASM(D;JGE)
+    ASM(D=1)
+    ASM_DYNAMIC(@${}_DONE, name)
+    ASM(0;JMP)
+    ASM_DYNAMIC((${}_X_NEGATIVE), name)
+    ASM(@R13)
+    ASM(D=M)
+    ASM_DYNAMIC(@${}_SUBTRACT, name)
+    ASM(D;JLT)
+    ASM(D=-1)
+    ASM_DYNAMIC(@${}_DONE, name)
+    ASM(0;JMP)
+    ASM_DYNAMIC((${}_SUBTRACT), name)
+    ASM(@SP)
+    ASM(A=M-1)
+    ASM(D=M)
+    ASM(@R13)
+    ASM(D=D-M)
+    ASM_DYNAMIC((${}_DONE), name)
+}
+
+void translator::_translate_unit(const unit &u) {
+    _unit = &u;
+
+    const auto& code = u.code;
+    for(size_t i = 0; i < code.size();) {
+        const auto& instruction = code[i];
+
+        if(instruction.op == vm_instruction::op_t::PUSH) {
+            i += _translate_push(code, i);
+            continue;
+        }
+
+        // A comparison feeding a branch jumps on the difference directly
+        if(_is_compare(instruction.op) && i + 1 < code.size()) {
+            bool negate = i + 2 < code.size() && code[i + 1].op == vm_instruction::op_t::NOT
+                    && code[i + 2].op == vm_instruction::op_t::IF_GOTO;
+            if(negate || code[i + 1].op == vm_instruction::op_t::IF_GOTO) {
+                _pop_d();
+                _jump_compare(instruction.op, negate, code[i + (negate ? 2 : 1)].name);
+                i += negate ? 3 : 2;
+                continue;
+            }
+        }
+
+        _translate_instruction(instruction);
+        i++;
+    }
+
+    _unit = nullptr;
+}
+
+size_t translator::_translate_push(const std::vector<vm_instruction> &code, size_t i) {
+    const auto& push = code[i];
+    if(i + 1 >= code.size()) {
+        _load_d(push);
+        _push_d();
+        return 1;
+    }
+
+    const auto& next = code[i + 1];
+    if(_is_arithmetic(next.op)) {
+        _load_d(push);
+        ASM(@SP)
+        ASM(A=M-1)
+        _apply_d(next.op);
+        return 2;
+    } else if(next.op == vm_instruction::op_t::POP) {
+        _load_d(push);
+        _store_d(next.segment, next.index);
+        return 2;
+    } else if(next.op == vm_instruction::op_t::IF_GOTO) {
+        _load_d(push);
+        ASM_DYNAMIC(@{}, _label(next.name))
+        ASM(D;JNE)
+        return 2;
+    } else if(_is_compare(next.op)) {
+        _load_d(push);
+
+        bool negate = i + 3 < code.size() && code[i + 2].op == vm_instruction::op_t::NOT
+                && code[i + 3].op == vm_instruction::op_t::IF_GOTO;
+        if(negate || (i + 2 < code.size() && code[i + 2].op == vm_instruction::op_t::IF_GOTO)) {
+            _jump_compare(next.op, negate, code[i + (negate ? 3 : 2)].name);
+            return negate ? 4 : 3;
+        }
+
+        _compare_top(next.op);
+        return 2;
+    }
+
+    _load_d(push);
+    _push_d();
+    return 1;
+}
+
+void translator::_translate_instruction(const vm_instruction &instruction) {
+    switch(instruction.op) {
+        case vm_instruction::op_t::PUSH:
+            _load_d(instruction);
+            _push_d();
+            break;
+        case vm_instruction::op_t::POP:
+            if(instruction.segment == vm_instruction::segment_t::POINTER
+                    || instruction.segment == vm_instruction::segment_t::TEMP
+                    || instruction.segment == vm_instruction::segment_t::STATIC
+                    || instruction.index <= 3) {
+                _pop_d();
+                _store_d(instruction.segment, instruction.index);
+            } else {
+                // Compute the address before popping so D is free for the value
+                ASM_DYNAMIC(@{}, instruction.index)
+                ASM(D=A)
+                ASM_DYNAMIC(@{}, _segment_base(instruction.segment))
+                ASM(D=D+M)
+                ASM(@R13)
+                ASM(M=D)
+                _pop_d();
+                ASM(@R13)
+                ASM(A=M)
+                ASM(M=D)
+            }
+            break;
+        case vm_instruction::op_t::ADD:
+        case vm_instruction::op_t::SUB:
+        case vm_instruction::op_t::AND:
+        case vm_instruction::op_t::OR:
+            _pop_d();
+            ASM(A=A-1)
+            _apply_d(instruction.op);
+            break;
+        case vm_instruction::op_t::NEG:
+            ASM(@SP)
+            ASM(A=M-1)
+            ASM(M=-M)
+            break;
+        case vm_instruction::op_t::NOT:
+            ASM(@SP)
+            ASM(A=M-1)
+            ASM(M=!M)
+            break;
+        case vm_instruction::op_t::EQ:
+        case vm_instruction::op_t::GT:
+        case vm_instruction::op_t::LT:
+            _pop_d();
+            _compare_top(instruction.op);
+            break;
+        case vm_instruction::op_t::LABEL:
+            ASM_DYNAMIC(({}), _label(instruction.name))
+            break;
+        case vm_instruction::op_t::GOTO:
+            ASM_DYNAMIC(@{}, _label(instruction.name))
+            ASM(0;JMP)
+            break;
+        case vm_instruction::op_t::IF_GOTO:
+            _pop_d();
+            ASM_DYNAMIC(@{}, _label(instruction.name))
+            ASM(D;JNE)
+            break;
+        case vm_instruction::op_t::FUNCTION:
+            _function = instruction.name;
+            ASM_DYNAMIC(({}), instruction.name)
+            if(instruction.index > 0) {
+                ASM(@SP)
+                ASM(A=M)
+                ASM(M=0)
+                for(uint16_t i = 1; i < instruction.index; i++) {
+                    ASM(A=A+1)
+                    ASM(M=0)
+                }
+                ASM(D=A+1)
+                ASM(@SP)
+                ASM(M=D)
+            }
+            break;
+        case vm_instruction::op_t::CALL:
+            _call(instruction.name, instruction.index);
+            break;
+        case vm_instruction::op_t::RETURN:
+            ASM(@$RETURN)
+            ASM(0;JMP)
+            break;
+    }
+}
+
+void translator::_load_d(const vm_instruction &push) {
+    switch(push.segment) {
+        case vm_instruction::segment_t::CONSTANT:
+            if(push.index <= 1) {
+                ASM_DYNAMIC(D={}, push.index)
+            } else {
+                ASM_DYNAMIC(@{}, push.index)
+                ASM(D=A)
+            }
+            break;
+        case vm_instruction::segment_t::POINTER:
+            ASM_DYNAMIC(@R{}, 3 + push.index)
+            ASM(D=M)
+            break;
+        case vm_instruction::segment_t::TEMP:
+            ASM_DYNAMIC(@R{}, 5 + push.index)
+            ASM(D=M)
+            break;
+        case vm_instruction::segment_t::STATIC:
+            ASM_DYNAMIC(@{}, _static(push.index))
+            ASM(D=M)
+            break;
+        default:
+            if(push.index <= 1) {
+                ASM_DYNAMIC(@{}, _segment_base(push.segment))
+                if(push.index == 0) {
+                    ASM(A=M)
+                } else {
+                    ASM(A=M+1)
+                }
+            } else {
+                ASM_DYNAMIC(@{}, push.index)
+                ASM(D=A)
+                ASM_DYNAMIC(@{}, _segment_base(push.segment))
+                ASM(A=D+M)
+            }
+            ASM(D=M)
+            break;
+    }
+}
+
+void translator::_store_d(vm_instruction::segment_t segment, uint16_t index) {
+    switch(segment) {
+        case vm_instruction::segment_t::CONSTANT:
+            throw std::runtime_error("Cannot pop to the constant segment");
+        case vm_instruction::segment_t::POINTER:
+            ASM_DYNAMIC(@R{}, 3 + index)
+            ASM(M=D)
+            break;
+        case vm_instruction::segment_t::TEMP:
+            ASM_DYNAMIC(@R{}, 5 + index)
+            ASM(M=D)
+            break;
+        case vm_instruction::segment_t::STATIC:
+            ASM_DYNAMIC(@{}, _static(index))
+            ASM(M=D)
+            break;
+        default:
+            if(index <= 3) {
+                ASM_DYNAMIC(@{}, _segment_base(segment))
+                if(index == 0) {
+                    ASM(A=M)
+                } else {
+                    ASM(A=M+1)
+                }
+                for(uint16_t i = 1; i < index; i++)
+                    ASM(A=A+1)
+                ASM(M=D)
+            } else {
+                ASM(@R13)
+                ASM(M=D)
+                ASM_DYNAMIC(@{}, index)
+                ASM(D=A)
+                ASM_DYNAMIC(@{}, _segment_base(segment))
+                ASM(D=D+M)
+                ASM(@R14)
+                ASM(M=D)
+                ASM(@R13)
+                ASM(D=M)
+                ASM(@R14)
+                ASM(A=M)
+                ASM(M=D)
+            }
+            break;
+    }
+}
+
+void translator::_pop_d() {
+    ASM(@SP)
+    ASM(AM=M-1)
+    ASM(D=M)
+}
+
+void translator::_push_d() {
+    ASM(@SP)
+    ASM(AM=M+1)
+    ASM(A=A-1)
+    ASM(M=D)
+}
+
+void translator::_apply_d(vm_instruction::op_t op) {
+    switch(op) {
+        case vm_instruction::op_t::ADD:
+            ASM(M=D+M)
+            break;
+        case vm_instruction::op_t::SUB:
+            ASM(M=M-D)
+            break;
+        case vm_instruction::op_t::AND:
+            ASM(M=D&M)
+            break;
+        case vm_instruction::op_t::OR:
+            ASM(M=D|M)
+            break;
+        default:
+            throw std::runtime_error("VM command is not arithmetic");
+    }
+}
+
+void translator::_compare_top(vm_instruction::op_t op) {
+    if(op == vm_instruction::op_t::EQ) {
+        ASM(@SP)
+        ASM(A=M-1)
+        ASM(M=M-D)
+    } else {
+        ASM(@R13)
+        ASM(M=D)
+    }
+    _call_compare(op == vm_instruction::op_t::EQ ? "EQ" : op == vm_instruction::op_t::GT ? "GT" : "LT");
+}
+
+void translator::_jump_compare(vm_instruction::op_t op, bool negate, const std::string &label) {
+    const char* jump;
+    switch(op) {
+        case vm_instruction::op_t::EQ:
+            jump = negate ? "JNE" : "JEQ";
+            break;
+        case vm_instruction::op_t::GT:
+            jump = negate ? "JLE" : "JGT";
+            break;
+        default:
+            jump = negate ? "JGE" : "JLT";
+            break;
+    }
+
+    // Equality survives overflow, the order of operands of opposite signs does not
+    if(op == vm_instruction::op_t::EQ) {
+        ASM(@SP)
+        ASM(AM=M-1)
+        ASM(D=M-D)
+    } else {
+        ASM(@R13)
+        ASM(M=D)
+        _call_compare("DIFF");
+    }
+    ASM_DYNAMIC(@{}, _label(label))
+    ASM_DYNAMIC(D;{}, jump)
+}
+
+void translator::_call_compare(const char* trampoline) {
+    auto return_label = fmt::format("$CMP.{}", _next_return++);
+    ASM_DYNAMIC(@{}, return_label)
+    ASM(D=A)
+    ASM(@R15)
+    ASM(M=D)
+    ASM_DYNAMIC(@${}, trampoline)
+    ASM(0;JMP)
+    ASM_DYNAMIC(({}), return_label)
+}
+
+void translator::_call(const std::string &function, uint16_t arg_count) {
+    auto return_label = fmt::format("{}$ret.{}", _function, _next_return++);
+    ASM_DYNAMIC(@{}, arg_count)
+    ASM(D=A)
+    ASM(@R14)
+    ASM(M=D)
+    ASM_DYNAMIC(@{}, function)
+    ASM(D=A)
+    ASM(@R13)
+    ASM(M=D)
+    ASM_DYNAMIC(@{}, return_label)
+    ASM(D=A)
+    ASM(@$CALL)
+    ASM(0;JMP)
+    ASM_DYNAMIC(({}), return_label)
+}
+
+std::string translator::_label(const std::string &name) const {
+    return _function + "$" + name;
+}
+
+std::string translator::_static(uint16_t index) const {
+    return _unit->name + "." + std::to_string(index);
+}
+
+bool translator::_is_arithmetic(vm_instruction::op_t op) {
+    return op == vm_instruction::op_t::ADD || op == vm_instruction::op_t::SUB
+        || op == vm_instruction::op_t::AND || op == vm_instruction::op_t::OR;
+}
+
+bool translator::_is_compare(vm_instruction::op_t op) {
+    return op == vm_instruction::op_t::EQ || op == vm_instruction::op_t::GT || op == vm_instruction::op_t::LT;
+}
+
+const char* translator::_segment_base(vm_instruction::segment_t segment) {
+    switch(segment) {
+        case vm_instruction::segment_t::LOCAL:
+            return "LCL";
+        case vm_instruction::segment_t::ARGUMENT:
+            return "ARG";
+        case vm_instruction::segment_t::THIS:
+            return "THIS";
+        case vm_instruction::segment_t::THAT:
+            return "THAT";
+        default:
+            throw std::runtime_error("VM segment has no base pointer");
+    }
+}
@@ -0,0 +1,205 @@
+#include "vm.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+static uint16_t check_index(int64_t index, const std::string& line) {
+    if(index < 0 || index > UINT16_MAX)
+        throw std::runtime_error("Index out of range in VM command '" + line + "'");
+    return static_cast<uint16_t>(index);
+}
+
+vm_instruction vm_instruction::parse(const std::string &line) {
+    std::istringstream in(line);
+    std::string command;
+    in >> command;
+
+    vm_instruction instruction;
+    instruction.op = op_from_string(command);
+
+    std::string segment;
+    // Wider than the field so out of range (and negative) indices are caught instead of truncated
+    int64_t index = 0;
+    switch(instruction.op) {
+        case op_t::PUSH:
+        case op_t::POP:
+            if(!(in >> segment >> index))
+                throw std::runtime_error("Malformed VM command '" + line + "'");
+            instruction.segment = segment_from_string(segment);
+            instruction.index = check_index(index, line);
+            break;
+        case op_t::LABEL:
+        case op_t::GOTO:
+        case op_t::IF_GOTO:
+            if(!(in >> instruction.name))
+                throw std::runtime_error("Malformed VM command '" + line + "'");
+            break;
+        case op_t::FUNCTION:
+        case op_t::CALL:
+            if(!(in >> instruction.name >> index))
+                throw std::runtime_error("Malformed VM command '" + line + "'");
+            instruction.index = check_index(index, line);
+            break;
+        default:
+            break;
+    }
+
+    return instruction;
+}
+
+std::vector<vm_instruction> vm_instruction::parse_all(const std::string &text) {
+    std::vector<vm_instruction> instructions;
+    size_t start = 0;
+    while(start < text.size()) {
+        auto end = text.find('\n', start);
+        if(end == std::string::npos)
+            end = text.size();
+
+        if(end > start)
+            instructions.push_back(parse(text.substr(start, end - start)));
+        start = end + 1;
+    }
+
+    return instructions;
+}
+
+vm_instruction::op_t vm_instruction::op_from_string(const std::string &str) {
+    if(str == "push")
+        return op_t::PUSH;
+    else if(str == "pop")
+        return op_t::POP;
+    else if(str == "add")
+        return op_t::ADD;
+    else if(str == "sub")
+        return op_t::SUB;
+    else if(str == "neg")
+        return op_t::NEG;
+    else if(str == "eq")
+        return op_t::EQ;
+    else if(str == "gt")
+        return op_t::GT;
+    else if(str == "lt")
+        return op_t::LT;
+    else if(str == "and")
+        return op_t::AND;
+    else if(str == "or")
+        return op_t::OR;
+    else if(str == "not")
+        return op_t::NOT;
+    else if(str == "label")
+        return op_t::LABEL;
+    else if(str == "goto")
+        return op_t::GOTO;
+    else if(str == "if-goto")
+        return op_t::IF_GOTO;
+    else if(str == "function")
+        return op_t::FUNCTION;
+    else if(str == "call")
+        return op_t::CALL;
+    else if(str == "return")
+        return op_t::RETURN;
+    else
+        throw std::runtime_error("Unknown VM command: '" + str + "'");
+}
+
+vm_instruction::segment_t vm_instruction::segment_from_string(const std::string &str) {
+    if(str == "constant")
+        return segment_t::CONSTANT;
+    else if(str == "local")
+        return segment_t::LOCAL;
+    else if(str == "argument")
+        return segment_t::ARGUMENT;
+    else if(str == "static")
+        return segment_t::STATIC;
+    else if(str == "this")
+        return segment_t::THIS;
+    else if(str == "that")
+        return segment_t::THAT;
+    else if(str == "pointer")
+        return segment_t::POINTER;
+    else if(str == "temp")
+        return segment_t::TEMP;
+    else
+        throw std::runtime_error("Unknown VM segment: '" + str + "'");
+}
+
+std::string vm_instruction::op_to_string(vm_instruction::op_t op) {
+    switch(op) {
+        case op_t::PUSH:
+            return "push";
+        case op_t::POP:
+            return "pop";
+        case op_t::ADD:
+            return "add";
+        case op_t::SUB:
+            return "sub";
+        case op_t::NEG:
+            return "neg";
+        case op_t::EQ:
+            return "eq";
+        case op_t::GT:
+            return "gt";
+        case op_t::LT:
+            return "lt";
+        case op_t::AND:
+            return "and";
+        case op_t::OR:
+            return "or";
+        case op_t::NOT:
+            return "not";
+        case op_t::LABEL:
+            return "label";
+        case op_t::GOTO:
+            return "goto";
+        case op_t::IF_GOTO:
+            return "if-goto";
+        case op_t::FUNCTION:
+            return "function";
+        case op_t::CALL:
+            return "call";
+        case op_t::RETURN:
+            return "return";
+    }
+
+    throw std::runtime_error("Failed to convert VM command to string");
+}
+
+std::string vm_instruction::segment_to_string(vm_instruction::segment_t segment) {
+    switch(segment) {
+        case segment_t::CONSTANT:
+            return "constant";
+        case segment_t::LOCAL:
+            return "local";
+        case segment_t::ARGUMENT:
+            return "argument";
+        case segment_t::STATIC:
+            return "static";
+        case segment_t::THIS:
+            return "this";
+        case segment_t::THAT:
+            return "that";
+        case segment_t::POINTER:
+            return "pointer";
+        case segment_t::TEMP:
+            return "temp";
+    }
+
+    throw std::runtime_error("Failed to convert VM segment to string");
+}
+
+std::string vm_instruction::to_string(const vm_instruction &instruction) {
+    switch(instruction.op) {
+        case op_t::PUSH:
+        case op_t::POP:
+            return op_to_string(instruction.op) + " " + segment_to_string(instruction.segment) + " " + std::to_string(instruction.index);
+        case op_t::LABEL:
+        case op_t::GOTO:
+        case op_t::IF_GOTO:
+            return op_to_string(instruction.op) + " " + instruction.name;
+        case op_t::FUNCTION:
+        case op_t::CALL:
+            return op_to_string(instruction.op) + " " + instruction.name + " " + std::to_string(instruction.index);
+        default:
+            return op_to_string(instruction.op);
+    }
+}
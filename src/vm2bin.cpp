@@ -0,0 +1,39 @@
+#include "bytecode.hpp"
+
+#include <fstream>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    if(argc < 2 || argc > 3) {
+        std::cerr << "Usage: vm2bin <input.vm> [output.vmb]" << std::endl;
+        return 1;
+    }
+
+    std::ifstream input(argv[1]);
+    if(input.fail()) {
+        std::cerr << "Failed to open " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::string output_path = argc == 3 ? argv[2] : std::string(argv[1]) + "b";
+
+    try {
+        std::vector<vm_instruction> instructions;
+        std::string line;
+        while(std::getline(input, line)) {
+            if(!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if(line.empty())
+                continue;
+            instructions.push_back(vm_instruction::parse(line));
+        }
+
+        std::ofstream output(output_path, std::ios::binary);
+        bytecode::write(bytecode::encode(instructions), output);
+    } catch(const std::runtime_error& e) {
+        std::cerr << argv[1] << ": " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
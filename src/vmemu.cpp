@@ -0,0 +1,100 @@
+#include "emulator.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <sstream>
+
+static bool starts_with(const std::string& str, const std::string& prefix) {
+    return str.rfind(prefix, 0) == 0;
+}
+
+static std::list<std::string> split(const std::string& str, char separator) {
+    std::list<std::string> parts;
+    std::istringstream in(str);
+    std::string part;
+    while(std::getline(in, part, separator)) {
+        if(!part.empty())
+            parts.push_back(part);
+    }
+    return parts;
+}
+
+static void print_report(const emulator& emu) {
+    std::cerr << "instructions: " << emu.get_instruction_count() << std::endl;
+
+    std::vector<const emulator::function*> functions;
+    for(const auto& fn : emu.get_functions()) {
+        if(fn.executed > 0 || fn.calls > 0)
+            functions.push_back(&fn);
+    }
+
+    std::sort(functions.begin(), functions.end(), [](auto a, auto b) {
+        return a->executed != b->executed ? a->executed > b->executed : a->name < b->name;
+    });
+
+    for(auto fn : functions)
+        std::cerr << "\t" << fn->name << " " << fn->executed << " (" << fn->calls << " calls)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    emulator::options options;
+    std::string entry = "Main.main";
+    std::optional<std::string> program_path;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = arg.substr(arg.find('=') + 1);
+
+        try {
+            if(starts_with(arg, "--keys=")) {
+                // <key code>*<polls>, for example --keys=0*100,81*1
+                for(const auto& key : split(value, ',')) {
+                    auto star = key.find('*');
+                    auto polls = star == std::string::npos ? 1 : std::stoul(key.substr(star + 1));
+                    options.keys.emplace_back(std::stoi(key.substr(0, star)), polls);
+                }
+            } else if(starts_with(arg, "--input=")) {
+                for(const auto& input : split(value, ','))
+                    options.inputs.push_back(std::stoi(input));
+            } else if(starts_with(arg, "--max-instructions=")) {
+                options.max_instructions = std::stoull(value);
+            } else if(starts_with(arg, "--entry=")) {
+                entry = value;
+            } else if(starts_with(arg, "--")) {
+                std::cerr << "Unknown option '" << arg << "'" << std::endl;
+                return 1;
+            } else if(program_path.has_value()) {
+                std::cerr << "Only 1 program path allowed" << std::endl;
+                return 1;
+            } else {
+                program_path = arg;
+            }
+        } catch(const std::logic_error&) {
+            std::cerr << "Invalid value for option '" << arg << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    if(!program_path.has_value()) {
+        std::cerr << "Usage: vmemu [--keys=K*N,...] [--input=V,...] [--max-instructions=N] [--entry=F] <.vm file or directory>" << std::endl;
+        return 1;
+    }
+
+    emulator emu(options);
+    int status = 0;
+    try {
+        emu.load(program_path.value());
+        emu.run(entry);
+    } catch(const std::runtime_error& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        status = 1;
+    }
+
+    std::cout << emu.get_output();
+    if(!emu.get_output().empty() && emu.get_output().back() != '\n')
+        std::cout << std::endl;
+
+    print_report(emu);
+    return status;
+}
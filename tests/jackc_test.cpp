@@ -0,0 +1,140 @@
+// Compiles every program in tests/ through libjackc from several threads at once and checks that
+// every compilation matches the first one, that a class's output does not depend on the classes
+// compiled along with it, then that broken sources are reported as diagnostics and that a compiler
+// object whose run failed compiles the next program alone.
+// Usage: jackc_test <tests directory>
+
+#include "compiler.hpp"
+#include "jackc.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+static std::vector<jackc::source> load_program(const std::filesystem::path& directory) {
+    std::vector<std::filesystem::path> paths;
+    for(const auto& entry : std::filesystem::directory_iterator(directory)) {
+        if(entry.path().extension() == ".jack")
+            paths.push_back(entry.path());
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<jackc::source> sources;
+    for(const auto& path : paths) {
+        std::ifstream in(path);
+        std::stringstream code;
+        code << in.rdbuf();
+        sources.push_back({path.filename().string(), code.str()});
+    }
+    return sources;
+}
+
+static bool same_outputs(const jackc::result& a, const jackc::result& b) {
+    if(a.outputs.size() != b.outputs.size())
+        return false;
+
+    for(size_t i = 0; i < a.outputs.size(); i++) {
+        if(a.outputs[i].class_name != b.outputs[i].class_name || a.outputs[i].code != b.outputs[i].code)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if(argc != 2) {
+        std::cerr << "Usage: jackc_test <tests directory>" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::vector<jackc::source>> programs;
+    std::vector<jackc::result> expected;
+    for(const auto& entry : std::filesystem::directory_iterator(argv[1])) {
+        if(!entry.is_directory())
+            continue;
+
+        programs.push_back(load_program(entry.path()));
+        expected.push_back(jackc::compile(programs.back()));
+        if(!expected.back().succeeded()) {
+            std::cerr << entry.path() << ": " << expected.back().diagnostics.front().message << std::endl;
+            return 1;
+        }
+    }
+
+    constexpr uint32_t THREADS = 8, ITERATIONS = 10;
+    std::atomic<uint32_t> mismatches = 0;
+    std::vector<std::thread> threads;
+    for(uint32_t t = 0; t < THREADS; t++) {
+        threads.emplace_back([&, t] {
+            for(uint32_t i = 0; i < ITERATIONS; i++) {
+                // Threads start at different programs so different compilations overlap
+                auto p = (t + i) % programs.size();
+                if(!same_outputs(jackc::compile(programs[p]), expected[p]))
+                    mismatches++;
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+
+    if(mismatches > 0) {
+        std::cerr << mismatches << " concurrent compilation(s) differed" << std::endl;
+        return 1;
+    }
+
+    // Statics are numbered per class, so a class compiles to the same bytes whatever comes before it
+    jackc::source counter{"Counter.jack", "class Counter { static int n; function int next() { let n = n + 1; return n; } }"};
+    auto alone = jackc::compile({counter});
+    auto after = jackc::compile({{"Clock.jack", "class Clock { static int t, u; function int now() { return t + u; } }"}, counter});
+    if(!alone.succeeded() || !after.succeeded() || alone.outputs.front().code != after.outputs.back().code) {
+        std::cerr << "Counter.vm depends on the classes compiled along with it" << std::endl;
+        return 1;
+    }
+
+    auto broken = jackc::compile({
+        {"Good.jack", "class Good { function void f() { return; } }"},
+        {"Bad.jack", "class Bad { function void f() { let x = ; } }"}
+    });
+    if(broken.succeeded() || broken.diagnostics.size() != 1 || broken.diagnostics.front().source != "Bad.jack" || !broken.outputs.empty()) {
+        std::cerr << "Broken source was not reported as one diagnostic for Bad.jack" << std::endl;
+        return 1;
+    }
+
+    auto large = jackc::compile({{"Large.jack", "class Large { function int f() { return 1234567890; } }"}});
+    if(large.succeeded() || large.diagnostics.front().message.find("'1234567890'") == std::string::npos) {
+        std::cerr << "Too large a constant was not quoted in full" << std::endl;
+        return 1;
+    }
+
+    auto scratch = std::filesystem::temp_directory_path() / "jackc_test";
+    std::filesystem::remove_all(scratch);
+    std::filesystem::create_directories(scratch / "Bad");
+    std::filesystem::create_directories(scratch / "Good");
+    std::ofstream(scratch / "Bad" / "Bad.jack") << "class Bad { function void f() { let x = ; } }";
+    std::ofstream(scratch / "Good" / "Good.jack") << "class Good { function void f() { return; } }";
+
+    ::compiler reused;
+    bool failed = false;
+    try {
+        reused.run(scratch / "Bad");
+    } catch(const compiler::error&) {
+        failed = true;
+    }
+    try {
+        reused.run(scratch / "Good");
+    } catch(const compiler::error& e) {
+        std::cerr << "Compiling after a failed run: " << e.what() << std::endl;
+        return 1;
+    }
+    std::filesystem::remove_all(scratch);
+    if(!failed) {
+        std::cerr << "Bad.jack compiled" << std::endl;
+        return 1;
+    }
+
+    std::cout << programs.size() << " programs compiled " << THREADS * ITERATIONS << " times on " << THREADS << " threads" << std::endl;
+    return 0;
+}